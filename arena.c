@@ -0,0 +1,140 @@
+/*
+ * arena.c
+ * 
+ * Copyright (C) 2004 PDC, KTH. See COPYING for license details.
+ * 
+ * Region allocation. The arena header lives in the first block, so a small arena
+ * costs exactly one allocation, and one free.
+*/
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "mem.h"
+
+#include "arena.h"
+
+/* ----------------------------------------------------------------------------------------- */
+
+#define	BLOCK_MAX	(1 << 20)	/* Don't let blocks grow larger than this, unless asked to. */
+
+typedef union
+{
+	double	d;
+	void	*p;
+	long	l;
+} Align;
+
+#define	ALIGN(s)	(((s) + sizeof (Align) - 1) & ~(sizeof (Align) - 1))
+
+typedef struct Block	Block;
+
+struct Block
+{
+	Block	*next;
+	size_t	size;		/* Bytes available for allocations, following the header. */
+	size_t	used;
+};
+
+#define	BLOCK_DATA(b)	((char *) (b) + ALIGN(sizeof (Block)))
+
+struct Arena
+{
+	Block	*first;		/* Blocks in allocation order. The first one holds this header. */
+	Block	*current;
+	size_t	next_size;	/* Size of the next block to allocate. */
+};
+
+/* ----------------------------------------------------------------------------------------- */
+
+Arena * arena_new(size_t size)
+{
+	Arena	*arena;
+	Block	*first;
+
+	if(size < 256)
+		size = 256;
+	size = ALIGN(size);
+	if((first = mem_alloc(ALIGN(sizeof *first) + ALIGN(sizeof *arena) + size)) == NULL)
+		return NULL;
+	first->next = NULL;
+	first->size = ALIGN(sizeof *arena) + size;
+	first->used = ALIGN(sizeof *arena);
+	arena = (Arena *) BLOCK_DATA(first);
+	arena->first = arena->current = first;
+	arena->next_size = 2 * size > BLOCK_MAX ? (size > BLOCK_MAX ? size : BLOCK_MAX) : 2 * size;
+
+	return arena;
+}
+
+/* Move on to a block with room for <size> bytes, re-using a cleared one if possible. */
+static Block * grow(Arena *arena, size_t size)
+{
+	Block	*b;
+
+	for(b = arena->current->next; b != NULL; b = b->next)
+	{
+		arena->current = b;
+		if(b->size - b->used >= size)
+			return b;
+	}
+	while(arena->next_size < size)
+		arena->next_size *= 2;
+	if((b = mem_alloc(ALIGN(sizeof *b) + arena->next_size)) == NULL)
+	{
+		LOG_ERR(("Arena failed to allocate %u-byte block", (unsigned int) arena->next_size));
+		return NULL;
+	}
+	b->next = NULL;
+	b->size = arena->next_size;
+	b->used = 0;
+	arena->current->next = b;
+	arena->current = b;
+	if(arena->next_size < BLOCK_MAX)
+		arena->next_size *= 2;
+	return b;
+}
+
+void * arena_alloc(Arena *arena, size_t size)
+{
+	Block	*b;
+	void	*ptr;
+
+	if(arena == NULL)
+		return NULL;
+	size = ALIGN(size);
+	b = arena->current;
+	if(b->size - b->used < size && (b = grow(arena, size)) == NULL)
+		return NULL;
+	ptr = BLOCK_DATA(b) + b->used;
+	b->used += size;
+
+	return ptr;
+}
+
+void arena_clear(Arena *arena)
+{
+	Block	*b;
+
+	if(arena == NULL)
+		return;
+	for(b = arena->first->next; b != NULL; b = b->next)
+		b->used = 0;
+	arena->first->used = ALIGN(sizeof *arena);
+	arena->current = arena->first;
+}
+
+void arena_destroy(Arena *arena)
+{
+	Block	*b, *next;
+
+	if(arena == NULL)
+		return;
+	/* The header lives in the first block, so free that one last. */
+	for(b = arena->first->next; b != NULL; b = next)
+	{
+		next = b->next;
+		mem_free(b);
+	}
+	mem_free(arena->first);
+}
@@ -0,0 +1,31 @@
+/*
+ * arena.h
+ * 
+ * Copyright (C) 2004 PDC, KTH. See COPYING for license details.
+ * 
+ * A region (or "arena") allocator. Memory is handed out by simply bumping a pointer
+ * through large blocks, and can not be freed individually; instead the entire arena
+ * is cleared or destroyed at once. Handy for big structures that die all together,
+ * such as parse trees.
+*/
+
+#if !defined ARENA_H
+#define	ARENA_H
+
+#include <stdlib.h>
+
+typedef struct Arena	Arena;
+
+/* Create a new arena, whose first block holds <size> bytes. Blocks grow geometrically. */
+extern Arena *	arena_new(size_t size);
+
+/* Allocate <size> bytes, suitably aligned for any type. Never freed individually. */
+extern void *	arena_alloc(Arena *arena, size_t size);
+
+/* Forget all allocations, but keep the blocks around for re-use. O(blocks). */
+extern void	arena_clear(Arena *arena);
+
+/* Destroy arena, freeing all memory allocated from it. */
+extern void	arena_destroy(Arena *arena);
+
+#endif		/* ARENA_H */
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Loader throughput benchmark. Runs the loader built against the recording Verse stub (see
+# verse_stub.c) with -bench over the sample files, and over synthetic files made by benchgen at
+# a few scales, printing one line of timings per file. Normally run through "make bench".
+#
+# Set SCALES to change the synthetic sizes (default "1 10 100"), LOADER and BENCHGEN to use other
+# binaries, and LOADER_ARGS to pass extra options, e.g. "-window=16".
+#
+
+LOADER=${LOADER:-./loader-stub}
+BENCHGEN=${BENCHGEN:-./benchgen}
+SCALES=${SCALES:-"1 10 100"}
+TMP=${TMPDIR:-/tmp}/vml-bench.$$
+
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' 0 1 2 15
+
+status=0
+for f in scenes/*.vml tests/*.vml tests/*.vmlb; do
+	$LOADER -q -bench $LOADER_ARGS "$f" | grep '^bench ' || { echo "bench: $f failed" >&2; status=1; }
+done
+for kind in vertices tiles objects; do
+	for scale in $SCALES; do
+		f="$TMP/$kind-$scale.vml"
+		$BENCHGEN $kind $scale > "$f" || exit 1
+		$LOADER -q -bench $LOADER_ARGS "$f" | grep '^bench ' || { echo "bench: $f failed" >&2; status=1; }
+		rm -f "$f"
+	done
+done
+exit $status
@@ -0,0 +1,133 @@
+/*
+ * Generate synthetic VML files for benchmarking the loader. Each file stresses one thing, and
+ * has a size proportional to a given scale factor, so throughput can be compared across sizes:
+ *
+ * vertices	One geometry node, a grid of 32 x 32*scale vertices and the quads between them.
+ * tiles	One bitmap node with three 8-bit layers of 64 x 64*scale pixels, i.e. 64*scale tiles each.
+ * objects	A tree of 50*scale object nodes, four children each, all linked to one small geometry.
+ *
+ * The output is deterministic, so runs are comparable between versions of the loader.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ----------------------------------------------------------------------------------------- */
+
+static void gen_header(FILE *out)
+{
+	fprintf(out, "<?xml version=\"1.0\"?>\n\n<vml version=\"1.0\">\n\n");
+}
+
+static void gen_footer(FILE *out)
+{
+	fprintf(out, "</vml>\n");
+}
+
+/* A geometry node with a <width> x <height> grid of vertices, joined by quads. */
+static void gen_grid(FILE *out, unsigned int id, const char *name, unsigned long width, unsigned long height)
+{
+	unsigned long	x, y;
+
+	fprintf(out, "<node-geometry id=\"n%u\" name=\"%s\">\n <layers>\n  <layer-vertex-xyz name=\"vertex\">\n", id, name);
+	for(y = 0; y < height; y++)
+	{
+		for(x = 0; x < width; x++)
+			fprintf(out, "   <v>%lu %g %g %g</v>\n", y * width + x, x / (double) width - 0.5,
+				((x * 7 + y * 13) % 17) / 170.0, y / (double) width - 0.5);
+	}
+	fprintf(out, "  </layer-vertex-xyz>\n  <layer-polygon-corner-uint32 name=\"polygon\">\n");
+	for(y = 0; y + 1 < height; y++)
+	{
+		for(x = 0; x + 1 < width; x++)
+			fprintf(out, "   <p>%lu %lu %lu %lu</p>\n", y * width + x, y * width + x + 1,
+				(y + 1) * width + x + 1, (y + 1) * width + x);
+	}
+	fprintf(out, "  </layer-polygon-corner-uint32>\n </layers>\n");
+	fprintf(out, " <vertexcrease layer=\"\" default=\"4294967295\"/>\n <edgecrease layer=\"\" default=\"4294967295\"/>\n");
+	fprintf(out, "</node-geometry>\n\n");
+}
+
+static void gen_vertices(FILE *out, unsigned int scale)
+{
+	gen_grid(out, 1, "grid", 32, 32UL * scale);
+	fprintf(out, "<node-object id=\"n2\" name=\"grid\">\n <links>\n  <link node=\"n1\" label=\"geometry\" target=\"0\"/>\n"
+		" </links>\n</node-object>\n\n");
+}
+
+static void gen_tiles(FILE *out, unsigned int scale)
+{
+	const char	*layer[] = { "col_r", "col_g", "col_b" };
+	unsigned long	tx, ty, tiles_y = 8UL * scale;
+	int		i, x, y;
+
+	fprintf(out, "<node-bitmap id=\"n1\" name=\"noise\">\n <dimensions>64 %lu 1</dimensions>\n <layers>\n", 8 * tiles_y);
+	for(i = 0; i < 3; i++)
+	{
+		fprintf(out, "  <layer-uint8 name=\"%s\">\n   <tiles>\n", layer[i]);
+		for(ty = 0; ty < tiles_y; ty++)
+		{
+			for(tx = 0; tx < 8; tx++)
+			{
+				fprintf(out, "    <tile tile_x=\"%lu\" tile_y=\"%lu\" tile_z=\"0\">\n", tx, ty);
+				for(y = 0; y < 8; y++)
+				{
+					fprintf(out, "\t");
+					for(x = 0; x < 8; x++)
+						fprintf(out, " %3lu", ((tx * 8 + x) * (7 + i) + (ty * 8 + y) * 13) % 256);
+					fprintf(out, "\n");
+				}
+				fprintf(out, "    </tile>\n");
+			}
+		}
+		fprintf(out, "   </tiles>\n  </layer-uint8>\n");
+	}
+	fprintf(out, " </layers>\n</node-bitmap>\n\n");
+}
+
+static void gen_objects(FILE *out, unsigned int scale)
+{
+	unsigned long	i, c, count = 50UL * scale;
+
+	gen_grid(out, 1, "cube", 2, 2);
+	for(i = 0; i < count; i++)
+	{
+		fprintf(out, "<node-object id=\"n%lu\" name=\"object-%lu\">\n <transform>\n", i + 2, i);
+		fprintf(out, "  <position>%g 0 %g</position>\n </transform>\n", (double) (i % 4) - 1.5, (double) (i / 4));
+		fprintf(out, " <links>\n  <link node=\"n1\" label=\"geometry\" target=\"0\"/>\n");
+		for(c = 4 * i + 1; c <= 4 * i + 4 && c < count; c++)
+			fprintf(out, "  <link node=\"n%lu\" label=\"child\" target=\"4294967295\"/>\n", c + 2);
+		fprintf(out, " </links>\n</node-object>\n\n");
+	}
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	int	scale;
+
+	if(argc != 3 || (scale = atoi(argv[2])) < 1)
+	{
+		fprintf(stderr, "Usage: %s vertices|tiles|objects SCALE\nWrites synthetic VML of the given kind and size to standard output.\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	gen_header(stdout);
+	if(strcmp(argv[1], "vertices") == 0)
+		gen_vertices(stdout, scale);
+	else if(strcmp(argv[1], "tiles") == 0)
+		gen_tiles(stdout, scale);
+	else if(strcmp(argv[1], "objects") == 0)
+		gen_objects(stdout, scale);
+	else
+	{
+		fprintf(stderr, "benchgen: Unknown kind \"%s\"\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	gen_footer(stdout);
+	return EXIT_SUCCESS;
+}
@@ -11,67 +11,35 @@
 
 #include "log.h"
 #include "mem.h"
-#include "memchunk.h"
 
 #include "hash.h"
 
 /* ----------------------------------------------------------------------------------------- */
 
-typedef struct HashEl	HashEl;
-
-struct HashEl {
+/* The table uses open addressing with linear probing, in a power-of-two sized array of slots.
+ * Each slot stores the full hash of its key, so growing never calls the hash function again
+ * and most non-matching keys are skipped without calling the key comparison function. Removal
+ * shifts the following elements of the cluster back, so there are no tombstones. Duplicate keys
+ * are allowed; the most recently inserted one is the one found (and removed), as before.
+*/
+typedef struct
+{
 	const void	*key;
 	void		*data;
-	HashEl		*next;
-};
-
-static MemChunk	*the_chunk = NULL;
+	unsigned int	hash;
+	int		used;
+} HashSlot;
 
 struct Hash
 {
-	HashEl		**vector;
-	size_t		length;
-	size_t		size;
+	HashSlot	*slot;
+	size_t		length;		/* Number of slots, zero or a power of two. */
+	size_t		size;		/* Number of slots in use. */
 	HashFunc	hfunc;
 	HashKeyEqFunc	kefunc;
 };
 
-/* Some prime numbers. Picked from <http://www.utm.edu/research/primes/lists/small/1000.txt>. */
-static const unsigned int the_primes[] = {
-     11,     13,     17,     19,     23,     29,
-     31,     37,     41,     43,     47,     53,     59,     61,     67,     71, 
-     73,     79,     83,     89,     97,    101,    103,    107,    109,    113, 
-    127,    131,    137,    139,    149,    151,    157,    163,    167,    173, 
-    179,    181,    191,    193,    197,    199,    211,    223,    227,    229, 
-    233,    239,    241,    251,    257,    263,    269,    271,    277,    281, 
-    283,    293,    307,    311,    313,    317,    331,    337,    347,    349, 
-    353,    359,    367,    373,    379,    383,    389,    397,    401,    409, 
-    419,    421,    431,    433,    439,    443,    449,    457,    461,    463, 
-    467,    479,    487,    491,    499,    503,    509,    521,    523,    541, 
-    547,    557,    563,    569,    571,    577,    587,    593,    599,    601, 
-    607,    613,    617,    619,    631,    641,    643,    647,    653,    659, 
-    661,    673,    677,    683,    691,    701,    709,    719,    727,    733, 
-    739,    743,    751,    757,    761,    769,    773,    787,    797,    809, 
-    811,    821,    823,    827,    829,    839,    853,    857,    859,    863, 
-    877,    881,    883,    887,    907,    911,    919,    929,    937,    941,
-   1069,   1223,   1373,   1511,   2053,   2531,   2903,   3511,   4297,   5179,
-   5521,   6571,   7561,   7919
-};
-
-/* ----------------------------------------------------------------------------------------- */
-
-/* Return the closest prime n such that x <= n. Breaks horribly for x larger than table above indicates. */
-static unsigned int get_prime(unsigned int x)
-{
-	unsigned int	j;
-
-	for(j = 0; j < sizeof the_primes / sizeof *the_primes; j++)
-	{
-		if(x <= the_primes[j])
-			return the_primes[j];
-	}
-	return the_primes[sizeof the_primes / sizeof *the_primes - 1];
-}
+#define	HASH_MIN_LENGTH	16
 
 /* ----------------------------------------------------------------------------------------- */
 
@@ -95,11 +63,22 @@ static int string_key_eq(const void *key1, const void *key2)
 	return strcmp(key1, key2) == 0;
 }
 
+/* Return the home slot of hash <h>. The bits are mixed first, since the table only looks at the
+ * low ones and user hash functions (like djb2, above) don't spread those very well.
+*/
+static size_t home(const Hash *hash, unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+	return h & (hash->length - 1);
+}
+
 /* ----------------------------------------------------------------------------------------- */
 
 void hash_init(void)
 {
-	the_chunk = memchunk_new("HashEl", sizeof (HashEl), 16);
+	/* Nothing to do; the table no longer shares any allocator between instances. */
 }
 
 /* ----------------------------------------------------------------------------------------- */
@@ -112,7 +91,7 @@ Hash * hash_new(HashFunc hfunc, HashKeyEqFunc kefunc)
 		return NULL;
 
 	hash = mem_alloc(sizeof *hash);
-	hash->vector = NULL;
+	hash->slot   = NULL;
 	hash->length = 0;
 	hash->size   = 0;
 	hash->hfunc  = hfunc;
@@ -126,99 +105,140 @@ Hash * hash_new_string(void)
 	return hash_new(hash_hash_string, string_key_eq);
 }
 
-static void resize(Hash *hash)
+/* Double the number of slots, and re-insert everything. Elements are moved in cluster order, so
+ * duplicate keys keep their relative order.
+*/
+static int resize(Hash *hash)
 {
-	size_t	new_len, i, h;
-	HashEl	**nv, *iter, *next;
+	size_t		new_len, old_len = hash->length, i, start, j;
+	HashSlot	*old = hash->slot, *ns;
 
-	new_len = get_prime(hash->length + 1);
-	nv = mem_alloc(new_len * sizeof *nv);
-	if(nv != NULL)
+	new_len = old_len > 0 ? 2 * old_len : HASH_MIN_LENGTH;
+	if((ns = mem_alloc(new_len * sizeof *ns)) == NULL)
 	{
-		for(i = 0; i < new_len; i++)
-			nv[i] = NULL;
-/*		LOG_MSG(("Growing from %u to %u elements", hash->length, new_len));*/
-		for(i = 0; i < hash->length; i++)
-		{
-			for(iter = hash->vector[i]; iter != NULL; iter = next)
-			{
-				next = iter->next;
-				h = hash->hfunc(iter->key) % new_len;
-				iter->next = nv[h];
-				nv[h] = iter;
-			}
-		}
-		mem_free(hash->vector);
-		hash->vector = nv;
-		hash->length = new_len;
-	}
-	else
 		LOG_ERR(("Hash resize failed, out of memory"));
+		return 0;
+	}
+	for(i = 0; i < new_len; i++)
+		ns[i].used = 0;
+	hash->slot = ns;
+	hash->length = new_len;
+	/* Start right after an empty slot, so no cluster is split across the wrap-around. */
+	for(start = 0; start < old_len && old[start].used; start++)
+		;
+	for(i = 0; i < old_len; i++)
+	{
+		const HashSlot	*s = old + (start + i) % old_len;
+
+		if(!s->used)
+			continue;
+		for(j = home(hash, s->hash); ns[j].used; j = (j + 1) & (new_len - 1))
+			;
+		ns[j] = *s;
+	}
+	mem_free(old);
+	return 1;
 }
 
 void hash_insert(Hash *hash, const void *key, void *data)
 {
-	unsigned int	h;
-	HashEl		*el;
+	HashSlot	put, tmp;
+	size_t		i;
 
 	if(hash == NULL)
 		return;
 
-	if(hash->size >= hash->length)
-		resize(hash);
+	if(4 * (hash->size + 1) > 3 * hash->length && !resize(hash))
+		return;
 
-	h = hash->hfunc(key);
-	h %= hash->length;
-	el = memchunk_alloc(the_chunk);
-	if(el != NULL)
+	put.key  = key;
+	put.data = data;
+	put.hash = hash->hfunc(key);
+	put.used = 1;
+	/* A duplicate key takes the place of the existing one, which moves on down the cluster. That
+	 * way, lookups find the newest, just like they did when chaining.
+	*/
+	for(i = home(hash, put.hash); hash->slot[i].used; i = (i + 1) & (hash->length - 1))
 	{
-		el->key  = key;
-		el->data = data;
-		el->next = hash->vector[h];
-		hash->vector[h] = el;
-		hash->size++;
+		if(hash->slot[i].hash == put.hash && hash->kefunc(key, hash->slot[i].key))
+		{
+			tmp = hash->slot[i];
+			hash->slot[i] = put;
+			put = tmp;
+		}
 	}
-	else
-		LOG_WARN(("Hash element allocation failed"));
+	hash->slot[i] = put;
+	hash->size++;
 }
 
-void * hash_lookup(const Hash *hash, const void *key)
+/* Find the slot holding <key>, or return -1. */
+static long find(const Hash *hash, const void *key)
 {
 	unsigned int	h;
-	const HashEl	*el;
+	size_t		i;
 
 	if(hash == NULL || hash->size == 0)
-		return NULL;
-	h = hash->hfunc(key) % hash->length;
-	for(el = hash->vector[h]; el != NULL; el = el->next)
+		return -1;
+	h = hash->hfunc(key);
+	for(i = home(hash, h); hash->slot[i].used; i = (i + 1) & (hash->length - 1))
 	{
-		if(hash->kefunc(key, el->key))
-			return el->data;
+		if(hash->slot[i].hash == h && hash->kefunc(key, hash->slot[i].key))
+			return (long) i;
 	}
-	return NULL;
+	return -1;
+}
+
+void * hash_lookup(const Hash *hash, const void *key)
+{
+	long	i;
+
+	if((i = find(hash, key)) < 0)
+		return NULL;
+	return hash->slot[i].data;
 }
 
 void hash_remove(Hash *hash, const void *key)
 {
-	unsigned int	h;
-	HashEl		*prev, *iter;
+	size_t	mask, i, j, h;
+	long	pos;
 
-	if(hash == NULL)
+	if((pos = find(hash, key)) < 0)
 		return;
-	h = hash->hfunc(key) % hash->length;
-	for(prev = NULL, iter = hash->vector[h]; iter != NULL; prev = iter, iter = iter->next)
+	mask = hash->length - 1;
+	/* Shift later elements of the cluster back into the hole, unless that would move one to
+	 * before its home slot. This keeps every element reachable without tombstones.
+	*/
+	for(i = (size_t) pos, j = (i + 1) & mask; hash->slot[j].used; j = (j + 1) & mask)
 	{
-		if(hash->kefunc(key, iter->key))
+		h = home(hash, hash->slot[j].hash);
+		if(((j - h) & mask) >= ((j - i) & mask))
 		{
-			if(prev != NULL)
-				prev->next = iter->next;
-			else
-				hash->vector[h] = iter->next;
-			memchunk_free(the_chunk, iter);
-			hash->size--;
-			return;
+			hash->slot[i] = hash->slot[j];
+			i = j;
 		}
 	}
+	hash->slot[i].used = 0;
+	hash->size--;
+}
+
+void hash_clear(Hash *hash)
+{
+	size_t	i;
+
+	if(hash == NULL || hash->size == 0)
+		return;
+	/* Drop a slot array that is much larger than what was just used, so that clearing doesn't
+	 * stay expensive after a one-off large fill.
+	*/
+	if(hash->length > 4 * HASH_MIN_LENGTH && 8 * hash->size < hash->length)
+	{
+		mem_free(hash->slot);
+		hash->slot = NULL;
+		hash->length = 0;
+	}
+	for(i = 0; i < hash->length; i++)
+		hash->slot[i].used = 0;
+	hash->size = 0;
 }
 
 size_t hash_size(const Hash *hash)
@@ -230,20 +250,15 @@ size_t hash_size(const Hash *hash)
 
 void hash_foreach(const Hash *hash, int (*func)(void *data, void *user), void *user)
 {
-	unsigned int	i;
+	size_t	i;
 
 	if(hash == NULL || func == NULL)
 		return;
 
 	for(i = 0; i < hash->length; i++)
 	{
-		const HashEl	*iter;
-
-		for(iter = hash->vector[i]; iter != NULL; iter = iter->next)
-		{
-			if(!func(iter->data, user))
-				return;
-		}
+		if(hash->slot[i].used && !func(hash->slot[i].data, user))
+			return;
 	}
 }
 
@@ -251,19 +266,7 @@ void hash_destroy(Hash *hash)
 {
 	if(hash != NULL)
 	{
-		unsigned int	i;
-
-		for(i = 0; i < hash->length; i++)
-		{
-			HashEl	*iter, *next;
-
-			for(iter = hash->vector[i]; iter != NULL; iter = next)
-			{
-				next = iter->next;
-				memchunk_free(the_chunk, iter);
-			}
-		}
-		mem_free(hash->vector);
+		mem_free(hash->slot);
 		mem_free(hash);
 	}
 }
@@ -28,6 +28,9 @@ extern void	hash_insert(Hash *hash, const void *key, void *data);
 extern void *	hash_lookup(const Hash *hash, const void *key);
 extern void	hash_remove(Hash *hash, const void *key);
 
+/* Remove all elements, keeping the table for re-use. */
+extern void	hash_clear(Hash *hash);
+
 extern size_t	hash_size(const Hash *hash);
 
 extern void	hash_foreach(const Hash *hash, int (*func)(void *data, void *user), void *user);
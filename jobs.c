@@ -0,0 +1,174 @@
+/*
+ * A tiny worker pool, used by the loader to parse several files at once. Threads pick items
+ * off a shared counter until there are none left; there is no queue as such, since all the
+ * work is known up front.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stdlib.h>
+
+#if defined __unix__ || defined __APPLE__
+#define	JOBS_PTHREADS
+#include <pthread.h>
+#elif defined _WIN32
+#define	JOBS_WIN32
+#include <windows.h>
+#endif
+
+#include "jobs.h"
+
+/* ----------------------------------------------------------------------------------------- */
+
+#define	JOBS_MAX	64	/* Max number of threads to run at once. */
+
+typedef struct
+{
+	char		*items;
+	size_t		num, size;
+	size_t		next;		/* Index of next item to hand out. */
+	void		(*func)(void *item, void *user);
+	void		*user;
+} Jobs;
+
+#if defined JOBS_PTHREADS
+
+static pthread_mutex_t	jobs_next_lock = PTHREAD_MUTEX_INITIALIZER,
+			jobs_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define	NEXT_LOCK()	pthread_mutex_lock(&jobs_next_lock)
+#define	NEXT_UNLOCK()	pthread_mutex_unlock(&jobs_next_lock)
+
+#elif defined JOBS_WIN32
+
+static CRITICAL_SECTION	jobs_next_lock, jobs_shared_lock;
+static int		jobs_locks_ready = 0;
+
+#define	NEXT_LOCK()	EnterCriticalSection(&jobs_next_lock)
+#define	NEXT_UNLOCK()	LeaveCriticalSection(&jobs_next_lock)
+
+#else
+
+#define	NEXT_LOCK()
+#define	NEXT_UNLOCK()
+
+#endif
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* Do items until there are none left. This is the body of each worker thread. */
+static void jobs_work(Jobs *jobs)
+{
+	size_t	i;
+
+	for(;;)
+	{
+		NEXT_LOCK();
+		i = jobs->next < jobs->num ? jobs->next++ : jobs->num;
+		NEXT_UNLOCK();
+		if(i >= jobs->num)
+			break;
+		jobs->func(jobs->items + i * jobs->size, jobs->user);
+	}
+}
+
+#if defined JOBS_PTHREADS
+
+static void * jobs_thread(void *data)
+{
+	jobs_work(data);
+	return NULL;
+}
+
+#elif defined JOBS_WIN32
+
+static DWORD WINAPI jobs_thread(LPVOID data)
+{
+	jobs_work(data);
+	return 0;
+}
+
+#endif
+
+void jobs_run(void *items, size_t num, size_t size, void (*func)(void *item, void *user), void *user, unsigned int threads)
+{
+	Jobs		jobs;
+	unsigned int	i, started = 0;
+
+	jobs.items = items;
+	jobs.num   = num;
+	jobs.size  = size;
+	jobs.next  = 0;
+	jobs.func  = func;
+	jobs.user  = user;
+
+	if(threads > num)
+		threads = num;
+	if(threads > JOBS_MAX)
+		threads = JOBS_MAX;
+#if defined JOBS_PTHREADS
+	if(threads > 1)
+	{
+		pthread_t	thread[JOBS_MAX];
+
+		/* The calling thread works too, so start one less. Any that fail to start just
+		 * leave more items for the others.
+		*/
+		for(i = 0; i < threads - 1; i++)
+		{
+			if(pthread_create(&thread[started], NULL, jobs_thread, &jobs) == 0)
+				started++;
+		}
+		jobs_work(&jobs);
+		for(i = 0; i < started; i++)
+			pthread_join(thread[i], NULL);
+		return;
+	}
+#elif defined JOBS_WIN32
+	if(!jobs_locks_ready)
+	{
+		InitializeCriticalSection(&jobs_next_lock);
+		InitializeCriticalSection(&jobs_shared_lock);
+		jobs_locks_ready = 1;
+	}
+	if(threads > 1)
+	{
+		HANDLE	thread[JOBS_MAX];
+
+		for(i = 0; i < threads - 1; i++)
+		{
+			if((thread[started] = CreateThread(NULL, 0, jobs_thread, &jobs, 0, NULL)) != NULL)
+				started++;
+		}
+		jobs_work(&jobs);
+		WaitForMultipleObjects(started, thread, TRUE, INFINITE);
+		for(i = 0; i < started; i++)
+			CloseHandle(thread[i]);
+		return;
+	}
+#endif
+	(void) started;
+	(void) i;
+	jobs_work(&jobs);
+}
+
+void jobs_lock(void *user)
+{
+#if defined JOBS_PTHREADS
+	pthread_mutex_lock(&jobs_shared_lock);
+#elif defined JOBS_WIN32
+	if(jobs_locks_ready)
+		EnterCriticalSection(&jobs_shared_lock);
+#endif
+}
+
+void jobs_unlock(void *user)
+{
+#if defined JOBS_PTHREADS
+	pthread_mutex_unlock(&jobs_shared_lock);
+#elif defined JOBS_WIN32
+	if(jobs_locks_ready)
+		LeaveCriticalSection(&jobs_shared_lock);
+#endif
+}
@@ -0,0 +1,21 @@
+/*
+ * Header file for the tiny worker pool used by the loader to parse files in parallel.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stddef.h>
+
+/* Call <func> once for each of the <num> items in the array <items>, whose elements are <size>
+ * bytes each, using up to <threads> threads. Items are handed out in order, but may complete in
+ * any order. Returns when all items are done. On platforms without thread support, or if there
+ * is just one thread, everything is simply done by the calling thread.
+*/
+extern void	jobs_run(void *items, size_t num, size_t size, void (*func)(void *item, void *user), void *user, unsigned int threads);
+
+/* A single global lock, for serializing access to shared state from within jobs. The (ignored)
+ * argument makes these directly usable as callbacks, e.g. for xmlnode_set_lock().
+*/
+extern void	jobs_lock(void *user);
+extern void	jobs_unlock(void *user);
@@ -338,3 +338,108 @@ void list_destroy(List *list)
 		memchunk_free(the_chunk, list);
 	}
 }
+
+/* ----------------------------------------------------------------------------------------- */
+
+void list_head_init(ListHead *head)
+{
+	head->first = head->last = NULL;
+	head->length = 0;
+}
+
+List * list_head_append(ListHead *head, void *data)
+{
+	List	*el;
+
+	if((el = list_new(data)) != NULL)
+	{
+		if(head->last != NULL)
+		{
+			head->last->next = el;
+			el->prev = head->last;
+		}
+		else
+			head->first = el;
+		head->last = el;
+		head->length++;
+	}
+	return el;
+}
+
+List * list_head_prepend(ListHead *head, void *data)
+{
+	List	*el;
+
+	if((el = list_new(data)) != NULL)
+	{
+		if(head->first != NULL)
+		{
+			head->first->prev = el;
+			el->next = head->first;
+		}
+		else
+			head->last = el;
+		head->first = el;
+		head->length++;
+	}
+	return el;
+}
+
+void list_head_concat(ListHead *head, List *list)
+{
+	if(list == NULL)
+		return;
+	if(head->last != NULL)
+		head->last->next = list;
+	else
+		head->first = list;
+	list->prev = head->last;
+	for(head->length++; list->next != NULL; list = list->next, head->length++)	/* Find new last. */
+		;
+	head->last = list;
+}
+
+void list_head_unlink(ListHead *head, List *element)
+{
+	if(element == NULL)
+		return;
+	if(element == head->first)
+		head->first = element->next;
+	if(element == head->last)
+		head->last = element->prev;
+	if(element->prev != NULL)
+		element->prev->next = element->next;
+	if(element->next != NULL)
+		element->next->prev = element->prev;
+	element->prev = element->next = NULL;
+	head->length--;
+}
+
+List * list_head_first(const ListHead *head)
+{
+	return head->first;
+}
+
+List * list_head_last(const ListHead *head)
+{
+	return head->last;
+}
+
+size_t list_head_length(const ListHead *head)
+{
+	return head->length;
+}
+
+List * list_head_detach(ListHead *head)
+{
+	List	*list = head->first;
+
+	list_head_init(head);
+	return list;
+}
+
+void list_head_destroy(ListHead *head)
+{
+	list_destroy(head->first);
+	list_head_init(head);
+}
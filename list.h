@@ -45,4 +45,31 @@ extern List *	list_find_sorted(const List *list, const void *data, int (*compare
 
 extern void	list_destroy(List *list);
 
+/* A list header, tracking both ends of a list and its length. This makes appending and finding the
+ * length O(1), so it's the thing to use when building long lists front to back. The members are
+ * only exposed so that headers can live on the stack; use the functions below to access them.
+*/
+typedef struct
+{
+	List	*first, *last;
+	size_t	length;
+} ListHead;
+
+extern void	list_head_init(ListHead *head);
+
+extern List *	list_head_append(ListHead *head, void *data);
+extern List *	list_head_prepend(ListHead *head, void *data);
+/* Append an entire plain list, whose elements are taken over by the header. */
+extern void	list_head_concat(ListHead *head, List *list);
+/* Unlink an element from the list, without destroying it. */
+extern void	list_head_unlink(ListHead *head, List *element);
+
+extern List *	list_head_first(const ListHead *head);
+extern List *	list_head_last(const ListHead *head);
+extern size_t	list_head_length(const ListHead *head);
+
+/* Return the list held by the header, and make the header empty. The caller owns the list. */
+extern List *	list_head_detach(ListHead *head);
+extern void	list_head_destroy(ListHead *head);
+
 #endif
@@ -6,11 +6,13 @@
  * under the GPL license, see the COPYING.loader file for details.
 */
 
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "dynstr.h"
 #include "hash.h"
 #include "list.h"
@@ -19,24 +21,49 @@
 
 #include "verse.h"
 
+#include "jobs.h"
+#include "numscan.h"
+#include "timer.h"
 #include "typemaps.h"
+#include "vmlb.h"
 
 typedef enum
 {
 	PEND_NONE = 0, PEND_CONNECT, PEND_NODE_CREATE, PEND_TAGGROUP_CREATE,
 	PEND_METHODGROUP_CREATE,
-	PEND_LAYER_CREATE, PEND_FRAGMENT_CREATE, PEND_CURVE_CREATE, PEND_BUFFER_CREATE
+	PEND_LAYER_CREATE, PEND_FRAGMENT_CREATE, PEND_CURVE_CREATE, PEND_BUFFER_CREATE,
+	PEND_STATES
 } Pending;
 
-typedef struct {
-	char	name[32];
-	uint32	id;		/* Less casting, this way. */
-} Entry;
+typedef struct Entry	Entry;
+
+struct Entry {
+	char		kind;		/* What is named: 'T' for tag group, 'M' for method group, etc. */
+	const char	*name;		/* Copy, in the dictionary's arena. */
+	uint32		id;		/* Less casting, this way. */
+	Entry		*prev, *next;
+};
 
+/* Maps a kind and a name to an ID. Entries live in an arena, which is cleared rather than freed
+ * along with the dictionary, so one that is refilled for every node soon stops allocating.
+*/
 typedef struct {
-	List	*entries;		/* List of Entry. */
+	Hash		*index;		/* Entries, hashed on kind and name. */
+	Arena		*arena;
+	Entry		*first;		/* All entries, most recently added first. */
 } Dict;
 
+/* Translates IDs used in the file into IDs on the server. IDs are mostly small and dense, so they
+ * index an array that grows by doubling; one far beyond the array's end goes into a hash instead,
+ * so that a few huge IDs don't cost memory in proportion to their value. Unknown IDs map to ~0.
+*/
+typedef struct {
+	uint32		*dense;
+	size_t		dense_size;
+	size_t		count;		/* Number of IDs set, which bounds the size of the array. */
+	Hash		*sparse;	/* Remote ID plus one, keyed on local ID. */
+} IdMap;
+
 typedef struct
 {
 	char		name[32];
@@ -44,40 +71,80 @@ typedef struct
 } LayerID;
 
 typedef struct {
-	boolean		visited;
-	boolean		circular;
-	unsigned int	count;
+	unsigned int	children;	/* Child links to objects that are not yet placed, for sorting. */
+	ListHead	parents;	/* LinkInfo of objects that link to this one as a child. */
 	const char	*id;		/* Points at value of xmlnode's "id" attribute. */
 	XmlNode		*node;
 } LinkInfo;
 
+/* In streaming mode, bulk data is uploaded in a second pass over each file, once the layers
+ * (and buffers) that hold it have been created. This remembers where each one ended up.
+*/
+typedef struct
+{
+	char		key[64];	/* Node ordinal in file and layer name, e.g. "3/vertex". */
+	VNodeID		node_id;
+	VLayerID	layer_id;
+	int		type;		/* Geometry, bitmap or audio layer type, as per node. */
+} StreamLayer;
+
+/* A node create that has been sent. These are kept until step() has reached the node, and
+ * the server has replied, whichever happens last.
+*/
+typedef struct
+{
+	const XmlNode	*node;
+	VNodeType	type;
+	VNodeID		id;		/* ~0 until created. */
+	double		sent;		/* Time the create was sent, for measuring the round trip. */
+} NodeCreate;
+
 typedef struct
 {
 	List		*files;		/* Files as loaded, top-level XmlNode from each. */
 	List		*file_iter;	/* Iterator over files. */
+	int		merge;		/* Upload all files as one, rather than one at a time? */
 	List		*file_nodes;	/* Children of <vml> element, re-sorted for better uploading. */
 	const List	*iter;		/* Iterator over file_nodes. */
 	int		skip_objects;	/* How do we react to object nodes in step()? Skip, or process. */
+	int		window;		/* Number of nodes to have creates out for, counting the current one. */
+	unsigned int	batch;		/* Max number of elements to step through between network updates. */
+	unsigned int	send_queue;	/* Stop stepping while the outgoing queue is at least this large. */
+	const List	*create_iter;	/* Look-ahead iterator, finds nodes to send creates for. */
+	unsigned int	nodes_sent;	/* Node creates sent so far in this pass. */
+	unsigned int	nodes_reached;	/* Nodes reached by step() so far in this pass. */
+	ListHead	creating;	/* NodeCreate for nodes not both reached and created, in send order. */
 	VNodeType	type;
 	const XmlNode	*node;
 	VNodeID		node_id;
 	Pending		pending;
 	int		pend_count;
-	Dict		tag_groups;
-	Dict		layer_ids;	/* Temporary structure for tracking layers. */
+	double		pend_since;	/* Time of the first pend_add() since nothing was pending. */
+	Dict		ids;		/* IDs of tag groups ('T'), method groups ('M') and layers ('L'). */
+
+	int		assign_ids;	/* Assign layer, tag group etc IDs ourselves, rather than wait? */
+	int		assigning;	/* Doing so in the current node? Cleared when redoing a node. */
+	int		reassign;	/* Set if the server did not accept an assigned ID. */
+	Dict		assigned;	/* IDs assigned in the current node, until confirmed by the server. */
+	const List	*node_start;	/* First element of current node's contents, for redoing it. */
 
 	double		o_pos_scale;
 	double		g_xyz_scale;
 
-	VNMFragmentID	*fragment_map;
-	size_t		fragment_map_size;
-
-	VNodeID		*node_map;
-	size_t		node_map_size;
+	IdMap		fragment_map;
+	IdMap		node_map;
 
 	VNodeID		avatar;
 
+	int		stream;		/* Stream bulk data from file, rather than keep it in memory? */
+	Hash		*stream_layers;	/* Hash of StreamLayer, keyed on node ordinal and name. */
+
 	int		log_level;
+
+	int		bench;		/* Print timings for each upload? */
+	double		time_order;	/* Seconds spent ordering nodes, in file_begin(). */
+	double		time_sort;	/* Seconds spent flattening them into elements, in sort_nodes(). */
+	unsigned long	elements;	/* Number of elements in file_nodes. */
 } MainInfo;
 
 /* ----------------------------------------------------------------------------------------- */
@@ -95,106 +162,572 @@ static void message(const MainInfo *min, int level, const char *fmt, ...)
 
 /* ----------------------------------------------------------------------------------------- */
 
+/* Instrumentation: counters and times that show whether a load is bound by parsing, by waiting
+ * for the server's replies, or by sending. These are global rather than in MainInfo, so that the
+ * signal handler can ask for a dump; the dump itself is done from the main loop.
+*/
+
+/* A histogram of latencies, on a log scale. Bucket i counts samples of at least 2^i but less
+ * than 2^(i+1) microseconds, except that bucket 0 also takes anything shorter, and the last one
+ * anything longer.
+*/
+#define	HIST_BUCKETS	32
 
-static void dict_ctor(Dict *dict)
+typedef struct
+{
+	unsigned long	count;
+	double		sum, max;
+	unsigned long	bucket[HIST_BUCKETS];
+} Histogram;
+
+typedef enum
 {
-	dict->entries = NULL;
+	SEND_SESSION = 0, SEND_NODE, SEND_TAG, SEND_OBJECT, SEND_GEOMETRY, SEND_MATERIAL,
+	SEND_BITMAP, SEND_TEXT, SEND_CURVE, SEND_AUDIO,
+	SEND_FAMILIES
+} SendFamily;
+
+static struct
+{
+	const char		*filename;	/* Where to dump, "-" for standard error. NULL if disabled. */
+	volatile sig_atomic_t	requested;	/* Set by the signal handler. */
+	double			start;
+	unsigned long		files, bytes;	/* Files loaded, and their size. */
+	unsigned long		elements;	/* Elements in the trees that were uploaded. */
+	unsigned long		steps;		/* Calls to step(), which does an element and maybe its children. */
+	unsigned long		sent[SEND_FAMILIES];	/* Commands sent, per verse_send_* family. */
+	double			time_read, time_parse, time_order, time_sort, time_process;
+	double			time_network;		/* Total time in verse_callback_update(). */
+	double			blocked[PEND_STATES];	/* Time blocked on the network, per pending state. */
+	unsigned long		waits[PEND_STATES];
+	Histogram		latency[PEND_STATES];	/* Round trip times of creates, per pending state. */
+} stats;
+
+/* Make the verse_send_*() <call>, counting it as sent in <family> (SEND_ prefix left out). */
+#define	SEND(family, call)	do { stats.sent[SEND_##family]++; call; } while(0)
+
+static const char	*pend_name[] = { "none", "connect", "node_create", "taggroup_create", "methodgroup_create",
+				 "layer_create", "fragment_create", "curve_create", "buffer_create" };
+
+static void hist_add(Histogram *h, double seconds)
+{
+	double	us = seconds * 1E6;
+	int	i;
+
+	for(i = 0; i < HIST_BUCKETS - 1 && us >= 2.0; i++)
+		us /= 2.0;
+	h->bucket[i]++;
+	h->count++;
+	h->sum += seconds;
+	if(seconds > h->max)
+		h->max = seconds;
+}
+
+/* Return the <p>:th quantile of the samples, in seconds. This is the upper limit of the bucket the
+ * quantile falls in, so it's an over-estimate by at most a factor of two; never more than the max.
+*/
+static double hist_quantile(const Histogram *h, double p)
+{
+	unsigned long	seen = 0, want;
+	double		limit;
+	int		i;
+
+	if(h->count == 0)
+		return 0.0;
+	want = p * h->count + 0.5;
+	if(want < 1)
+		want = 1;
+	for(i = 0, limit = 2E-6; i < HIST_BUCKETS - 1; i++, limit *= 2.0)
+	{
+		if((seen += h->bucket[i]) >= want)
+			break;
+	}
+	return limit < h->max ? limit : h->max;
 }
 
-static void dict_clear(Dict *dict)
+/* Record a round trip for <state> that started at <since>. */
+static void stats_latency(Pending state, double since)
 {
-	List	*iter;
+	hist_add(&stats.latency[state], timer_now() - since);
+}
 
-	for(iter = dict->entries; iter != NULL; iter = list_next(iter))
-		mem_free(list_data(iter));
-	list_destroy(dict->entries);
-	dict->entries = NULL;
+/* Service the network, waiting up to <timeout> microseconds. If that's a wait, the time is charged
+ * to <state>: what we're blocked on. A wait with nothing pending means the send queue is full.
+*/
+static void stats_wait(Pending state, uint32 timeout)
+{
+	double	t0 = timer_now(), t;
+
+	verse_callback_update(timeout);
+	t = timer_now() - t0;
+	stats.time_network += t;
+	if(timeout > 0)
+	{
+		stats.blocked[state] += t;
+		stats.waits[state]++;
+	}
 }
 
-static Entry * dict_find(const Dict *dict, const char *name)
+/* Write the counters so far as a JSON object. */
+static void stats_dump(void)
 {
-	List	*iter;
+	static const char	*family[] = { "session", "node", "tag", "o", "g", "m", "b", "t", "c", "a" };
+	FILE			*out;
+	const Histogram		*h;
+	int			i;
 
-	for(iter = dict->entries; iter != NULL; iter = list_next(iter))
+	stats.requested = 0;
+	if(stats.filename == NULL)
+		return;
+	if(strcmp(stats.filename, "-") == 0)
+		out = stderr;
+	else if((out = fopen(stats.filename, "w")) == NULL)
 	{
-		if(strcmp(name, ((Entry *) list_data(iter))->name) == 0)
-			return list_data(iter);
+		fprintf(stderr, "loader: Couldn't open \"%s\" for writing statistics\n", stats.filename);
+		return;
 	}
-	return NULL;
+	fprintf(out, "{\n \"elapsed\": %.6f,\n \"files\": %lu,\n \"bytes_parsed\": %lu,\n \"elements\": %lu,\n \"steps\": %lu,\n",
+		timer_now() - stats.start, stats.files, stats.bytes, stats.elements, stats.steps);
+	fprintf(out, " \"time\": { \"read\": %.6f, \"parse\": %.6f, \"order\": %.6f, \"sort\": %.6f, \"process\": %.6f, \"network\": %.6f },\n",
+		stats.time_read, stats.time_parse, stats.time_order, stats.time_sort, stats.time_process, stats.time_network);
+	fprintf(out, " \"sent\": {");
+	for(i = 0; i < SEND_FAMILIES; i++)
+		fprintf(out, "%s \"%s\": %lu", i > 0 ? "," : "", family[i], stats.sent[i]);
+	fprintf(out, " },\n \"blocked\": {\n");
+	for(i = 0; i < PEND_STATES; i++)
+		fprintf(out, "  \"%s\": { \"seconds\": %.6f, \"waits\": %lu }%s\n", pend_name[i], stats.blocked[i], stats.waits[i], i < PEND_STATES - 1 ? "," : "");
+	fprintf(out, " },\n \"latency\": {\n");
+	for(i = 1; i < PEND_STATES; i++)
+	{
+		h = &stats.latency[i];
+		fprintf(out, "  \"%s\": { \"count\": %lu, \"mean\": %.6f, \"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f }%s\n",
+			pend_name[i], h->count, h->count > 0 ? h->sum / h->count : 0.0, hist_quantile(h, 0.5), hist_quantile(h, 0.99), h->max,
+			i < PEND_STATES - 1 ? "," : "");
+	}
+	fprintf(out, " }\n}\n");
+	if(out == stderr)
+		fflush(out);
+	else
+		fclose(out);
 }
 
-static void dict_set(Dict *dict, const char *name, uint32 id)
+static void stats_signal(int sig)
 {
-	Entry	*e;
+	stats.requested = 1;
+	signal(sig, stats_signal);	/* Some systems reset the handler. */
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* Element names that the loader dispatches on. These are interned before anything is parsed, so
+ * their atoms are known up front, and equal to the A_ constants below.
+*/
+#define	ATOMS	\
+	ATOM(TAGS, "tags") ATOM(TAGGROUP, "taggroup") ATOM(TAG, "tag")						\
+	ATOM(TAG_BOOLEAN, "tag-boolean") ATOM(TAG_UINT32, "tag-uint32") ATOM(TAG_STRING, "tag-string")		\
+	ATOM(TAG_REAL64, "tag-real64") ATOM(TAG_REAL64_VEC3, "tag-real64-vec3") ATOM(TAG_LINK, "tag-link")	\
+	ATOM(TAG_ANIMATION, "tag-animation") ATOM(TAG_BLOB, "tag-blob")						\
+	ATOM(NODE_OBJECT, "node-object") ATOM(NODE_GEOMETRY, "node-geometry") ATOM(NODE_MATERIAL, "node-material")	\
+	ATOM(NODE_BITMAP, "node-bitmap") ATOM(NODE_TEXT, "node-text") ATOM(NODE_CURVE, "node-curve")		\
+	ATOM(NODE_AUDIO, "node-audio")										\
+	ATOM(TRANSFORM, "transform") ATOM(LIGHT, "light") ATOM(LINKS, "links") ATOM(METHODGROUPS, "methodgroups")	\
+	ATOM(METHODGROUP, "methodgroup") ATOM(HIDDEN, "hidden")							\
+	ATOM(LAYERS, "layers") ATOM(VERTEXCREASE, "vertexcrease") ATOM(EDGECREASE, "edgecrease") ATOM(BONES, "bones")	\
+	ATOM(FRAGMENTS, "fragments") ATOM(DIMENSIONS, "dimensions") ATOM(CURVES, "curves")			\
+	ATOM(BUFFERS, "buffers") ATOM(BUFFER, "buffer") ATOM(LANGUAGE, "language")				\
+	ATOM(V, "v") ATOM(P, "p") ATOM(TILES, "tiles") ATOM(TILE, "tile") ATOM(BLOCKS, "blocks") ATOM(BLOCK, "block")
+
+typedef enum
+{
+	A_NONE = XMLNODE_ATOM_NONE,
+#define	ATOM(a, n)	A_##a,
+	ATOMS
+#undef	ATOM
+	A_COUNT
+} Atom;
+
+/* Intern the names above, in order. Must be done before any XML is parsed. */
+static int atoms_init(void)
+{
+	static const char	*names[] = {
+#define	ATOM(a, n)	n,
+	ATOMS
+#undef	ATOM
+	};
+	size_t	i;
+
+	for(i = 0; i < sizeof names / sizeof *names; i++)
+	{
+		if(xmlnode_atom(names[i]) != A_NONE + 1 + i)
+			return 0;
+	}
+	return 1;
+}
 
-	if((e = dict_find(dict, name)) == NULL)
+/* Map a node element to the type of node, or V_NT_NUM_TYPES if it's not a node. */
+static VNodeType node_type_from_atom(XmlAtom atom)
+{
+	switch(atom)
 	{
-		e = mem_alloc(sizeof *e);
-		strcpy(e->name, name);
-		dict->entries = list_prepend(dict->entries, e);
+	case A_NODE_OBJECT:	return V_NT_OBJECT;
+	case A_NODE_GEOMETRY:	return V_NT_GEOMETRY;
+	case A_NODE_MATERIAL:	return V_NT_MATERIAL;
+	case A_NODE_BITMAP:	return V_NT_BITMAP;
+	case A_NODE_TEXT:	return V_NT_TEXT;
+	case A_NODE_CURVE:	return V_NT_CURVE;
+	case A_NODE_AUDIO:	return V_NT_AUDIO;
+	}
+	return V_NT_NUM_TYPES;
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* Queries that are run for many nodes, compiled once up front. */
+static struct
+{
+	XmlNodeQuery	*ramp_points;	/* Points of a ramp material fragment. */
+	XmlNodeQuery	*fragments;	/* All fragments of a material node. */
+	XmlNodeQuery	*child_links;	/* Child links of an object node. */
+} Queries;
+
+static void queries_init(void)
+{
+	Queries.ramp_points = xmlnode_query_new(XMLNODE_AXIS_CHILD, XMLNODE_NAME("ramp"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("ramppoint"), XMLNODE_DONE);
+	Queries.fragments   = xmlnode_query_new(XMLNODE_AXIS_CHILD, XMLNODE_NAME("fragments"),
+					     XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("fragment-"), XMLNODE_DONE);
+	Queries.child_links = xmlnode_query_new(XMLNODE_AXIS_CHILD, XMLNODE_NAME("links"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("link"),
+					     XMLNODE_ATTRIB_VAL("label", "child"), XMLNODE_DONE);
+}
+
+static void queries_destroy(void)
+{
+	xmlnode_query_destroy(Queries.ramp_points);
+	xmlnode_query_destroy(Queries.fragments);
+	xmlnode_query_destroy(Queries.child_links);
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+
+static unsigned int entry_hash(const void *key)
+{
+	const Entry	*e = key;
+
+	return hash_hash_string(e->name) * 31 + (unsigned char) e->kind;
+}
+
+static int entry_equal(const void *key1, const void *key2)
+{
+	const Entry	*e1 = key1, *e2 = key2;
+
+	return e1->kind == e2->kind && strcmp(e1->name, e2->name) == 0;
+}
+
+static void dict_ctor(Dict *dict)
+{
+	dict->index = hash_new(entry_hash, entry_equal);
+	dict->arena = arena_new(4 << 10);
+	dict->first = NULL;
+}
+
+static void dict_clear(Dict *dict)
+{
+	hash_clear(dict->index);
+	arena_clear(dict->arena);
+	dict->first = NULL;
+}
+
+static Entry * dict_find(const Dict *dict, char kind, const char *name)
+{
+	Entry	key;
+
+	key.kind = kind;
+	key.name = name;
+	return hash_lookup(dict->index, &key);
+}
+
+static void dict_set(Dict *dict, char kind, const char *name, uint32 id)
+{
+	Entry	*e;
+	size_t	len;
+	char	*copy;
+
+	if((e = dict_find(dict, kind, name)) == NULL)
+	{
+		len = strlen(name) + 1;
+		e = arena_alloc(dict->arena, sizeof *e);
+		copy = arena_alloc(dict->arena, len);
+		memcpy(copy, name, len);
+		e->kind = kind;
+		e->name = copy;
+		e->prev = NULL;
+		if((e->next = dict->first) != NULL)
+			e->next->prev = e;
+		dict->first = e;
+		hash_insert(dict->index, e, e);
 	}
 	e->id = id;
 }
 
-static uint32 dict_get(const Dict *dict, const char *name)
+static uint32 dict_get(const Dict *dict, char kind, const char *name)
 {
 	Entry	*e;
 
-	if((e = dict_find(dict, name)) != NULL)
+	if((e = dict_find(dict, kind, name)) != NULL)
 		return e->id;
 	return ~0;
 }
 
+/* Remove an entry. Its memory is reclaimed when the dictionary next becomes empty. */
+static void dict_remove(Dict *dict, Entry *e)
+{
+	hash_remove(dict->index, e);
+	if(e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		dict->first = e->next;
+	if(e->next != NULL)
+		e->next->prev = e->prev;
+	if(dict->first == NULL)
+		arena_clear(dict->arena);
+}
+
 /* ----------------------------------------------------------------------------------------- */
 
-static void layer_id_clear(MainInfo *min)
+#define	IDMAP_MIN	256	/* IDs below this always go into the array. */
+
+static unsigned int idmap_hash(const void *key)
+{
+	return (unsigned int) (size_t) key;
+}
+
+static int idmap_equal(const void *key1, const void *key2)
+{
+	return key1 == key2;
+}
+
+static void idmap_ctor(IdMap *map)
+{
+	map->dense = NULL;
+	map->dense_size = 0;
+	map->count = 0;
+	map->sparse = hash_new(idmap_hash, idmap_equal);
+}
+
+/* Forget all IDs, but keep the memory around. */
+static void idmap_clear(IdMap *map)
+{
+	size_t	i;
+
+	for(i = 0; i < map->dense_size; i++)
+		map->dense[i] = ~0u;
+	map->count = 0;
+	hash_clear(map->sparse);
+}
+
+static void idmap_set(IdMap *map, uint32 local, uint32 remote)
 {
-	dict_clear(&min->layer_ids);
+	if(local >= map->dense_size && (local < IDMAP_MIN || local < 2 * (map->count + 1)))
+	{
+		size_t	ns = map->dense_size > 0 ? map->dense_size : IDMAP_MIN, i;
+		uint32	*nd;
+
+		while(ns <= local)
+			ns *= 2;
+		if((nd = mem_realloc(map->dense, ns * sizeof *nd)) != NULL)
+		{
+			for(i = map->dense_size; i < ns; i++)
+				nd[i] = ~0u;
+			map->dense = nd;
+			map->dense_size = ns;
+		}
+	}
+	if(local < map->dense_size)
+	{
+		if(map->dense[local] == ~0u)
+			map->count++;
+		map->dense[local] = remote;
+		return;
+	}
+	if(hash_lookup(map->sparse, (void *) (size_t) local) != NULL)
+		hash_remove(map->sparse, (void *) (size_t) local);
+	else
+		map->count++;
+	hash_insert(map->sparse, (void *) (size_t) local, (void *) ((size_t) remote + 1));
 }
 
+static uint32 idmap_get(const IdMap *map, uint32 local)
+{
+	void	*remote;
+
+	if(local < map->dense_size && map->dense[local] != ~0u)
+		return map->dense[local];
+	if((remote = hash_lookup(map->sparse, (void *) (size_t) local)) != NULL)
+		return (uint32) ((size_t) remote - 1);
+	return ~0u;
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
 static void layer_id_set(MainInfo *min, const char *name, VLayerID id)
 {
-	dict_set(&min->layer_ids, name, id);
+	dict_set(&min->ids, 'L', name, id);
 	message(min, 3, "layer id for '%s' set to %u\n", name, id);
 }
 
 static VLayerID layer_id_get(const MainInfo *min, const char *name)
 {
-	return dict_get(&min->layer_ids, name);
+	return dict_get(&min->ids, 'L', name);
 }
 
 /* ----------------------------------------------------------------------------------------- */
 
 static void fragment_map_clear(MainInfo *min)
 {
-	mem_free(min->fragment_map);
-	min->fragment_map = NULL;
-	min->fragment_map_size = 0u;
+	idmap_clear(&min->fragment_map);
+}
+
+/* Fragments created but not yet echoed are stored as (VNMFragmentID) ~0, which is not the same as
+ * not being stored at all; see fragment_map_has().
+*/
+static void fragment_map_store(MainInfo *min, uint32 local, VNMFragmentID remote)
+{
+	idmap_set(&min->fragment_map, local, remote);
+}
+
+static int fragment_map_has(const MainInfo *min, uint32 local)
+{
+	return idmap_get(&min->fragment_map, local) != ~0u;
+}
+
+static VNMFragmentID fragment_map_get(const MainInfo *min, uint32 local)
+{
+	return idmap_get(&min->fragment_map, local);
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* In optimistic mode, layers, tag groups, method groups, curves, buffers and fragments are given
+ * IDs by the loader, counting from 0 in file order, and their contents are sent right away rather
+ * than after a create round-trip. Assigned IDs are remembered in a dictionary of their own, with
+ * the same kinds as in min->ids plus F for fragments, until the server echoes the create. If it
+ * gives something an ID other than the one asked for, the node is uploaded again once all echoes
+ * are in, the round-trip way.
+*/
+
+static void assign_real_set(MainInfo *min, char kind, const char *name, uint32 id)
+{
+	if(kind == 'L')
+		layer_id_set(min, name, id);
+	else if(kind != 'F')
+		dict_set(&min->ids, kind, name, id);
+}
+
+/* Assign <id> to the item of <kind> called <name>, in the current node. */
+static void assign_set(MainInfo *min, char kind, const char *name, uint32 id)
+{
+	dict_set(&min->assigned, kind, name, id);
+	assign_real_set(min, kind, name, id);
+}
+
+/* Check a create echoed by the server against the assigned IDs. Returns 1 if it was one of ours,
+ * whether or not it got the ID that was asked for.
+*/
+static int assign_confirm(MainInfo *min, char kind, uint32 id, const char *name)
+{
+	Entry	*e, *next;
+
+	if(min->assigned.first == NULL)
+		return 0;
+	/* Anything else that was assigned, or already got, the same ID has lost it. */
+	for(e = min->assigned.first; e != NULL; e = next)
+	{
+		next = e->next;
+		if(e->kind == kind && e->id == id && strcmp(e->name, name) != 0)
+		{
+			message(min, 2, "ID %u.%u was not given to \"%s\"\n", min->node_id, id, e->name);
+			dict_remove(&min->assigned, e);
+		}
+	}
+	for(e = min->ids.first; e != NULL; e = e->next)
+	{
+		if(e->kind == kind && e->id == id && strcmp(e->name, name) != 0)
+		{
+			e->id = ~0u;
+			min->reassign = 1;
+		}
+	}
+	if((e = dict_find(&min->assigned, kind, name)) == NULL)
+		return 0;
+	if(e->id != id)
+	{
+		message(min, 2, "\"%s\" in node %u got ID %u rather than %u\n", name, min->node_id, id, e->id);
+		min->reassign = 1;
+	}
+	assign_real_set(min, kind, name, id);
+	dict_remove(&min->assigned, e);
+	return 1;
+}
+
+/* Fragments have no names, so they are keyed on the assigned ID instead, and remember the type. */
+static void assign_set_fragment(MainInfo *min, VNMFragmentID id, VNMFragmentType type)
+{
+	char	name[16];
+
+	sprintf(name, "%u", id);
+	assign_set(min, 'F', name, type);
 }
 
-static void fragment_map_store(MainInfo *min, VNMFragmentID local, VNMFragmentID remote)
+static int assign_confirm_fragment(MainInfo *min, VNMFragmentID id, VNMFragmentType type)
 {
-	if(local >= min->fragment_map_size)
+	char	name[16];
+	Entry	*e;
+
+	if(min->assigned.first == NULL)
+		return 0;
+	sprintf(name, "%u", id);
+	if((e = dict_find(&min->assigned, 'F', name)) == NULL)
+		return 0;
+	if(e->id != type)
 	{
-		min->fragment_map = mem_realloc(min->fragment_map, (1 + local) * sizeof *min->fragment_map);
-		min->fragment_map_size = local + 1;
+		message(min, 2, "Fragment %u.%u was not given the expected type\n", min->node_id, id);
+		min->reassign = 1;
 	}
-	min->fragment_map[local] = remote;
+	dict_remove(&min->assigned, e);
+	return 1;
 }
 
-static VNMFragmentID fragment_map_get(const MainInfo *min, VNMFragmentID local)
+/* Called when a new node is reached. In optimistic mode, the previous node is only done once the
+ * server has confirmed all of its assigned IDs. If any were refused, the node's contents are
+ * uploaded again with round-trips, re-using the IDs that did work.
+*/
+static int assign_node_done(MainInfo *min)
 {
-	if(local > min->fragment_map_size)
-		return (VNMFragmentID) ~0u;
-	return min->fragment_map[local];
+	if(min->assigned.first != NULL)
+		return 0;
+	if(min->reassign)
+	{
+		message(min, 1, "Not all IDs assigned in node %u were accepted, uploading it again\n", min->node_id);
+		min->reassign  = 0;
+		min->assigning = 0;
+		min->iter = min->node_start;
+		return 0;
+	}
+	return 1;
 }
 
 /* ----------------------------------------------------------------------------------------- */
 
+/* Note that we're waiting for the server to reply to a create. Several creates sent in a row are
+ * timed from the first, since they're sent at practically the same time.
+*/
 static void pend_add(MainInfo *min, Pending what, int counting)
 {
 	if(what != min->pending)
+	{
 		min->pend_count = 0;
+		min->pend_since = timer_now();
+	}
 	min->pending = what;
 	if(counting)
 		min->pend_count++;
@@ -204,6 +737,7 @@ static void pend_add(MainInfo *min, Pending what, int counting)
 static void pend_sub(MainInfo *min)
 {
 	message(min, 4, "in pend_sub(): count=%u\n", min->pend_count);
+	stats_latency(min->pending, min->pend_since);
 	if(min->pend_count > 0)
 	{
 		if(--min->pend_count > 0)
@@ -214,24 +748,63 @@ static void pend_sub(MainInfo *min)
 
 static void node_map_clear(MainInfo *min)
 {
-	if(min->node_map != NULL)
-	{
-		mem_free(min->node_map);
-		min->node_map = NULL;
-	}
-	min->node_map_size = 0u;
+	idmap_clear(&min->node_map);
 }
 
 static void node_map_set(MainInfo *min, VNodeID local, VNodeID remote)
 {
-	if(local >= min->node_map_size)
+	idmap_set(&min->node_map, local, remote);
+}
+
+static VNodeID node_map_get(const MainInfo *min, VNodeID local)
+{
+	return idmap_get(&min->node_map, local);
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* Layers are keyed on the ordinal of their node in the file, rather than the node's ID, to be
+ * robust against files re-using IDs. The ordinal is stored as the node's user data, at load.
+*/
+static void stream_layer_key(char *key, size_t max, unsigned long node, const char *layer)
+{
+	snprintf(key, max, "%lu/%s", node, layer != NULL ? layer : "");
+}
+
+/* Remember that the current node's layer (or buffer) <name> is <id>, for the bulk data pass. */
+static void stream_layer_set(MainInfo *min, const char *name, VLayerID id, int type)
+{
+	StreamLayer	*sl;
+	char		key[sizeof sl->key];
+
+	stream_layer_key(key, sizeof key, (unsigned long) xmlnode_get_user(min->node), name);
+	if((sl = hash_lookup(min->stream_layers, key)) == NULL)
 	{
-		min->node_map = mem_realloc(min->node_map, (local + 1) * sizeof *min->node_map);
-		min->node_map_size = local + 1;
+		sl = mem_alloc(sizeof *sl);
+		strcpy(sl->key, key);
+		hash_insert(min->stream_layers, sl->key, sl);
 	}
-	min->node_map[local] = remote;	
+	sl->node_id  = min->node_id;
+	sl->layer_id = id;
+	sl->type     = type;
+	message(min, 3, "  stream layer %s is %u.%u\n", key, min->node_id, id);
+}
+
+static int stream_layer_free(void *data, void *user)
+{
+	mem_free(data);
+	return 1;
 }
 
+static void stream_layer_clear(MainInfo *min)
+{
+	hash_foreach(min->stream_layers, stream_layer_free, NULL);
+	hash_destroy(min->stream_layers);
+	min->stream_layers = hash_new_string();
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
 static real64 child_get_uint32(const XmlNode *node, const char *name, uint32 def)
 {
 	const char	*v;
@@ -240,7 +813,7 @@ static real64 child_get_uint32(const XmlNode *node, const char *name, uint32 def
 	{
 		uint32	x;
 
-		if(sscanf(v, "%u", &x) == 1)
+		if(numscan_uint32(v, &x) != NULL)
 			return x;
 	}
 	return def;
@@ -254,7 +827,7 @@ static real64 child_get_real64(const XmlNode *node, const char *name, real64 def
 	{
 		real64	x;
 
-		if(sscanf(v, "%lg", &x) == 1)
+		if(numscan_real64(v, &x) != NULL)
 			return x;
 	}
 	return def;
@@ -282,11 +855,9 @@ static uint32 attrib_get_uint32(const XmlNode *node, const char *name, uint32 de
 
 	if((v = xmlnode_attrib_get_value(node, name)) != NULL)
 	{
-		char	*eptr;
 		uint32	val;
 
-		val = strtoul(v, &eptr, 10);
-		if(eptr > v)
+		if(numscan_uint32(v, &val) != NULL)
 			return val;
 	}
 	return def;
@@ -300,11 +871,9 @@ static uint32 attrib_get_ref(const XmlNode *node, const char *name, char prefix,
 	{
 		if(*v == prefix)
 		{
-			char	*eptr;
 			uint32	val;
 
-			val = strtoul(v + 1, &eptr, 10);
-			if(eptr > v + 1)
+			if(numscan_uint32(v + 1, &val) != NULL)
 				return val;
 		}
 	}
@@ -317,11 +886,9 @@ static real64 attrib_get_real64(const XmlNode *node, const char *name, real64 de
 
 	if((v = xmlnode_attrib_get_value(node, name)) != NULL)
 	{
-		char	*eptr;
 		real64	val;
 
-		val = strtod(v, &eptr);
-		if(eptr > v)
+		if(numscan_real64(v, &val) != NULL)
 			return val;
 	}
 	return def;
@@ -335,11 +902,9 @@ static uint32 child_get_ref(const XmlNode *node, const char *name, char prefix,
 	{
 		if(*v == prefix)
 		{
-			char	*eptr;
 			uint32	val;
 
-			val = strtoul(v + 1, &eptr, 10);
-			if(eptr > v + 1)
+			if(numscan_uint32(v + 1, &val) != NULL)
 				return val;
 		}
 	}
@@ -354,27 +919,38 @@ static boolean get_boolean(const char *b)
 static int process_common(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
-	const char	*el = xmlnode_get_name(here);
+	const XmlAtom	el = xmlnode_get_atom(here);
 
-	if(strcmp(el, "tags") == 0)
+	if(el == A_TAGS)
 	{
 		List	*groups, *iter;
+		uint16	i;
 
 		groups = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("taggroup"), XMLNODE_DONE);
-		for(iter = groups; iter != NULL; iter = list_next(iter))
+		for(iter = groups, i = 0; iter != NULL; iter = list_next(iter), i++)
 		{
-			verse_send_tag_group_create(min->node_id, (uint16) ~0u, xmlnode_attrib_get_value(list_data(iter), "name"));
+			const char	*name = xmlnode_attrib_get_value(list_data(iter), "name");
+
+			if(dict_get(&min->ids, 'T', name) != (uint32) ~0u)
+				continue;
+			if(min->assigning)
+			{
+				assign_set(min, 'T', name, i);
+				SEND(TAG, verse_send_tag_group_create(min->node_id, i, name));
+				continue;
+			}
+			SEND(TAG, verse_send_tag_group_create(min->node_id, (uint16) ~0u, name));
 			pend_add(min, PEND_TAGGROUP_CREATE, 1);
 		}
 		list_destroy(groups);
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 	}
-	else if(strcmp(el, "taggroup") == 0)
+	else if(el == A_TAGGROUP)
 	{
 		const char	*name = xmlnode_attrib_get_value(here, "name");
 		uint32		id;
 
-		id = dict_get(&min->tag_groups, name);
+		id = dict_get(&min->ids, 'T', name);
 		if(id != (uint32) ~0u)
 		{
 			List	*tags, *iter;
@@ -387,65 +963,62 @@ static int process_common(MainInfo *min)
 						*value = xmlnode_eval_single(list_data(iter), "");
 				VNTag		tag;
 
-				if(strcmp(type, "boolean") == 0)
+				switch(xmlnode_get_atom(list_data(iter)))
 				{
+				case A_TAG_BOOLEAN:
 					tag.vboolean = get_boolean(value);
-					verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_BOOLEAN, &tag);
-				}
-				else if(strcmp(type, "uint32") == 0)
-				{
+					SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_BOOLEAN, &tag));
+					break;
+				case A_TAG_UINT32:
 					tag.vuint32 = child_get_uint32(list_data(iter), "", 0);
-					verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_UINT32, &tag);
-				}
-				else if(strcmp(type, "string") == 0)
-				{
+					SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_UINT32, &tag));
+					break;
+				case A_TAG_STRING:
 					tag.vstring = (char *) value;	/* Drop the const. */
-					verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_STRING, &tag);
-				}
-				else if(strcmp(type, "real64") == 0)
-				{
+					SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_STRING, &tag));
+					break;
+				case A_TAG_REAL64:
 					if(sscanf(value, "%lg", &tag.vreal64) == 1)
-						verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_REAL64, &tag);
+						SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_REAL64, &tag));
 					else
 						fprintf(stderr, "loader: Parse error on real64 tag \"%s\" value\n", name);
-				}
-				else if(strcmp(type, "real64-vec3") == 0)
-				{
+					break;
+				case A_TAG_REAL64_VEC3:
 					if(sscanf(value, "%lg %lg %lg", &tag.vreal64_vec3[0], &tag.vreal64_vec3[1], &tag.vreal64_vec3[2]) == 3)
-						verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_REAL64_VEC3, &tag);
+						SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_REAL64_VEC3, &tag));
 					else
 						fprintf(stderr, "loader: Parse error on real64_vec3 tag \"%s\" value\n", name);
-				}
-				else if(strcmp(type, "link") == 0)
-				{
+					break;
+				case A_TAG_LINK:
 					tag.vlink = child_get_ref(list_data(iter), "", 'n', ~0u);
-					verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_LINK, &tag);
-				}
-				else if(strcmp(type, "animation") == 0)
-				{
+					SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_LINK, &tag));
+					break;
+				case A_TAG_ANIMATION:
 					tag.vanimation.curve = child_get_ref(list_data(iter), "curve", 'n', ~0u);
 					tag.vanimation.start = child_get_uint32(list_data(iter), "start", 0u);
 					tag.vanimation.end   = child_get_uint32(list_data(iter), "end", 0u);
-					verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_ANIMATION, &tag);
-				}
-				else if(strcmp(type, "blob") == 0)
-				{
-					char		*eptr;
-					unsigned char	data[65536];
-					size_t		size;
-					unsigned long	x;
-
-					for(size = 0; size < sizeof data && (x = strtoul(value, &eptr, 10), eptr > value); size++)
+					SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_ANIMATION, &tag));
+					break;
+				case A_TAG_BLOB:
 					{
-						data[size] = x;
-						value = eptr;
+						char		*eptr;
+						unsigned char	data[65536];
+						size_t		size;
+						unsigned long	x;
+
+						for(size = 0; size < sizeof data && (x = strtoul(value, &eptr, 10), eptr > value); size++)
+						{
+							data[size] = x;
+							value = eptr;
+						}
+						tag.vblob.size = size;
+						tag.vblob.blob = data;
+						SEND(TAG, verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_BLOB, &tag));
 					}
-					tag.vblob.size = size;
-					tag.vblob.blob = data;
-					verse_send_tag_create(min->node_id, id, ~0, name, VN_TAG_BLOB, &tag);
-				}
-				else
+					break;
+				default:
 					fprintf(stderr, "loader: Ignoring tag of type \"%s\" -- not implemented\n", type);
+				}
 			}
 			list_destroy(tags);
 			min->iter = xmlnode_iter_next(min->iter, here);	/* Skip entire group. */
@@ -453,7 +1026,7 @@ static int process_common(MainInfo *min)
 		else
 			fprintf(stderr, "loader: Unknown tag group %u.\"%s\" -- still waiting for server response?\n", min->node_id, name);
 	}
-	else if(strcmp(el, "tag") == 0)
+	else if(el == A_TAG)
 	{
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 		exit(0);
@@ -466,10 +1039,10 @@ static int process_common(MainInfo *min)
 static int process_object(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
-	const char	*el = xmlnode_get_name(here);
+	const XmlAtom	el = xmlnode_get_atom(here);
 	const char	*txt;
 
-	if(strcmp(el, "transform") == 0)
+	if(el == A_TRANSFORM)
 	{
 		if((txt = xmlnode_eval_single(here, "position")) != NULL)
 		{
@@ -480,7 +1053,7 @@ static int process_object(MainInfo *min)
 				pos[0] *= min->o_pos_scale;
 				pos[1] *= min->o_pos_scale;
 				pos[2] *= min->o_pos_scale;
-				verse_send_o_transform_pos_real64(min->node_id, 0u, 0u, pos, NULL, NULL, NULL, 0.0);
+				SEND(OBJECT, verse_send_o_transform_pos_real64(min->node_id, 0u, 0u, pos, NULL, NULL, NULL, 0.0));
 				min->iter = xmlnode_iter_next(min->iter, NULL);
 			}
 		}
@@ -490,7 +1063,7 @@ static int process_object(MainInfo *min)
 
 			if(sscanf(txt, "%lg %lg %lg %lg", &rot.x, &rot.y, &rot.z, &rot.w) == 4)
 			{
-				verse_send_o_transform_rot_real64(min->node_id, 0u, 0u, &rot, NULL, NULL, NULL, 0.0);
+				SEND(OBJECT, verse_send_o_transform_rot_real64(min->node_id, 0u, 0u, &rot, NULL, NULL, NULL, 0.0));
 				min->iter = xmlnode_iter_next(min->iter, NULL);
 			}
 		}
@@ -500,24 +1073,24 @@ static int process_object(MainInfo *min)
 
 			if(sscanf(txt, "%lg %lg %lg", scale, scale + 1, scale + 2) == 3)
 			{
-				verse_send_o_transform_scale_real64(min->node_id, scale[0], scale[1], scale[2]);
+				SEND(OBJECT, verse_send_o_transform_scale_real64(min->node_id, scale[0], scale[1], scale[2]));
 				min->iter = xmlnode_iter_next(min->iter, NULL);
 			}
 		}
 		min->iter = xmlnode_iter_next(min->iter, here);	/* Skip all of transform. */
 	}
-	else if(strcmp(el, "light") == 0)
+	else if(el == A_LIGHT)
 	{
 		if((txt = xmlnode_eval_single(here, "")) != NULL)
 		{
 			real64	r, g, b;
 
 			if(sscanf(txt, "%lg %lg %lg", &r, &g, &b) == 3)
-				verse_send_o_light_set(min->node_id, r, g, b);
+				SEND(OBJECT, verse_send_o_light_set(min->node_id, r, g, b));
 		}
 		min->iter = xmlnode_iter_next(min->iter, here);
 	}
-	else if(strcmp(el, "links") == 0)
+	else if(el == A_LINKS)
 	{
 		List	*link, *li;
 		uint16	id = 0;
@@ -531,38 +1104,53 @@ static int process_object(MainInfo *min)
 			if(ln != ~0u)
 			{
 				const char	*label = xmlnode_attrib_get_value(l, "label");
+				VNodeID		link = node_map_get(min, ln);
 
-				message(min, 3, "Sending link_set from node %u to node n%u (%u), label '%s'\n", min->node_id, ln, min->node_map[ln], label);
-				verse_send_o_link_set(min->node_id, id, min->node_map[ln], label, target);
+				if(link == ~0u)
+				{
+					fprintf(stderr, "loader: Link '%s' in node %u refers to unknown node n%u--skipping\n", label, min->node_id, ln);
+					continue;
+				}
+				message(min, 3, "Sending link_set from node %u to node n%u (%u), label '%s'\n", min->node_id, ln, link, label);
+				SEND(OBJECT, verse_send_o_link_set(min->node_id, id, link, label, target));
 				id++;
 			}
 		}
 		list_destroy(link);
 		min->iter = xmlnode_iter_next(min->iter, here);
 	}
-	else if(strcmp(el, "methodgroups") == 0)
+	else if(el == A_METHODGROUPS)
 	{
 		List	*groups, *iter;
+		uint16	i;
 
 		groups = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("methodgroup"), XMLNODE_DONE);
-		for(iter = groups; iter != NULL; iter = list_next(iter))
+		for(iter = groups, i = 0; iter != NULL; iter = list_next(iter), i++)
 		{
 			const char	*mn = xmlnode_attrib_get_value(list_data(iter), "name");
 
+			if(dict_get(&min->ids, 'M', mn) != ~0u)
+				continue;
 			message(min, 2, "Creating method group \"%s\" in object %u\n", mn, min->node_id);
-			verse_send_o_method_group_create(min->node_id, ~0, mn);
+			if(min->assigning)
+			{
+				assign_set(min, 'M', mn, i);
+				SEND(OBJECT, verse_send_o_method_group_create(min->node_id, i, mn));
+				continue;
+			}
+			SEND(OBJECT, verse_send_o_method_group_create(min->node_id, ~0, mn));
 			pend_add(min, PEND_METHODGROUP_CREATE, 1);
 		}
 		list_destroy(groups);
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 	}
-	else if(strcmp(el, "methodgroup") == 0)
+	else if(el == A_METHODGROUP)
 	{
 		const char	*gn = xmlnode_attrib_get_value(here, "name");
 		uint16		gid;
 		List		*methods, *iter, *params, *piter;
 
-		gid = layer_id_get(min, gn);
+		gid = dict_get(&min->ids, 'M', gn);
 		if(gid == (uint16) ~0)
 		{
 			fprintf(stderr, "loader: Couldn't look up ID for method group \"%s\" -- creation failed?\n", gn);
@@ -591,18 +1179,18 @@ static int process_object(MainInfo *min)
 			if(err == 0)
 			{
 				message(min, 3, "Creating method %u.%u, \"%s\" with %u params\n", min->node_id, gid, mn, pn);
-				verse_send_o_method_create(min->node_id, gid, ~0, mn, pn, ptype, pname);
+				SEND(OBJECT, verse_send_o_method_create(min->node_id, gid, ~0, mn, pn, ptype, pname));
 			}
 		}
 		list_destroy(methods);
 		min->iter = xmlnode_iter_next(min->iter, here);
 	}
-	else if(strcmp(el, "hidden") == 0)
+	else if(el == A_HIDDEN)
 	{
 		if((txt = xmlnode_eval_single(here, "")) != NULL)
 		{
 			if(strcmp(txt, "true") == 0 || strcmp(txt, "1") == 0)
-				verse_send_o_hide(min->node_id, TRUE);
+				SEND(OBJECT, verse_send_o_hide(min->node_id, TRUE));
 		}
 		min->iter = xmlnode_iter_next(min->iter, here);
 	}
@@ -613,11 +1201,12 @@ static int process_object(MainInfo *min)
 
 static int g_scan_send_vertex_xyz(VNodeID node_id, VLayerID layer_id, const char *element, void *tmp, uint32 index, MainInfo *min)
 {
-	real64	*xyz = tmp;
+	real64		*xyz = tmp;
+	const char	*next;
 
-	if(sscanf(element, "%u %lg %lg %lg", &index, xyz, xyz + 1, xyz + 2) == 4)
+	if((next = numscan_uint32(element, &index)) != NULL && numscan_real64_vec(next, xyz, 3) == 3)
 	{
-		verse_send_g_vertex_set_xyz_real64(node_id, layer_id, index, min->g_xyz_scale * xyz[0], min->g_xyz_scale * xyz[1], min->g_xyz_scale * xyz[2]);
+		SEND(GEOMETRY, verse_send_g_vertex_set_xyz_real64(node_id, layer_id, index, min->g_xyz_scale * xyz[0], min->g_xyz_scale * xyz[1], min->g_xyz_scale * xyz[2]));
 		return 1;
 	}
 	else
@@ -627,11 +1216,12 @@ static int g_scan_send_vertex_xyz(VNodeID node_id, VLayerID layer_id, const char
 
 static int g_scan_send_vertex_uint32(VNodeID node_id, VLayerID layer_id, const char *element, void *tmp, uint32 index, MainInfo *min)
 {
-	uint32	*v = tmp;
+	uint32		*v = tmp;
+	const char	*next;
 
-	if(sscanf(element, "%u %u", &index, v) == 2)
+	if((next = numscan_uint32(element, &index)) != NULL && numscan_uint32(next, v) != NULL)
 	{
-		verse_send_g_vertex_set_uint32(node_id, layer_id, index, *v);
+		SEND(GEOMETRY, verse_send_g_vertex_set_uint32(node_id, layer_id, index, *v));
 		return 1;
 	}
 	return 0;
@@ -639,11 +1229,12 @@ static int g_scan_send_vertex_uint32(VNodeID node_id, VLayerID layer_id, const c
 
 static int g_scan_send_vertex_real(VNodeID node_id, VLayerID layer_id, const char *element, void *tmp, uint32 index, MainInfo *min)
 {
-	real64	*v = tmp;
+	real64		*v = tmp;
+	const char	*next;
 
-	if(sscanf(element, "%u %lg", &index, v) == 2)
+	if((next = numscan_uint32(element, &index)) != NULL && numscan_real64(next, v) != NULL)
 	{
-		verse_send_g_vertex_set_real64(node_id, layer_id, index, *v);
+		SEND(GEOMETRY, verse_send_g_vertex_set_real64(node_id, layer_id, index, *v));
 		return 1;
 	}
 	return 0;
@@ -654,9 +1245,9 @@ static int g_scan_send_polygon_corner_uint32(VNodeID node_id, VLayerID layer_id,
 	uint32	*v = tmp;
 
 	v[3] = ~0u;
-	if(sscanf(element, "%u %u %u %u", v, v + 1, v + 2, v + 3) >= 3)
+	if(numscan_uint32_vec(element, v, 4) >= 3)
 	{
-		verse_send_g_polygon_set_corner_uint32(node_id, layer_id, index, v[0], v[1], v[2], v[3]);
+		SEND(GEOMETRY, verse_send_g_polygon_set_corner_uint32(node_id, layer_id, index, v[0], v[1], v[2], v[3]));
 		return 1;
 	}
 	return 0;
@@ -666,9 +1257,9 @@ static int g_scan_send_polygon_corner_real(VNodeID node_id, VLayerID layer_id, c
 {
 	real64	*v = tmp;
 
-	if(sscanf(element, "%lg %lg %lg %lg", v, v + 1, v + 2, v + 3) == 4)
+	if(numscan_real64_vec(element, v, 4) == 4)
 	{
-		verse_send_g_polygon_set_corner_real64(node_id, layer_id, index, v[0], v[1], v[2], v[3]);
+		SEND(GEOMETRY, verse_send_g_polygon_set_corner_real64(node_id, layer_id, index, v[0], v[1], v[2], v[3]));
 		return 1;
 	}
 	return 0;
@@ -678,9 +1269,9 @@ static int g_scan_send_polygon_face_uint8(VNodeID node_id, VLayerID layer_id, co
 {
 	uint32	*v = tmp;
 
-	if(sscanf(element, "%u", v) == 1)
+	if(numscan_uint32(element, v) != NULL)
 	{
-		verse_send_g_polygon_set_face_uint8(node_id, layer_id, index, v[0]);
+		SEND(GEOMETRY, verse_send_g_polygon_set_face_uint8(node_id, layer_id, index, v[0]));
 		return 1;
 	}
 	return 0;
@@ -690,9 +1281,9 @@ static int g_scan_send_polygon_face_uint32(VNodeID node_id, VLayerID layer_id, c
 {
 	uint32	*v = tmp;
 
-	if(sscanf(element, "%u", v) == 1)
+	if(numscan_uint32(element, v) != NULL)
 	{
-		verse_send_g_polygon_set_face_uint32(node_id, layer_id, index, v[0]);
+		SEND(GEOMETRY, verse_send_g_polygon_set_face_uint32(node_id, layer_id, index, v[0]));
 		return 1;
 	}
 	return 0;
@@ -702,45 +1293,153 @@ static int g_scan_send_polygon_face_real(VNodeID node_id, VLayerID layer_id, con
 {
 	real64	*v = tmp;
 
-	if(sscanf(element, "%lg", v) == 1)
+	if(numscan_real64(element, v) != NULL)
 	{
-		verse_send_g_polygon_set_face_real64(node_id, layer_id, index, v[0]);
+		SEND(GEOMETRY, verse_send_g_polygon_set_face_real64(node_id, layer_id, index, v[0]));
 		return 1;
 	}
 	return 0;
 }
 
+typedef int (*GScanSend)(VNodeID node_id, VLayerID layer_id, const char *element, void *tmp, uint32 index, MainInfo *min);
+
+/* Map a geometry layer type to the function that parses and sends its elements, and the name of those. */
+static GScanSend g_scan_send_get(VNGLayerType type, const char **elname)
+{
+	switch(type)
+	{
+	case VN_G_LAYER_VERTEX_XYZ:
+		*elname = "v";
+		return g_scan_send_vertex_xyz;
+	case VN_G_LAYER_VERTEX_UINT32:
+		*elname = "v";
+		return g_scan_send_vertex_uint32;
+	case VN_G_LAYER_VERTEX_REAL:
+		*elname = "v";
+		return g_scan_send_vertex_real;
+	case VN_G_LAYER_POLYGON_CORNER_UINT32:
+		*elname = "p";
+		return g_scan_send_polygon_corner_uint32;
+	case VN_G_LAYER_POLYGON_CORNER_REAL:
+		*elname = "p";
+		return g_scan_send_polygon_corner_real;
+	case VN_G_LAYER_POLYGON_FACE_UINT8:
+		*elname = "p";
+		return g_scan_send_polygon_face_uint8;
+	case VN_G_LAYER_POLYGON_FACE_UINT32:
+		*elname = "p";
+		return g_scan_send_polygon_face_uint32;
+	case VN_G_LAYER_POLYGON_FACE_REAL:
+		*elname = "p";
+		return g_scan_send_polygon_face_real;
+	default:
+		return NULL;
+	}
+}
+
 /* Helper function for setting a geometry layer. Extracts children ("elements", i.e. vertices or polygons)
  * named <elname> from <layer>, then calls the scan_send() function on each, providing it with some tempo-
  * rary storage and an index number. The storage should be enough for the largest type (4 * real64).
 */
-static void g_set_layer(VNodeID node_id, VLayerID layer_id, const XmlNode *layer, const char *elname,
-			int (*scan_send)(VNodeID node_id, VLayerID layer_id, const char *element, void *tmp, uint32 index, MainInfo *min),
-			MainInfo *min)
+static void g_set_layer(VNodeID node_id, VLayerID layer_id, const XmlNode *layer, const char *elname, GScanSend scan_send, MainInfo *min)
 {
-	List	*points, *iter;
-	real64	tmp[4];
-	uint32	index = 0;
+	const XmlNode	*point;
+	const char	*name, *txt;
+	real64		tmp[4];
+	uint32		index = 0;
+	size_t		i;
 
-	for(iter = points = xmlnode_nodeset_get(layer, XMLNODE_AXIS_CHILD, XMLNODE_NAME(elname), XMLNODE_DONE);
-	    iter != NULL; iter = list_next(iter))
+	/* Layers can be huge, so scan the child array directly rather than building a nodeset. */
+	for(i = 0; (point = xmlnode_child_get(layer, i)) != NULL; i++)
 	{
-		const char	*txt = xmlnode_eval_single(list_data(iter), "");
-
-		if(txt != NULL && scan_send(node_id, layer_id, txt, tmp, index, min))
+		if((name = xmlnode_get_name(point)) == NULL || strcmp(name, elname) != 0)
+			continue;
+		if((txt = xmlnode_get_text(point)) != NULL && scan_send(node_id, layer_id, txt, tmp, index, min))
 			index++;
 	}
-	list_destroy(points);
+}
+
+/* Send a geometry layer stored in the VMLB section named by <section>, rather than as elements. */
+static void g_set_layer_section(MainInfo *min, VLayerID layer_id, VNGLayerType lt, const char *section)
+{
+	VmlbSection		s;
+	const unsigned char	*index = NULL, *value;
+	size_t			size;
+	unsigned long		i;
+	uint32			n;
+
+	switch(lt)
+	{
+	case VN_G_LAYER_VERTEX_XYZ:		size = 3 * sizeof (real64);	break;
+	case VN_G_LAYER_VERTEX_UINT32:		size = sizeof (uint32);		break;
+	case VN_G_LAYER_VERTEX_REAL:		size = sizeof (real64);		break;
+	case VN_G_LAYER_POLYGON_CORNER_UINT32:	size = 4 * sizeof (uint32);	break;
+	case VN_G_LAYER_POLYGON_CORNER_REAL:	size = 4 * sizeof (real64);	break;
+	case VN_G_LAYER_POLYGON_FACE_UINT8:	size = sizeof (uint8);		break;
+	case VN_G_LAYER_POLYGON_FACE_UINT32:	size = sizeof (uint32);		break;
+	case VN_G_LAYER_POLYGON_FACE_REAL:	size = sizeof (real64);		break;
+	default:
+		return;
+	}
+	if(lt < VN_G_LAYER_POLYGON_CORNER_UINT32)
+	{
+		if(!vmlb_section_get(section, VMLB_VERTEX, &s))
+			return;
+		index = vmlb_array(&s, s.count, sizeof (uint32));
+	}
+	else if(!vmlb_section_get(section, VMLB_POLYGON, &s))
+		return;
+	if((lt < VN_G_LAYER_POLYGON_CORNER_UINT32 && index == NULL) || (value = vmlb_array(&s, s.count, size)) == NULL)
+	{
+		fprintf(stderr, "loader: VMLB section %s is too short for its %lu elements\n", section, s.count);
+		return;
+	}
+	for(i = 0; i < s.count; i++, value += size)
+	{
+		n = index != NULL ? vmlb_uint32(index + 4 * i) : i;
+		switch(lt)
+		{
+		case VN_G_LAYER_VERTEX_XYZ:
+			SEND(GEOMETRY, verse_send_g_vertex_set_xyz_real64(min->node_id, layer_id, n, min->g_xyz_scale * vmlb_real64(value),
+									  min->g_xyz_scale * vmlb_real64(value + 8), min->g_xyz_scale * vmlb_real64(value + 16)));
+			break;
+		case VN_G_LAYER_VERTEX_UINT32:
+			SEND(GEOMETRY, verse_send_g_vertex_set_uint32(min->node_id, layer_id, n, vmlb_uint32(value)));
+			break;
+		case VN_G_LAYER_VERTEX_REAL:
+			SEND(GEOMETRY, verse_send_g_vertex_set_real64(min->node_id, layer_id, n, vmlb_real64(value)));
+			break;
+		case VN_G_LAYER_POLYGON_CORNER_UINT32:
+			SEND(GEOMETRY, verse_send_g_polygon_set_corner_uint32(min->node_id, layer_id, n, vmlb_uint32(value), vmlb_uint32(value + 4),
+									      vmlb_uint32(value + 8), vmlb_uint32(value + 12)));
+			break;
+		case VN_G_LAYER_POLYGON_CORNER_REAL:
+			SEND(GEOMETRY, verse_send_g_polygon_set_corner_real64(min->node_id, layer_id, n, vmlb_real64(value), vmlb_real64(value + 8),
+									      vmlb_real64(value + 16), vmlb_real64(value + 24)));
+			break;
+		case VN_G_LAYER_POLYGON_FACE_UINT8:
+			SEND(GEOMETRY, verse_send_g_polygon_set_face_uint8(min->node_id, layer_id, n, *value));
+			break;
+		case VN_G_LAYER_POLYGON_FACE_UINT32:
+			SEND(GEOMETRY, verse_send_g_polygon_set_face_uint32(min->node_id, layer_id, n, vmlb_uint32(value)));
+			break;
+		case VN_G_LAYER_POLYGON_FACE_REAL:
+			SEND(GEOMETRY, verse_send_g_polygon_set_face_real64(min->node_id, layer_id, n, vmlb_real64(value)));
+			break;
+		}
+	}
 }
 
 static int process_geometry(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
+	const XmlAtom	atom = xmlnode_get_atom(here);
 	const char	*el = xmlnode_get_name(here);
 
-	if(strcmp(el, "layers") == 0)
+	if(atom == A_LAYERS)
 	{
 		List	*layers, *iter;
+		VLayerID	next = 2;	/* The first ID after the server's own layers. */
 
 		layers = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("layer-"), XMLNODE_DONE);
 		for(iter = layers; iter != NULL; iter = list_next(iter))
@@ -748,9 +1447,25 @@ static int process_geometry(MainInfo *min)
 			const char	*ln = xmlnode_attrib_get_value(list_data(iter), "name");
 			VNGLayerType	type = g_layer_type_from_string(xmlnode_get_name(list_data(iter)) + 6);
 
-			if(layer_id_get(min, ln) == (VLayerID) ~0u)
+			if(layer_id_get(min, ln) == (VLayerID) ~0u && min->assigning)
 			{
-				verse_send_g_layer_create(min->node_id, ~0, ln, type, 0, 0);
+				/* Layers 0 and 1 are created by the server along with the node, and may already
+				 * have been announced if the node was created ahead of time. They are matched on
+				 * name and type, since files can list their layers in any order.
+				*/
+				if(ln != NULL && strcmp(ln, "vertex") == 0 && type == VN_G_LAYER_VERTEX_XYZ)
+					layer_id_set(min, ln, 0);
+				else if(ln != NULL && strcmp(ln, "polygon") == 0 && type == VN_G_LAYER_POLYGON_CORNER_UINT32)
+					layer_id_set(min, ln, 1);
+				else
+				{
+					assign_set(min, 'L', ln, next);
+					SEND(GEOMETRY, verse_send_g_layer_create(min->node_id, next++, ln, type, 0, 0));
+				}
+			}
+			else if(layer_id_get(min, ln) == (VLayerID) ~0u)
+			{
+				SEND(GEOMETRY, verse_send_g_layer_create(min->node_id, ~0, ln, type, 0, 0));
 				layer_id_set(min, ln, ~0);
 				pend_add(min, PEND_LAYER_CREATE, 1);
 			}
@@ -760,15 +1475,17 @@ static int process_geometry(MainInfo *min)
 	}
 	else if(strncmp(el, "layer-", 6) == 0)
 	{
-		const char	*ln;
+		const char	*ln, *elname, *sn;
 		VLayerID	id;
 		VNGLayerType	lt;
+		GScanSend	scan_send;
 
 		ln = xmlnode_attrib_get_value(here, "name");
 		id = layer_id_get(min, ln);
 		if(id == (VLayerID) ~0)
 		{
 			fprintf(stderr, "loader: Unknown geometry layer \"%s\"\n", ln);
+			min->iter = xmlnode_iter_next(min->iter, here);
 			return 1;
 		}
 		message(min, 3, "  ID of geometry layer %s is %u\n", ln, layer_id_get(min, ln));
@@ -776,60 +1493,43 @@ static int process_geometry(MainInfo *min)
 		if(lt == (VNGLayerType) ~0)
 		{
 			fprintf(stderr, "loader: Unknown layer type \"%s\"\n", xmlnode_get_name(here) + 6);
+			min->iter = xmlnode_iter_next(min->iter, here);
 			return 1;
 		}
-		switch(lt)
+		if((scan_send = g_scan_send_get(lt, &elname)) != NULL)
 		{
-		case VN_G_LAYER_VERTEX_XYZ:
-			g_set_layer(min->node_id, id, here, "v", g_scan_send_vertex_xyz, min);
-			break;
-		case VN_G_LAYER_VERTEX_UINT32:
-			g_set_layer(min->node_id, id, here, "v", g_scan_send_vertex_uint32, min);
-			break;
-		case VN_G_LAYER_VERTEX_REAL:
-			g_set_layer(min->node_id, id, here, "v", g_scan_send_vertex_real, min);
-			break;
-		case VN_G_LAYER_POLYGON_CORNER_UINT32:
-			g_set_layer(min->node_id, id, here, "p", g_scan_send_polygon_corner_uint32, min);
-			break;
-		case VN_G_LAYER_POLYGON_CORNER_REAL:
-			g_set_layer(min->node_id, id, here, "p", g_scan_send_polygon_corner_real, min);
-			break;
-		case VN_G_LAYER_POLYGON_FACE_UINT8:
-			g_set_layer(min->node_id, id, here, "p", g_scan_send_polygon_face_uint8, min);
-			break;
-		case VN_G_LAYER_POLYGON_FACE_UINT32:
-			g_set_layer(min->node_id, id, here, "p", g_scan_send_polygon_face_uint32, min);
-			break;
-		case VN_G_LAYER_POLYGON_FACE_REAL:
-			g_set_layer(min->node_id, id, here, "p", g_scan_send_polygon_face_real, min);
-			break;
+			if((sn = xmlnode_attrib_get_value(here, "section")) != NULL)
+				g_set_layer_section(min, id, lt, sn);
+			else if(min->stream)
+				stream_layer_set(min, ln, id, lt);
+			else
+				g_set_layer(min->node_id, id, here, elname, scan_send, min);
 		}
 		min->iter = xmlnode_iter_next(min->iter, here);
 	}
-	else if(strcmp(el, "vertexcrease") == 0)
+	else if(atom == A_VERTEXCREASE)
 	{
 		const char	*lname = NULL;
 		uint32		def;
 
 		lname = xmlnode_attrib_get_value(here, "layer");
 		def   = attrib_get_uint32(here, "default", ~0u);
-		verse_send_g_crease_set_vertex(min->node_id, lname, def);
+		SEND(GEOMETRY, verse_send_g_crease_set_vertex(min->node_id, lname, def));
 		message(min, 4, "vertex crease set to '%s' def=%u\n", lname, def);
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 	}
-	else if(strcmp(el, "edgecrease") == 0)
+	else if(atom == A_EDGECREASE)
 	{
 		const char	*lname = NULL;
 		uint32		def;
 
 		lname = xmlnode_attrib_get_value(here, "layer");
 		def   = attrib_get_uint32(here, "default", ~0u);
-		verse_send_g_crease_set_edge(min->node_id, lname, def);
+		SEND(GEOMETRY, verse_send_g_crease_set_edge(min->node_id, lname, def));
 		message(min, 4, "edge crease set to '%s'\n", lname);
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 	}
-	else if(strcmp(el, "bones") == 0)
+	else if(atom == A_BONES)
 	{
 		List	*bones, *iter;
 		int	i = 0;
@@ -849,7 +1549,7 @@ static int process_geometry(MainInfo *min)
 					*sr = xmlnode_eval_single(b, "scale-label");
 			uint32		par = child_get_ref(b, "parent", 'b', ~0u);
 
-			verse_send_g_bone_create(min->node_id, (uint16) i, wght, ref, par, i, 0.0, 0.0, pr, rr, sr);
+			SEND(GEOMETRY, verse_send_g_bone_create(min->node_id, (uint16) i, wght, ref, par, i, 0.0, 0.0, pr, rr, sr));
 		}
 		list_destroy(bones);
 		min->iter = xmlnode_iter_next(min->iter, here);	/* That's it, skip it now. */
@@ -859,8 +1559,12 @@ static int process_geometry(MainInfo *min)
 	return 1;
 }
 
+/* Clear a fragment to sane defaults. Fields not mentioned below are simply zeroed, so that no
+ * uninitialized memory is ever sent.
+*/
 static void fragment_clear(VNMFragmentType type, VMatFrag *f)
 {
+	memset(f, 0, sizeof *f);
 	switch(type)
 	{
 	case VN_M_FT_COLOR:
@@ -945,7 +1649,7 @@ static int fragment_set(const MainInfo *min, VNMFragmentType type, VMatFrag *f,
 		child_get_string(f->geometry.layer_b, sizeof f->geometry.layer_b, frag, "layer_b");
 		break;
 	case VN_M_FT_TEXTURE:
-		f->texture.bitmap = min->node_map[child_get_ref(frag, "bitmap", 'n', ~0u)];
+		f->texture.bitmap = node_map_get(min, child_get_ref(frag, "bitmap", 'n', ~0u));
 		child_get_string(f->texture.layer_r, sizeof f->texture.layer_r, frag, "layer_r");
 		child_get_string(f->texture.layer_g, sizeof f->texture.layer_g, frag, "layer_g");
 		child_get_string(f->texture.layer_b, sizeof f->texture.layer_b, frag, "layer_b");
@@ -985,18 +1689,18 @@ static int fragment_set(const MainInfo *min, VNMFragmentType type, VMatFrag *f,
 		f->ramp.mapping = fragment_map_get(min, child_get_ref(frag, "mapping", 'f', ~0u));
 		f->ramp.point_count = 0;
 		{
-			List		*iter;
+			XmlNodeCursor	cursor;
+			const XmlNode	*point;
 			VNMRampPoint	*p;
 			const char	*txt;
 
-			for(iter = xmlnode_nodeset_get(frag, XMLNODE_AXIS_CHILD, XMLNODE_NAME("ramp"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("ramppoint"), XMLNODE_DONE);
-			    iter != NULL;
-			    iter = list_next(iter))
+			xmlnode_query_begin(&cursor, Queries.ramp_points, frag);
+			while((point = xmlnode_query_next(&cursor)) != NULL)
 			{
 				p = &f->ramp.ramp[f->ramp.point_count];
-				if((txt = xmlnode_eval_single(list_data(iter), "")) != NULL)
+				if((txt = xmlnode_eval_single(point, "")) != NULL)
 				{
-					p->pos = attrib_get_real64(list_data(iter), "pos", 0.0);
+					p->pos = attrib_get_real64(point, "pos", 0.0);
 					if(sscanf(txt, "%lg %lg %lg", &p->red, &p->green, &p->blue) == 3)
 						f->ramp.point_count++;
 					else
@@ -1036,7 +1740,7 @@ static int m_create_fragment(MainInfo *min, VNMFragmentID id, const XmlNode *fra
 	if(ok)
 	{
 		message(min, 3, "creating material fragment, node %u, type %d\n", min->node_id, type);
-		verse_send_m_fragment_create(min->node_id, id, type, &f);
+		SEND(MATERIAL, verse_send_m_fragment_create(min->node_id, id, type, &f));
 	}
 	return 1;
 }
@@ -1044,16 +1748,31 @@ static int m_create_fragment(MainInfo *min, VNMFragmentID id, const XmlNode *fra
 static int process_material(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
+	const XmlAtom	atom = xmlnode_get_atom(here);
 	const char	*el = xmlnode_get_name(here);
 
-	if(strcmp(el, "fragments") == 0)
+	if(atom == A_FRAGMENTS)
 	{
-		List	*frags, *iter;
+		List		*frags, *iter;
+		VNMFragmentID	i = 0;
 
 		frags = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("fragment-"), XMLNODE_DONE);
 		fragment_map_clear(min);
 		for(iter = frags; iter != NULL; iter = list_next(iter))
 		{
+			if(min->assigning)
+			{
+				/* With all IDs known up front, each fragment is created just once, below. */
+				VNMFragmentType	type = m_fragment_type_from_string(xmlnode_get_name(list_data(iter)) + 9);
+				uint32		lid = attrib_get_ref(list_data(iter), "id", 'f', ~0u);
+
+				if(type != ~0u && lid != ~0u)
+				{
+					fragment_map_store(min, lid, i);
+					assign_set_fragment(min, i++, type);
+				}
+				continue;
+			}
 			m_create_fragment(min, (VNMFragmentID) ~0u, list_data(iter));
 			pend_add(min, PEND_FRAGMENT_CREATE, 1);
 		}
@@ -1065,8 +1784,8 @@ static int process_material(MainInfo *min)
 		uint32	id;
 
 		id = attrib_get_ref(here, "id", 'f', ~0u);
-		if(id < min->fragment_map_size)
-			m_create_fragment(min, min->fragment_map[id], here);
+		if(fragment_map_has(min, id))
+			m_create_fragment(min, fragment_map_get(min, id), here);
 		min->iter = xmlnode_iter_next(min->iter, here);	/* Skip children. */
 	}
 	else
@@ -1074,35 +1793,125 @@ static int process_material(MainInfo *min)
 	return 1;
 }
 
+/* Parse pixels of a tile of type <lt> from the text <ts>, and send it. */
+static int b_tile_send(VNodeID node_id, VLayerID layer_id, VNBLayerType lt, uint16 x, uint16 y, uint16 z, const char *ts)
+{
+	VNBTile		tile;
+	const size_t	num = sizeof tile.vuint8 / sizeof *tile.vuint8;
+	NumScanType	type;
+	size_t		i;
+
+	switch(lt)
+	{
+	case VN_B_LAYER_UINT8:	type = NUMSCAN_UINT8;	break;
+	case VN_B_LAYER_UINT16:	type = NUMSCAN_UINT16;	break;
+	case VN_B_LAYER_REAL32:	type = NUMSCAN_REAL32;	break;
+	case VN_B_LAYER_REAL64:	type = NUMSCAN_REAL64;	break;
+	default:
+		fprintf(stderr, "loader: Can't parse 1-bpp pixel data\n");
+		return 0;
+	}
+	if((i = numscan_array(ts, type, &tile, num, NULL)) < num)
+		fprintf(stderr, "loader: Parse error in tile (%u,%u,%u), pixel %u\n", x, y, z, (unsigned int) i);
+	else
+	{
+		SEND(BITMAP, verse_send_b_tile_set(node_id, layer_id, x, y, z, lt, &tile));
+		return 1;
+	}
+	return 0;
+}
+
+/* Send the tiles of a bitmap layer stored in the VMLB section named by <section>. */
+static void b_set_layer_section(MainInfo *min, VLayerID layer_id, VNBLayerType lt, const char *section)
+{
+	VmlbSection		s;
+	const unsigned char	*xyz, *pixels;
+	VNBTile			tile;
+	const size_t		num = sizeof tile.vuint8 / sizeof *tile.vuint8;
+	size_t			size, j;
+	unsigned long		i;
+
+	switch(lt)
+	{
+	case VN_B_LAYER_UINT1:	size = sizeof tile.vuint1;	break;
+	case VN_B_LAYER_UINT8:	size = sizeof tile.vuint8;	break;
+	case VN_B_LAYER_UINT16:	size = num * 2;			break;
+	case VN_B_LAYER_REAL32:	size = num * 4;			break;
+	case VN_B_LAYER_REAL64:	size = num * 8;			break;
+	default:
+		return;
+	}
+	if(!vmlb_section_get(section, VMLB_TILES, &s))
+		return;
+	if((xyz = vmlb_array(&s, s.count, 3 * sizeof (uint16))) == NULL || (pixels = vmlb_array(&s, s.count, size)) == NULL)
+	{
+		fprintf(stderr, "loader: VMLB section %s is too short for its %lu tiles\n", section, s.count);
+		return;
+	}
+	for(i = 0; i < s.count; i++, xyz += 6, pixels += size)
+	{
+		switch(lt)
+		{
+		case VN_B_LAYER_UINT1:
+		case VN_B_LAYER_UINT8:
+			memcpy(&tile, pixels, size);
+			break;
+		case VN_B_LAYER_UINT16:
+			for(j = 0; j < num; j++)
+				tile.vuint16[j] = vmlb_uint16(pixels + 2 * j);
+			break;
+		case VN_B_LAYER_REAL32:
+			for(j = 0; j < num; j++)
+				tile.vreal32[j] = vmlb_real32(pixels + 4 * j);
+			break;
+		case VN_B_LAYER_REAL64:
+			for(j = 0; j < num; j++)
+				tile.vreal64[j] = vmlb_real64(pixels + 8 * j);
+			break;
+		}
+		SEND(BITMAP, verse_send_b_tile_set(min->node_id, layer_id, vmlb_uint16(xyz), vmlb_uint16(xyz + 2), vmlb_uint16(xyz + 4), lt, &tile));
+	}
+}
+
 static int process_bitmap(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
+	const XmlAtom	atom = xmlnode_get_atom(here);
 	const char	*el = xmlnode_get_name(here), *txt;
 
 	txt = xmlnode_eval_single(here, "");
 
-	if(strcmp(el, "dimensions") == 0)
+	if(atom == A_DIMENSIONS)
 	{
 		uint16	w, h, d;
 
 		if(sscanf(txt, "%hu %hu %hu", &w, &h, &d) == 3)
 		{
 			message(min, 2, " got dimensions: %ux%ux%u\n", w, h, d);
-			verse_send_b_dimensions_set(min->node_id, w, h, d);
+			SEND(BITMAP, verse_send_b_dimensions_set(min->node_id, w, h, d));
 			min->iter = xmlnode_iter_next(min->iter, NULL);
 		}
 	}
-	else if(strcmp(el, "layers") == 0)
+	else if(atom == A_LAYERS)
 	{
 		List	*layers, *iter;
+		VLayerID	i;
 
 		layers = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("layer-"), XMLNODE_DONE);
-		for(iter = layers; iter != NULL; iter = list_next(iter))
+		for(iter = layers, i = 0; iter != NULL; iter = list_next(iter), i++)
 		{
 			const char	*ln = xmlnode_attrib_get_value(list_data(iter), "name");
 			VNBLayerType	lt = b_layer_type_from_string(xmlnode_get_name(list_data(iter)) + 6);
 
-			verse_send_b_layer_create(min->node_id, (VLayerID) ~0u, ln, lt);
+			if(layer_id_get(min, ln) != (VLayerID) ~0u)
+				continue;
+			if(min->assigning)
+			{
+				assign_set(min, 'L', ln, i);
+				SEND(BITMAP, verse_send_b_layer_create(min->node_id, i, ln, lt));
+				continue;
+			}
+			SEND(BITMAP, verse_send_b_layer_create(min->node_id, (VLayerID) ~0u, ln, lt));
 			layer_id_set(min, ln, ~0);
 			pend_add(min, PEND_LAYER_CREATE, 1);
 		}
@@ -1113,54 +1922,41 @@ static int process_bitmap(MainInfo *min)
 	{
 		const char	*ln = xmlnode_attrib_get_value(here, "name");
 		VLayerID	lid = layer_id_get(min, ln);
-		List		*tiles, *iter;
+		List		*tiles, *tile, *iter, *titer;
 		VNBLayerType	lt = b_layer_type_from_string(el + 6);
 
-		tiles = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("tiles"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("tile"), XMLNODE_DONE);
-		for(iter = tiles; iter != NULL; iter = list_next(iter))
+		if((txt = xmlnode_attrib_get_value(here, "section")) != NULL)
 		{
-			const char	*xs = xmlnode_attrib_get_value(list_data(iter), "tile_x"),
-					*ys = xmlnode_attrib_get_value(list_data(iter), "tile_y"),
-					*zs = xmlnode_attrib_get_value(list_data(iter), "tile_z"),
-					*ts = xmlnode_eval_single(list_data(iter), "");
-			char		*eptr;
-			VNBTile		tile;
-			uint16		x, y, z, i;
-
-			if(xs == NULL || ys == NULL || zs == NULL || ts == NULL)
+			b_set_layer_section(min, lid, lt, txt);
+			min->iter = xmlnode_iter_next(min->iter, here);
+			return 1;
+		}
+		if(min->stream)
+			stream_layer_set(min, ln, lid, lt);
+		/* There can be several tiles elements, e.g. included from the saver's incremental saves,
+		 * each either holding tiles or referring to a VMLB section. Later ones win, so go in order.
+		*/
+		tiles = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("tiles"), XMLNODE_DONE);
+		for(titer = tiles; titer != NULL; titer = list_next(titer))
+		{
+			if((txt = xmlnode_attrib_get_value(list_data(titer), "section")) != NULL)
+			{
+				b_set_layer_section(min, lid, lt, txt);
 				continue;
-			x = strtoul(xs, NULL, 10);
-			y = strtoul(ys, NULL, 10);
-			z = strtoul(zs, NULL, 10);
-/*			printf("%s,%s,%s -> %u,%u,%u\n", xs, ys, zs, x, y, z);*/
-			i = 0;
-			for(i = 0; i < sizeof tile.vuint8 / sizeof *tile.vuint8; i++)
+			}
+			tile = xmlnode_nodeset_get(list_data(titer), XMLNODE_AXIS_CHILD, XMLNODE_NAME("tile"), XMLNODE_DONE);
+			for(iter = tile; iter != NULL; iter = list_next(iter))
 			{
-				/* Inspect the type for each pixel. We can afford the overhead, and it saves code. */
-				if(lt == VN_B_LAYER_UINT1)
-				{
-					fprintf(stderr, "loader: Can't parse 1-bpp pixel data\n");
-					break;
-				}
-				else if(lt == VN_B_LAYER_UINT8)
-					tile.vuint8[i] = strtoul(ts, &eptr, 10);
-				else if(lt == VN_B_LAYER_UINT16)
-					tile.vuint16[i] = strtoul(ts, &eptr, 10);
-				else if(lt == VN_B_LAYER_REAL32)
-					tile.vreal32[i] = strtod(ts, &eptr);
-				else if(lt == VN_B_LAYER_REAL64)
-					tile.vreal64[i] = strtod(ts, &eptr);
-				
-				if(eptr > ts)
-					ts = eptr;
-				else
-				{
-					fprintf(stderr, "loader: Parse error in tile (%u,%u,%u), pixel %u\n", x, y, z, i);
-					break;
-				}
+				const char	*xs = xmlnode_attrib_get_value(list_data(iter), "tile_x"),
+						*ys = xmlnode_attrib_get_value(list_data(iter), "tile_y"),
+						*zs = xmlnode_attrib_get_value(list_data(iter), "tile_z"),
+						*ts = xmlnode_eval_single(list_data(iter), "");
+
+				if(xs == NULL || ys == NULL || zs == NULL || ts == NULL)
+					continue;
+				b_tile_send(min->node_id, lid, lt, strtoul(xs, NULL, 10), strtoul(ys, NULL, 10), strtoul(zs, NULL, 10), ts);
 			}
-			if(i == sizeof tile.vuint8 / sizeof *tile.vuint8)
-				verse_send_b_tile_set(min->node_id, lid, x, y, z, lt, &tile);
+			list_destroy(tile);
 		}
 		list_destroy(tiles);
 		min->iter = xmlnode_iter_next(min->iter, here);
@@ -1170,23 +1966,69 @@ static int process_bitmap(MainInfo *min)
 	return 1;
 }
 
+/* Send the keys of a curve of <dim> dimensions stored in the VMLB section named by <section>. */
+static void c_set_curve_section(MainInfo *min, VLayerID curve_id, unsigned int dim, const char *section)
+{
+	VmlbSection		s;
+	const unsigned char	*pos, *pre_val, *val, *post_val, *pre_pos, *post_pos;
+	real64			value[4], pre_value[4], post_value[4];
+	uint32			pre[4], post[4];
+	unsigned long		i;
+	unsigned int		j;
+
+	if(dim < 1 || dim > 4 || !vmlb_section_get(section, VMLB_KEYS, &s))
+		return;
+	if((pos = vmlb_array(&s, s.count, sizeof (real64))) == NULL ||
+	   (pre_val = vmlb_array(&s, s.count, dim * sizeof (real64))) == NULL ||
+	   (val = vmlb_array(&s, s.count, dim * sizeof (real64))) == NULL ||
+	   (post_val = vmlb_array(&s, s.count, dim * sizeof (real64))) == NULL ||
+	   (pre_pos = vmlb_array(&s, s.count, dim * sizeof (uint32))) == NULL ||
+	   (post_pos = vmlb_array(&s, s.count, dim * sizeof (uint32))) == NULL)
+	{
+		fprintf(stderr, "loader: VMLB section %s is too short for its %lu keys\n", section, s.count);
+		return;
+	}
+	for(i = 0; i < s.count && i < 65535; i++)
+	{
+		for(j = 0; j < dim; j++)
+		{
+			pre_value[j]  = vmlb_real64(pre_val + 8 * (i * dim + j));
+			value[j]      = vmlb_real64(val + 8 * (i * dim + j));
+			post_value[j] = vmlb_real64(post_val + 8 * (i * dim + j));
+			pre[j]        = vmlb_uint32(pre_pos + 4 * (i * dim + j));
+			post[j]       = vmlb_uint32(post_pos + 4 * (i * dim + j));
+		}
+		SEND(CURVE, verse_send_c_key_set(min->node_id, curve_id, (uint16) i, dim, pre_value, pre, value, vmlb_real64(pos + 8 * i), post_value, post));
+	}
+}
+
 static int process_curve(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
+	const XmlAtom	atom = xmlnode_get_atom(here);
 	const char	*el = xmlnode_get_name(here), *txt;
 
-	if(strcmp(el, "curves") == 0)
+	if(atom == A_CURVES)
 	{
 		List	*curves, *iter;
+		VLayerID	i;
 
 		curves = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("curve-"), XMLNODE_DONE);
-		for(iter = curves; iter != NULL; iter = list_next(iter))
+		for(iter = curves, i = 0; iter != NULL; iter = list_next(iter), i++)
 		{
 			const char	*cn = xmlnode_attrib_get_value(list_data(iter), "name");
 			unsigned int	cd;
 
+			if(layer_id_get(min, cn) != (VLayerID) ~0u)
+				continue;
 			cd = strtoul(xmlnode_get_name(list_data(iter)) + 6, NULL, 10);
-			verse_send_c_curve_create(min->node_id, (VLayerID) ~0u, cn, cd);
+			if(min->assigning)
+			{
+				assign_set(min, 'L', cn, i);
+				SEND(CURVE, verse_send_c_curve_create(min->node_id, i, cn, cd));
+				continue;
+			}
+			SEND(CURVE, verse_send_c_curve_create(min->node_id, (VLayerID) ~0u, cn, cd));
 			layer_id_set(min, cn, ~0);
 			pend_add(min, PEND_CURVE_CREATE, 1);
 		}
@@ -1202,63 +2044,33 @@ static int process_curve(MainInfo *min)
 		uint16		key_id = 0;
 
 		dim = strtoul(el + 6, NULL, 10);
+		if((txt = xmlnode_attrib_get_value(here, "section")) != NULL)
+		{
+			c_set_curve_section(min, cid, dim, txt);
+			min->iter = xmlnode_iter_next(min->iter, here);
+			return 1;
+		}
 		keys = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("key"), XMLNODE_DONE);
 		for(iter = keys; iter != NULL; iter = list_next(iter))
 		{
 			real64	pos, value[4], pre_val[4], post_val[4];
 			uint32	pre_pos[4], post_pos[4];
 			XmlNode	*key = list_data(iter);
-			char	*eptr;
-			int	i, got = 0;
+			int	got = 0;
 
 			pos = attrib_get_real64(key, "pos", 0.0);
 			if((txt = xmlnode_eval_single(key, "value")) != NULL)
-			{
-				for(i = 0; i < dim; i++)
-				{
-					value[i] = strtod(txt, &eptr);
-					got += eptr > txt;
-					txt = eptr;
-				}
-			}
+				got += numscan_real64_vec(txt, value, dim);
 			if((txt = xmlnode_eval_single(key, "pre-value")) != NULL)
-			{
-				for(i = 0; i < dim; i++)
-				{
-					pre_val[i] = strtod(txt, &eptr);
-					got += eptr > txt;
-					txt = eptr;
-				}
-			}
+				got += numscan_real64_vec(txt, pre_val, dim);
 			if((txt = xmlnode_eval_single(key, "pre-pos")) != NULL)
-			{
-				for(i = 0; i < dim; i++)
-				{
-					pre_pos[i] = strtoul(txt, &eptr, 10);
-					got += eptr > txt;
-					txt = eptr;
-				}
-			}
+				got += numscan_uint32_vec(txt, pre_pos, dim);
 			if((txt = xmlnode_eval_single(key, "post-value")) != NULL)
-			{
-				for(i = 0; i < dim; i++)
-				{
-					post_val[i] = strtod(txt, &eptr);
-					got += eptr > txt;
-					txt = eptr;
-				}
-			}
+				got += numscan_real64_vec(txt, post_val, dim);
 			if((txt = xmlnode_eval_single(key, "post-pos")) != NULL)
-			{
-				for(i = 0; i < dim; i++)
-				{
-					post_pos[i] = strtoul(txt, &eptr, 10);
-					got += eptr > txt;
-					txt = eptr;
-				}
-			}
+				got += numscan_uint32_vec(txt, post_pos, dim);
 			if(got == 5 * dim)
-				verse_send_c_key_set(min->node_id, cid, key_id++, dim, pre_val, pre_pos, value, pos, post_val, post_pos);
+				SEND(CURVE, verse_send_c_key_set(min->node_id, cid, key_id++, dim, pre_val, pre_pos, value, pos, post_val, post_pos));
 			else
 				fprintf(stderr, "loader: Parse error in curve key, got %d values (expected %d)\n", got, 5 * dim);
 		}
@@ -1270,108 +2082,104 @@ static int process_curve(MainInfo *min)
 	return 1;
 }
 
-static int a_parse_int8(VNABlock *block, const char *data)
+/* Parse a block of type <bt> from the text <data>, and send it. */
+static int a_block_send(const MainInfo *min, VNodeID node_id, VLayerID buffer_id, VNABlockType bt, uint32 index, const char *data)
 {
-	char	*eptr;
-	size_t	i;
-
-	for(i = 0; i < VN_A_BLOCK_SIZE_INT8; i++)
+	static const struct
 	{
-		block->vint8[i] = strtol(data, &eptr, 10);
-		if(eptr == data)
-			return 0;
-	}
-	return 1;
-}
+		NumScanType	type;
+		size_t		num;
+	} format[] = {	/* Indexed by block type. Note that 24-bit samples are stored in 32-bit integers. */
+		{ NUMSCAN_INT8, VN_A_BLOCK_SIZE_INT8 }, { NUMSCAN_INT16, VN_A_BLOCK_SIZE_INT16 },
+		{ NUMSCAN_INT32, VN_A_BLOCK_SIZE_INT24 }, { NUMSCAN_INT32, VN_A_BLOCK_SIZE_INT32 },
+		{ NUMSCAN_REAL32, VN_A_BLOCK_SIZE_REAL32 }, { NUMSCAN_REAL64, VN_A_BLOCK_SIZE_REAL64 }
+	};
+	VNABlock	block;
 
-static int a_parse_int16(VNABlock *block, const char *data)
-{
-	char	*eptr;
-	size_t	i;
-
-	for(i = 0; i < VN_A_BLOCK_SIZE_INT8; i++)
-	{
-		block->vint16[i] = strtol(data, &eptr, 10);
-		if(eptr == data)
-			return 0;
-	}
-	return 1;
-}
-
-static int a_parse_int24(VNABlock *block, const char *data)
-{
-	char	*eptr;
-	size_t	i;
-
-	for(i = 0; i < VN_A_BLOCK_SIZE_INT8; i++)
+	if(data == NULL || (unsigned int) bt >= sizeof format / sizeof *format)
+		return 0;
+	if(numscan_array(data, format[bt].type, &block, format[bt].num, NULL) == format[bt].num)
 	{
-		block->vint24[i] = strtol(data, &eptr, 10);
-		if(eptr == data)
-			return 0;
+		message(min, 3, " sending audio block %u.%u.%u\n", node_id, buffer_id, index);
+		SEND(AUDIO, verse_send_a_block_set(node_id, buffer_id, index, bt, &block));
+		return 1;
 	}
-	return 1;
+	return 0;
 }
 
-static int a_parse_int32(VNABlock *block, const char *data)
+/* Send the blocks of an audio buffer stored in the VMLB section named by <section>. */
+static void a_set_buffer_section(MainInfo *min, VLayerID buffer_id, VNABlockType bt, const char *section)
 {
-	char	*eptr;
-	size_t	i;
+	VmlbSection		s;
+	const unsigned char	*index, *samples;
+	VNABlock		block;
+	size_t			num, size, j;
+	unsigned long		i;
 
-	for(i = 0; i < VN_A_BLOCK_SIZE_INT8; i++)
+	switch(bt)
 	{
-		block->vint32[i] = strtol(data, &eptr, 10);
-		if(eptr == data)
-			return 0;
+	case VN_A_BLOCK_INT8:	num = VN_A_BLOCK_SIZE_INT8;	size = 1;	break;
+	case VN_A_BLOCK_INT16:	num = VN_A_BLOCK_SIZE_INT16;	size = 2;	break;
+	case VN_A_BLOCK_INT24:	num = VN_A_BLOCK_SIZE_INT24;	size = 4;	break;
+	case VN_A_BLOCK_INT32:	num = VN_A_BLOCK_SIZE_INT32;	size = 4;	break;
+	case VN_A_BLOCK_REAL32:	num = VN_A_BLOCK_SIZE_REAL32;	size = 4;	break;
+	case VN_A_BLOCK_REAL64:	num = VN_A_BLOCK_SIZE_REAL64;	size = 8;	break;
+	default:
+		return;
 	}
-	return 1;
-}
-
-static int a_parse_real32(VNABlock *block, const char *data)
-{
-	char	*eptr;
-	size_t	i;
-
-	for(i = 0; i < VN_A_BLOCK_SIZE_INT8; i++)
+	if(!vmlb_section_get(section, VMLB_BLOCKS, &s))
+		return;
+	if((index = vmlb_array(&s, s.count, sizeof (uint32))) == NULL || (samples = vmlb_array(&s, s.count, num * size)) == NULL)
 	{
-		block->vreal32[i] = strtod(data, &eptr);
-		if(eptr == data)
-			return 0;
+		fprintf(stderr, "loader: VMLB section %s is too short for its %lu blocks\n", section, s.count);
+		return;
 	}
-	return 1;
-}
-
-static int a_parse_real64(VNABlock *block, const char *data)
-{
-	char	*eptr;
-	size_t	i;
-
-	for(i = 0; i < VN_A_BLOCK_SIZE_INT8; i++)
+	for(i = 0; i < s.count; i++, samples += num * size)
 	{
-		block->vreal64[i] = strtod(data, &eptr);
-		if(eptr == data)
-			return 0;
+		for(j = 0; j < num; j++)
+		{
+			switch(bt)
+			{
+			case VN_A_BLOCK_INT8:	block.vint8[j]   = (int8) samples[j];				break;
+			case VN_A_BLOCK_INT16:	block.vint16[j]  = (int16) vmlb_uint16(samples + 2 * j);	break;
+			case VN_A_BLOCK_INT24:	block.vint24[j]  = (int32) vmlb_uint32(samples + 4 * j);	break;
+			case VN_A_BLOCK_INT32:	block.vint32[j]  = (int32) vmlb_uint32(samples + 4 * j);	break;
+			case VN_A_BLOCK_REAL32:	block.vreal32[j] = vmlb_real32(samples + 4 * j);		break;
+			case VN_A_BLOCK_REAL64:	block.vreal64[j] = vmlb_real64(samples + 8 * j);		break;
+			}
+		}
+		SEND(AUDIO, verse_send_a_block_set(min->node_id, buffer_id, vmlb_uint32(index + 4 * i), bt, &block));
 	}
-	return 1;
 }
 
 static int process_audio(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
+	const XmlAtom	atom = xmlnode_get_atom(here);
 	const char	*el = xmlnode_get_name(here);
 
-	if(strcmp(el, "buffers") == 0)
+	if(atom == A_BUFFERS)
 	{
 		List	*buffers, *iter;
+		VLayerID	i;
 
 		buffers = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("buffer-"), XMLNODE_DONE);
-		for(iter = buffers; iter != NULL; iter = list_next(iter))
+		for(iter = buffers, i = 0; iter != NULL; iter = list_next(iter), i++)
 		{
 			const char	*bn = xmlnode_attrib_get_value(list_data(iter), "name");
 			VNABlockType	bt = a_block_type_from_string(xmlnode_get_name(list_data(iter)) + 7);
 			real64		freq = strtod(xmlnode_attrib_get_value(list_data(iter), "frequency"), NULL);
 
+			if(layer_id_get(min, bn) != (VLayerID) ~0u)
+				continue;
 			message(min, 2, "there's an audio buffer called \"%s\", type %d, freq %g Hz\n", bn, bt, freq);
-			verse_send_a_buffer_create(min->node_id, (VLayerID) ~0u, bn, bt, freq);
+			if(min->assigning)
+			{
+				assign_set(min, 'L', bn, i);
+				SEND(AUDIO, verse_send_a_buffer_create(min->node_id, i, bn, bt, freq));
+				continue;
+			}
+			SEND(AUDIO, verse_send_a_buffer_create(min->node_id, (VLayerID) ~0u, bn, bt, freq));
 			layer_id_set(min, bn, ~0);
 			pend_add(min, PEND_BUFFER_CREATE, 1);
 		}
@@ -1380,13 +2188,11 @@ static int process_audio(MainInfo *min)
 	}
 	else if(strncmp(el, "buffer-", 7) == 0)
 	{
-		const char	*bn;
+		const char	*bn, *sn;
 		VNABlockType	bt;
 		VLayerID	id;
 		List		*blocks, *iter;
 		uint32		index;
-		VNABlock	block;
-		int		(*parser[])(VNABlock *block, const char *data) = { a_parse_int8, a_parse_int16, a_parse_int24, a_parse_int32, a_parse_real32, a_parse_real64 };
 
 		bn = xmlnode_attrib_get_value(here, "name");
 		bt = a_block_type_from_string(el + 7);
@@ -1396,18 +2202,21 @@ static int process_audio(MainInfo *min)
 			return 0;
 		}
 		id = layer_id_get(min, bn);
+		if((sn = xmlnode_attrib_get_value(here, "section")) != NULL)
+		{
+			a_set_buffer_section(min, id, bt, sn);
+			min->iter = xmlnode_iter_next(min->iter, here);
+			return 1;
+		}
+		if(min->stream)
+			stream_layer_set(min, bn, id, bt);
 		blocks = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("blocks"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("block"), XMLNODE_DONE);
 		for(iter = blocks; iter != NULL; iter = list_next(iter))
 		{
 			index = attrib_get_uint32(list_data(iter), "index", ~0);
 			if(index == ~0)
 				continue;
-			if(parser[bt](&block, xmlnode_eval_single(list_data(iter), "")))
-			{
-				message(min, 3, " sending audio block %u.%u.%u\n", min->node_id, id, index);
-				verse_send_a_block_set(min->node_id, id, index, bt, &block);
-			}
-			else
+			if(!a_block_send(min, min->node_id, id, bt, index, xmlnode_eval_single(list_data(iter), "")))
 				break;
 		}
 		list_destroy(blocks);
@@ -1421,33 +2230,43 @@ static int process_audio(MainInfo *min)
 static int process_text(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
-	const char	*el = xmlnode_get_name(here), *txt;
+	const XmlAtom	el = xmlnode_get_atom(here);
+	const char	*txt;
 
-	if(strcmp(el, "language") == 0)
+	if(el == A_LANGUAGE)
 	{
 		const char	*lang = xmlnode_eval_single(here, "");
 
 		message(min, 2, "text node langauge: '%s'\n", lang);
-		verse_send_t_language_set(min->node_id, lang);
+		SEND(TEXT, verse_send_t_language_set(min->node_id, lang));
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 	}
-	else if(strcmp(el, "buffers") == 0)
+	else if(el == A_BUFFERS)
 	{
 		List	*buffers, *iter;
+		VLayerID	i;
 
 		buffers = xmlnode_nodeset_get(here, XMLNODE_AXIS_CHILD, XMLNODE_NAME("buffer"), XMLNODE_DONE);
-		for(iter = buffers; iter != NULL; iter = list_next(iter))
+		for(iter = buffers, i = 0; iter != NULL; iter = list_next(iter), i++)
 		{
 			const char	*bn = xmlnode_attrib_get_value(list_data(iter), "name");
 
-			verse_send_t_buffer_create(min->node_id, (VLayerID) ~0u, bn);
+			if(layer_id_get(min, bn) != (VLayerID) ~0u)
+				continue;
+			if(min->assigning)
+			{
+				assign_set(min, 'L', bn, i);
+				SEND(TEXT, verse_send_t_buffer_create(min->node_id, i, bn));
+				continue;
+			}
+			SEND(TEXT, verse_send_t_buffer_create(min->node_id, (VLayerID) ~0u, bn));
 			layer_id_set(min, bn, ~0);
 			pend_add(min, PEND_BUFFER_CREATE, 1);
 		}
 		list_destroy(buffers);
 		min->iter = xmlnode_iter_next(min->iter, NULL);
 	}
-	else if(strcmp(el, "buffer") == 0)
+	else if(el == A_BUFFER)
 	{
 		const char	*bn = xmlnode_attrib_get_value(here, "name");
 		VLayerID	bid = layer_id_get(min, bn);
@@ -1463,7 +2282,7 @@ static int process_text(MainInfo *min)
 				chunk = (len > sizeof buf - 1) ? sizeof buf - 1 : len;
 				memcpy(buf, txt + pos, chunk);	/* We're not in a hurry, here. */
 				buf[chunk] = '\0';
-				verse_send_t_text_set(min->node_id, bid, pos, chunk, buf);
+				SEND(TEXT, verse_send_t_text_set(min->node_id, bid, pos, chunk, buf));
 			}
 		}
 		min->iter = xmlnode_iter_next(min->iter, here);
@@ -1473,15 +2292,102 @@ static int process_text(MainInfo *min)
 	return 1;
 }
 
+static void node_create_send(MainInfo *min, const XmlNode *node, VNodeType type)
+{
+	NodeCreate	*nc = mem_alloc(sizeof *nc);
+
+	message(min, 3, " sending create, local ID is %s\n", xmlnode_attrib_get_value(node, "id"));
+	SEND(NODE, verse_send_node_create(~0, type, 0));
+	nc->node = node;
+	nc->type = type;
+	nc->id   = ~0u;
+	nc->sent = timer_now();
+	list_head_append(&min->creating, nc);
+	min->nodes_sent++;
+}
+
+static void node_create_done(MainInfo *min, List *element)
+{
+	list_head_unlink(&min->creating, element);
+	mem_free(list_data(element));
+	list_destroy(element);
+}
+
+/* Send creates for the nodes following the one being uploaded, so that up to <window> nodes
+ * have their creates out at once. Replies are matched to the nodes by type and order, in
+ * cb_node_create(), so the round trips overlap with uploading the contents of earlier nodes.
+ * This walks the same nodes in the same order as step(), just ahead of it.
+*/
+static void node_create_ahead(MainInfo *min)
+{
+	const XmlNode	*here;
+	VNodeType	type;
+
+	while(min->create_iter != NULL && min->nodes_sent < min->nodes_reached + min->window - 1)
+	{
+		here = list_data(min->create_iter);
+		if((type = node_type_from_atom(xmlnode_get_atom(here))) == V_NT_NUM_TYPES)
+		{
+			min->create_iter = xmlnode_iter_next(min->create_iter, NULL);
+			continue;
+		}
+		min->create_iter = xmlnode_iter_next(min->create_iter, here);	/* Contents are not needed here. */
+		if((type == V_NT_OBJECT) == (min->skip_objects != 0))
+			continue;
+		node_create_send(min, here, type);
+	}
+}
+
+/* Start a new pass over the file's nodes. */
+static void pass_begin(MainInfo *min, int skip_objects)
+{
+	min->skip_objects = skip_objects;
+	min->iter = min->create_iter = min->file_nodes;
+	min->nodes_sent = min->nodes_reached = 0;
+}
+
+static void step(MainInfo *min);
+
+/* Step through the current pass. Elements are processed in batches for as long as nothing is
+ * pending and the outgoing queue has room, polling the network in between. Only when there's
+ * nothing to do but wait for the server do we block on the socket.
+*/
+static void pass_run(MainInfo *min)
+{
+	const List	*before;
+	unsigned int	n;
+
+	while(min->iter != NULL || !assign_node_done(min))
+	{
+		for(n = 0; n < min->batch && min->pending == PEND_NONE && min->iter != NULL; n++)
+		{
+			if(verse_session_get_size() >= min->send_queue)
+				break;
+			before = min->iter;
+			step(min);
+			if(min->iter == before && min->pending == PEND_NONE)
+				break;		/* Stalled, waiting for assigned IDs to be confirmed. */
+		}
+		stats_wait(min->pending, n == min->batch ? 0 : 10000);
+		if(stats.requested)
+			stats_dump();
+	}
+}
+
 static void step(MainInfo *min)
 {
 	const XmlNode	*here = list_data(min->iter);
+	VNodeType	type;
+	List		*first;
 
+	stats.steps++;
 	/* New node reached? */
-	if(strncmp(xmlnode_get_name(here), "node-", 5) == 0)
+	if((type = node_type_from_atom(xmlnode_get_atom(here))) != V_NT_NUM_TYPES)
 	{
+		if(!assign_node_done(min))
+			return;
 		min->node = here;
-		min->type = node_type_from_string(xmlnode_get_name(here) + 5);
+		min->type = type;
 		message(min, 3, "In step(), found node type %d at %p\n", min->type, min->node);
 		if(min->type == V_NT_OBJECT && min->skip_objects)
 		{
@@ -1495,12 +2401,26 @@ static void step(MainInfo *min)
 			min->iter = xmlnode_iter_next(min->iter, here);
 			return;
 		}
-		message(min, 3, " sending create, local ID is %s\n", xmlnode_attrib_get_value(min->node, "id"));
+		/* Send the create now, unless node_create_ahead() already has. */
+		if(++min->nodes_reached > min->nodes_sent)
+		{
+			min->create_iter = xmlnode_iter_next(min->iter, here);
+			node_create_send(min, here, min->type);
+		}
 		min->iter = xmlnode_iter_next(min->iter, NULL);
-		verse_send_node_create(~0, min->type, 0);
-		pend_add(min, PEND_NODE_CREATE, 0);
-		dict_clear(&min->tag_groups);
-		layer_id_clear(min);
+		/* All earlier nodes are both reached and created, so this node's create is first in line. */
+		first = list_head_first(&min->creating);
+		if((min->node_id = ((NodeCreate *) list_data(first))->id) != ~0u)
+		{
+			message(min, 3, " already created as %u\n", min->node_id);
+			node_create_done(min, first);
+		}
+		else
+			pend_add(min, PEND_NODE_CREATE, 0);
+		node_create_ahead(min);
+		dict_clear(&min->ids);
+		min->assigning = min->assign_ids;
+		min->node_start = min->iter;
 	}
 	else	/* Nope, so keep processing the previous one. */
 	{
@@ -1551,6 +2471,8 @@ static void cb_a_buffer_create(void *user, VNodeID node_id, VLayerID buffer_id,
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
+		if(assign_confirm(min, 'L', buffer_id, name))
+			return;
 		if(min->pending == PEND_BUFFER_CREATE)
 		{
 			message(min, 5, "  and we're buffer-create blocked, how interesting\n");
@@ -1568,6 +2490,8 @@ static void cb_t_buffer_create(void *user, VNodeID node_id, VLayerID buffer_id,
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
+		if(assign_confirm(min, 'L', buffer_id, name))
+			return;
 		if(min->pending == PEND_BUFFER_CREATE)
 		{
 			message(min, 5, "  and we're buffer-create blocked, how interesting\n");
@@ -1585,6 +2509,8 @@ static void cb_c_curve_create(void *user, VNodeID node_id, VLayerID curve_id, co
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
+		if(assign_confirm(min, 'L', curve_id, name))
+			return;
 		if(min->pending == PEND_CURVE_CREATE)
 		{
 			message(min, 5, "  and we're curve-create blocked, how interesting\n");
@@ -1602,6 +2528,8 @@ static void cb_b_layer_create(void *user, VNodeID node_id, VLayerID layer_id, co
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
+		if(assign_confirm(min, 'L', layer_id, name))
+			return;
 		if(min->pending == PEND_LAYER_CREATE)
 		{
 			message(min, 5, "  and we're layer-create blocked, how interesting\n");
@@ -1620,16 +2548,17 @@ static void cb_m_fragment_create(void *user, VNodeID node_id, VNMFragmentID frag
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in the current node\n");
+		if(assign_confirm_fragment(min, fragment_id, type))
+			return;
 		if(min->pending == PEND_FRAGMENT_CREATE)
 		{
-			List	*frags, *iter;
+			XmlNodeCursor	cursor;
+			const XmlNode	*here;
 
 			message(min, 5, "  and we're fragment-create blocked, how interesting\n");
-			frags = xmlnode_nodeset_get(min->node, XMLNODE_AXIS_CHILD, XMLNODE_NAME("fragments"),
-						     XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("fragment-"), XMLNODE_DONE);
-			for(iter = frags; iter != NULL; iter = list_next(iter))
+			xmlnode_query_begin(&cursor, Queries.fragments, min->node);
+			while((here = xmlnode_query_next(&cursor)) != NULL)
 			{
-				const XmlNode	*here = list_data(iter);
 				VNMFragmentType	ftype = m_fragment_type_from_string(xmlnode_get_name(here) + 9);
 
 				if(ftype == type)
@@ -1637,7 +2566,7 @@ static void cb_m_fragment_create(void *user, VNodeID node_id, VNMFragmentID frag
 					uint32	id = attrib_get_ref(here, "id", 'f', ~0u);
 					if(id != ~0u)
 					{
-						if(id < min->fragment_map_size && min->fragment_map[id] == (VNMFragmentID) ~0u)
+						if(fragment_map_has(min, id) && fragment_map_get(min, id) == (VNMFragmentID) ~0u)
 						{
 							fragment_map_store(min, id, fragment_id);
 							pend_sub(min);
@@ -1646,7 +2575,6 @@ static void cb_m_fragment_create(void *user, VNodeID node_id, VNMFragmentID frag
 					}
 				}
 			}
-			list_destroy(frags);
 		}
 	}
 }
@@ -1660,6 +2588,8 @@ static void cb_g_layer_create(void *user, VNodeID node_id, VLayerID layer_id, co
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
+		if(assign_confirm(min, 'L', layer_id, name))
+			return;
 		layer_id_set(min, name, layer_id);	/* Always store, even if not expected (server sends vertex/poly spontaneously). */
 		if(min->pending == PEND_LAYER_CREATE)
 		{
@@ -1679,7 +2609,9 @@ static void cb_o_method_group_create(void *user, VNodeID node_id, uint16 group_i
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
-		layer_id_set(min, name, group_id);
+		if(assign_confirm(min, 'M', group_id, name))
+			return;
+		dict_set(&min->ids, 'M', name, group_id);
 		if(min->pending == PEND_METHODGROUP_CREATE)
 		{
 			message(min, 5, "  and we're group-create blocked, how interesting\n");
@@ -1698,10 +2630,12 @@ static void cb_tag_group_create(void *user, VNodeID node_id, uint16 group_id, co
 	if(node_id == min->node_id)
 	{
 		message(min, 5, " that's in our current node\n");
+		if(assign_confirm(min, 'T', group_id, name))
+			return;
 		if(min->pending == PEND_TAGGROUP_CREATE)
 		{
 			message(min, 5, "  and we're tag group-create blocked, how interesting\n");
-			dict_set(&min->tag_groups, name, group_id);
+			dict_set(&min->ids, 'T', name, group_id);
 			pend_sub(min);
 		}
 		else
@@ -1712,34 +2646,47 @@ static void cb_tag_group_create(void *user, VNodeID node_id, uint16 group_id, co
 static void cb_node_create(void *user, VNodeID node_id, VNodeType type, VNodeOwner owner)
 {
 	MainInfo	*min = user;
+	List		*iter;
 
 	if(type == V_NT_OBJECT && node_id == min->avatar)
 		return;
 	if(owner != VN_OWNER_MINE)
 		return;
 	message(min, 2, "There's a node called %u of type %d\n", node_id, type);
-	if(min->pending == PEND_NODE_CREATE && type == min->type)
+	/* Nodes are created in the order the creates were sent, so match with the oldest one of the type. */
+	for(iter = list_head_first(&min->creating); iter != NULL; iter = list_next(iter))
 	{
-		VNodeID	local;
+		NodeCreate	*nc = list_data(iter);
+		const XmlNode	*node = nc->node;
+		VNodeID		local;
 		const char	*name;
 
-		local = attrib_get_ref(min->node, "id", 'n', ~0);
+		if(nc->type != type || nc->id != ~0u)
+			continue;
+		nc->id = node_id;
+		stats_latency(PEND_NODE_CREATE, nc->sent);
+		if(node == min->node && min->pending == PEND_NODE_CREATE)
+		{
+			min->node_id = node_id;
+			min->pending = PEND_NONE;
+			node_create_done(min, iter);
+		}
+		local = attrib_get_ref(node, "id", 'n', ~0);
 		if(local == ~0)
 		{
 			fprintf(stderr, "loader: Failed to read ID attrib\n");
 			return;
 		}
-		message(min, 2, "that means node '%s' got created\n", xmlnode_attrib_get_value(min->node, "id"));
+		message(min, 2, "that means node '%s' got created\n", xmlnode_attrib_get_value(node, "id"));
 		node_map_set(min, local, node_id);
-		min->node_id = node_id;
-		min->pending = PEND_NONE;
 		message(min, 3, "sending node_subscribe, node %u\n", node_id);
-		verse_send_node_subscribe(node_id);
-		if((name = xmlnode_attrib_get_value(min->node, "name")) != NULL)
+		SEND(NODE, verse_send_node_subscribe(node_id));
+		if((name = xmlnode_attrib_get_value(node, "name")) != NULL)
 		{
-			verse_send_node_name_set(node_id, name);
+			SEND(NODE, verse_send_node_name_set(node_id, name));
 			message(min, 2, "Name set, node %u is \"%s\"\n", node_id, name);
 		}
+		break;
 	}
 }
 
@@ -1763,198 +2710,456 @@ static int type_to_position(const char *type)
 	return 0;
 }
 
-static int cmp_node(const void *a, const void *b)
-{
-	const XmlNode	*na = a, *nb = b;
-	const char	*ta = xmlnode_get_name(na) + 4 + 1,
-			*tb = xmlnode_get_name(nb) + 4 + 1;
-	int		pa = type_to_position(ta), pb = type_to_position(tb);
+#define	NODE_POSITIONS	7	/* Number of distinct values returned by type_to_position(). */
 
-	return pa < pb ? -1 : pa > pb;
-}
+/* Put <objects> in an order where each object comes after all objects it links to as children,
+ * so that every link can be set as soon as its object is created. This is Kahn's algorithm, run
+ * on the child links backwards: objects without any (known) children are ready right away, and
+ * an object becomes ready once the last of its children has been placed. Ready objects are taken
+ * in the order they became ready, starting from file order, so the result is deterministic.
+ * Objects that are part of, or depend on, a cycle of child links are reported, and put last.
+*/
+static List * objects_sort(const List *objects)
+{
+	size_t		num = list_length(objects), i, head, tail;
+	const List	*iter;
+	LinkInfo	*info, **order;
+	Hash		*ids;
+	XmlNodeCursor	cursor;
+	const XmlNode	*link;
+	ListHead	sorted;
+
+	if(num == 0)
+		return NULL;
+	info  = mem_alloc(num * sizeof *info);
+	order = mem_alloc(num * sizeof *order);
+	ids   = hash_new_string();
+	for(i = 0, iter = objects; iter != NULL; iter = list_next(iter), i++)
+	{
+		info[i].node = list_data(iter);
+		info[i].id   = xmlnode_attrib_get_value(info[i].node, "id");
+		info[i].children = 0;
+		list_head_init(&info[i].parents);
+		if(info[i].id != NULL)
+			hash_insert(ids, info[i].id, info + i);
+	}
+	for(i = 0; i < num; i++)
+	{
+		xmlnode_query_begin(&cursor, Queries.child_links, info[i].node);
+		while((link = xmlnode_query_next(&cursor)) != NULL)
+		{
+			LinkInfo	*child = hash_lookup(ids, xmlnode_attrib_get_value(link, "node"));
 
-static int is_object(const void *listdata, const void *data)
-{
-	return xmlnode_get_name(listdata)[4 + 1] != 'o';	/* Returns 0 when 'o' is found, as needed. */
+			if(child != NULL)
+			{
+				info[i].children++;
+				list_head_append(&child->parents, info + i);
+			}
+		}
+	}
+	/* The order array doubles as the queue; objects between head and tail are ready. */
+	for(i = tail = 0; i < num; i++)
+	{
+		if(info[i].children == 0)
+			order[tail++] = info + i;
+	}
+	for(head = 0; head < tail; head++)
+	{
+		for(iter = list_head_first(&order[head]->parents); iter != NULL; iter = list_next(iter))
+		{
+			LinkInfo	*parent = list_data(iter);
+
+			if(--parent->children == 0)
+				order[tail++] = parent;
+		}
+	}
+	for(i = 0; i < num && tail < num; i++)
+	{
+		if(info[i].children > 0)
+		{
+			const char	*name = info[i].id;
+
+			if(name == NULL && (name = xmlnode_attrib_get_value(info[i].node, "name")) == NULL)
+				name = "(no id)";
+			fprintf(stderr, "loader: Object %s is part of, or links to, a circular chain of child links\n", name);
+			order[tail++] = info + i;
+		}
+	}
+	list_head_init(&sorted);
+	for(i = 0; i < num; i++)
+	{
+		list_head_append(&sorted, order[i]->node);
+		list_head_destroy(&info[i].parents);
+	}
+	hash_destroy(ids);
+	mem_free(order);
+	mem_free(info);
+
+	return list_head_detach(&sorted);
 }
 
-static int linkinfo_equal(const void *key1, const void *key2)
+/* Gather the nodes of the current file (or all remaining files, when merging), in upload order:
+ * grouped on type, with the objects last and sorted on their child links.
+*/
+static List * file_begin(MainInfo *min)
 {
-	return strcmp(key1, key2) == 0;
+	List		*list, *iter;
+	ListHead	all, position[NODE_POSITIONS];
+	int		i;
+
+	/* When merging, the nodes of all remaining files are sorted together. */
+	list_head_init(&all);
+	for(iter = min->file_iter; iter != NULL; iter = min->merge ? list_next(iter) : NULL)
+		list_head_concat(&all, xmlnode_nodeset_get(list_data(iter), XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("node"), XMLNODE_DONE));
+	list = list_head_detach(&all);
+	/* Distribute on type position, which keeps file order within each type. */
+	for(i = 0; i < NODE_POSITIONS; i++)
+		list_head_init(&position[i]);
+	for(iter = list; iter != NULL; iter = list_next(iter))
+		list_head_append(&position[type_to_position(xmlnode_get_name(list_data(iter)) + 4 + 1)], list_data(iter));
+	list_destroy(list);
+	for(i = 0; i < NODE_POSITIONS - 1; i++)
+		list_head_concat(&all, list_head_detach(&position[i]));
+	/* The objects are last, and need to be sorted with respect to their links. */
+	list = list_head_detach(&position[NODE_POSITIONS - 1]);
+	list_head_concat(&all, objects_sort(list));
+	list_destroy(list);
+
+	return list_head_detach(&all);
 }
 
-static int linkinfo_clear_visited(void *data, void *user)
+static void cb_connect_accept(void *user, VNodeID avatar, const char *address, const uint8 *host_id)
 {
-	LinkInfo	*li = (LinkInfo *) data;
+	MainInfo	*min = user;
 
-	li->visited = FALSE;
-	return 1;
+	min->avatar = avatar;
+	message(min, 1, "Connected as %u to %s\n", avatar, address);
+	SEND(NODE, verse_send_node_index_subscribe(~0));
+
+	stats_latency(PEND_CONNECT, min->pend_since);
+	min->pending = PEND_NONE;
 }
 
-static void follow_links(const Hash *objects, LinkInfo *li)
+/* ----------------------------------------------------------------------------------------- */
+
+/* Load a file, remembering it if it is VMLB. Only the latter touches state shared by the parsing
+ * threads, so it is all that is locked. Returns NULL if the file can't be loaded, or is damaged VMLB.
+*/
+static char * file_load(const char *filename, size_t *size)
 {
-	List	*links, *iter;
+	DynStr	*ds;
+	char	*buf;
+	int	vmlb;
 
-	if(li->visited)
+	if((ds = dynstr_new_from_file(filename)) == NULL)
+		return NULL;
+	*size = dynstr_length(ds);
+	buf = dynstr_destroy(ds, 0);	/* Destroys the string, not the buffer, which is returned. */
+	jobs_lock(NULL);
+	vmlb = vmlb_register(buf, *size);
+	jobs_unlock(NULL);
+	if(vmlb < 0)
 	{
-		printf("circular stuff found\n");
-		li->circular = TRUE;
-		return;
+		mem_free(buf);
+		return NULL;
 	}
-	li->visited = TRUE;
-	li->count++;
-	links = xmlnode_nodeset_get(li->node, XMLNODE_AXIS_CHILD, XMLNODE_NAME("links"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("link"), XMLNODE_ATTRIB_VAL("label", "child"), XMLNODE_DONE);
-	for(iter = links; iter != NULL; iter = list_next(iter))
-	{
-		const char	*node = xmlnode_attrib_get_value(list_data(iter), "node");
-		LinkInfo	*child = hash_lookup(objects, node);
+	return buf;
+}
+
+/* This is an xmlnode loader callback. It uses some simple heuristics to get the path to the
+ * root input file we're currently processing, and appends any href value there, if it looks
+ * relative. Included files can be VMLB, too.
+*/
+static char * xml_load_callback(const char *uri, void *user)
+{
+	char	buffer[4096], *put = buffer;
+	size_t	size;
 
-		if(child != NULL)
-			follow_links(objects, child);
+	if(uri[0] != '/' && uri[0] != '\\')
+	{
+		strcpy(buffer, user);	/* Overwrite with full input filename, e.g. "a/b/c/d/foo.vml". */
+		if((put = strrchr(buffer, '/')) != NULL || ((put = strrchr(buffer, '\\'))) != NULL)
+			put++;	/* Advance to just after last separator. */
+		else
+			put = buffer;
 	}
-	list_destroy(links);
+	strcpy(put, uri);
+	return file_load(buffer, &size);
 }
 
-/* Store data from hash table into flat array. */
-static int linkinfo_store(void *data, void *user)
+/* Filter for the streaming tree builder, leaving out the bulk data elements. These are instead
+ * uploaded by stream_upload(), below, so the tree holds just the node "headers".
+*/
+static int stream_keep(const XmlNode *node, void *user)
 {
-	LinkInfo	***pptr = user, **ptr = *pptr;
+	const XmlNode	*parent = xmlnode_get_parent(node);
 
-	*ptr++ = data;
-	*pptr = ptr;
+	if(parent == NULL || xmlnode_get_atom(parent) == XMLNODE_ATOM_NONE)
+		return 1;
+	switch(xmlnode_get_atom(node))
+	{
+	case A_V:
+	case A_P:
+		return strncmp(xmlnode_get_name(parent), "layer-", 6) != 0;
+	case A_TILE:
+		return xmlnode_get_atom(parent) != A_TILES;
+	case A_BLOCK:
+		return xmlnode_get_atom(parent) != A_BLOCKS;
+	}
 	return 1;
 }
 
-static int cmp_linkinfo_ref(const void *a, const void *b)
+/* Number the nodes in a streamed tree in document order, for stream_layer_key(). */
+static void stream_number_nodes(XmlNode *root)
 {
-	const LinkInfo	**la = (const LinkInfo **) a, **lb = (const LinkInfo **) b;
+	List		*flat, *iter;
+	unsigned long	n = 0;
 
-	return -((*la)->count < (*lb)->count ? -1 : (*la)->count > (*lb)->count);
+	flat = xmlnode_iter_begin(root);
+	for(iter = flat; iter != NULL; iter = list_next(iter))
+	{
+		if(node_type_from_atom(xmlnode_get_atom(list_data(iter))) != V_NT_NUM_TYPES)
+			xmlnode_set_user(list_data(iter), (void *) n++);
+	}
+	list_destroy(flat);
 }
 
-static List * linkinfo_collect(const Hash *hash)
+/* A file to be loaded, possibly by a worker thread. Once loaded, this is kept as the user pointer
+ * of the tree, so the filename and load times are known when it is uploaded.
+*/
+typedef struct
 {
-	size_t		num = hash_size(hash), i;
-	LinkInfo	**sort, **put;
-	List		*objsort = NULL;
-
-	put = sort = malloc(sizeof *sort * num);
-	hash_foreach(hash, linkinfo_store, &put);
-	qsort(sort, num, sizeof *sort, cmp_linkinfo_ref);
-	for(i = 0; i < num; i++)
-		objsort = list_prepend(objsort, sort[i]->node);
-	objsort = list_reverse(objsort);
-
-	return objsort;
-}
+	const char	*filename;
+	int		stream;
+	XmlNode		*root;
+	size_t		size;		/* Size of file in bytes, if known. */
+	double		time_read;	/* Seconds spent reading the file into memory. */
+	double		time_parse;	/* Seconds spent parsing it into a tree. */
+} LoadJob;
 
-static List * file_begin(MainInfo *min)
+static XmlNode * load(LoadJob *job)
 {
-	List	*list, *iter, *sorted = NULL, *obj0, *objsort = NULL;
-	Hash	*obj;
-	
-	list = xmlnode_nodeset_get(list_data(min->file_iter), XMLNODE_AXIS_CHILD, XMLNODE_NAME_PREFIX("node"), XMLNODE_DONE);
-	for(iter = list; iter != NULL; iter = list_next(iter))
-		sorted = list_insert_sorted(sorted, list_data(iter), cmp_node);
-	/* At this point, we have the list containing all the nodes. The object nodes form the tail.
-	 * We need to re-sort that sub-part of the list, so that the objects end up sorted based on
-	 * child relationships, as well. Deep stuff.
-	*/
-	obj0 = list_find_custom(sorted, NULL, is_object);
-	sorted = list_split(sorted, obj0);
-	/* Now, we have the non-object nodes in the sorted order in 'sorted', and obj0 points at
-	 * the first object. We need to create a new list of objects, sorted with respect to the
-	 * links and stuff. The algorithm here is simply: recurse through all links, and each time
-	 * a node is reached, increase a counter in that node. Then sort on the final count value.
-	 */
-	obj = hash_new(hash_hash_string, linkinfo_equal);
-	for(iter = obj0; iter != NULL; iter = list_next(iter))
-	{
-		LinkInfo	*li = malloc(sizeof *li);
-
-		li->visited = FALSE;
-		li->circular = FALSE;
-		li->count = 0u;
-		li->id = xmlnode_attrib_get_value(list_data(iter), "id");
-		li->node = list_data(iter);
-		hash_insert(obj, li->id, li);
-	}
-	/* Now, we have a hash with all objects in it, keyed on the XML ID ("n1", "n2" etc.). We
-	 * can traverse the objects in any order, and just follow the links in each node. The order
-	 * chosen is the one the nodes are already in, for simplicity.
-	*/
-	for(iter = obj0; iter != NULL; iter = list_next(iter))
+	XmlNode	*root;
+	char	*buf;
+	double	t0 = timer_now(), t1;
+
+	if(job->stream)
 	{
-		LinkInfo	*li = hash_lookup(obj, xmlnode_attrib_get_value(list_data(iter), "id"));
+		FILE	*in;
+
+		if((in = fopen(job->filename, "rb")) != NULL)
+		{
+			char	magic[4];
 
-		hash_foreach(obj, linkinfo_clear_visited, NULL);
-		if(li != NULL)
-			follow_links(obj, li);
+			if(fseek(in, 0, SEEK_END) == 0)
+				job->size = ftell(in);
+			if(fseek(in, -8, SEEK_END) == 0 && fread(magic, sizeof magic, 1, in) == 1 && memcmp(magic, "VMLB", sizeof magic) == 0)
+			{
+				fprintf(stderr, "loader: \"%s\" is VMLB, which can't be streamed\n", job->filename);
+				fclose(in);
+				return NULL;
+			}
+			fclose(in);
+		}
+		xmlnode_set_loader(xml_load_callback, (void *) job->filename);
+		if((root = xmlnode_new_from_file(job->filename, stream_keep, NULL)) != NULL)
+			stream_number_nodes(root);
+		job->time_parse = timer_now() - t0;	/* Reading and parsing are one and the same, here. */
+		return root;
 	}
-	/* Now, all links should have been recursively followed. Time to extract the data from the
-	 * hash table, and use it to build a new list sorted on the "depth" of each node (deepest first).
-	 * This is a bit involved, since the data we want to compare is not the same as the data we want
-	 * to build the list out of.
-	*/
-	objsort = linkinfo_collect(obj);
-	
-	/* Link the two lists back together. */
-	sorted = list_concat(sorted, objsort);
-	/* And throw out the old objects-only tail. */
- 	list_destroy(obj0);
-	hash_destroy(obj);
+	buf = file_load(job->filename, &job->size);
+	t1 = timer_now();
+	job->time_read = t1 - t0;
+	if(buf == NULL)
+		return NULL;
+	root = xmlnode_new_insitu_loader(buf, xml_load_callback, (void *) job->filename);	/* Tree takes over the buffer. */
+	job->time_parse = timer_now() - t1;
+	return root;
+}
 
-	return sorted;
+static void load_job(void *item, void *user)
+{
+	LoadJob	*job = item;
+
+	job->root = load(job);
 }
 
-static void cb_connect_accept(void *user, VNodeID avatar, const char *address, const uint8 *host_id)
+/* Load the named files, using up to <threads> threads, and return a list of the trees in the
+ * same order as the names. Files that fail to load are reported, and left out.
+*/
+static List * load_all(const char **filenames, size_t num, int stream, unsigned int threads)
 {
-	MainInfo	*min = user;
+	LoadJob	*job;
+	List	*files = NULL;
+	size_t	i;
 
-	min->avatar = avatar;
-	message(min, 1, "Connected as %u to %s\n", avatar, address);
-	verse_send_node_index_subscribe(~0);
+	if(num == 0)
+		return NULL;
+	job = mem_alloc(num * sizeof *job);
+	for(i = 0; i < num; i++)
+	{
+		job[i].filename   = filenames[i];
+		job[i].stream     = stream;
+		job[i].root       = NULL;
+		job[i].size       = 0;
+		job[i].time_read  = 0.0;
+		job[i].time_parse = 0.0;
+	}
+	if(stream)
+		threads = 1;	/* The streaming builder uses the global loader, so it's one at a time. */
+	if(threads > 1)
+	{
+		/* Files and their xi:includes share one budget: each of the (at most <num>) file workers
+		 * gets its share of <threads> for its includes, so the total never exceeds <threads>.
+		*/
+		unsigned int	outer = num < threads ? (unsigned int) num : threads;
 
-	min->pending = PEND_NONE;
+		xmlnode_set_lock(jobs_lock, jobs_unlock, NULL);
+		xmlnode_set_include_jobs(jobs_run, threads / outer);
+	}
+	jobs_run(job, num, sizeof *job, load_job, NULL, threads);
+	xmlnode_set_include_jobs(NULL, 0);
+	xmlnode_set_lock(NULL, NULL, NULL);
+	for(i = 0; i < num; i++)
+	{
+		if(job[i].root != NULL)
+		{
+			LoadJob	*keep = mem_alloc(sizeof *keep);
+
+			*keep = job[i];
+			xmlnode_set_user(job[i].root, keep);
+			stats.files++;
+			stats.bytes += job[i].size;
+			stats.time_read += job[i].time_read;
+			stats.time_parse += job[i].time_parse;
+			files = list_append(files, job[i].root);
+		}
+		else
+			fprintf(stderr, "loader: Couldn't load VML from \"%s\"\n", job[i].filename);
+	}
+	mem_free(job);
+	return files;
 }
 
 /* ----------------------------------------------------------------------------------------- */
 
-/* This is an xmlnode loader callback. It uses some simple heuristics to get the path to the
- * root input file we're currently processing, and appends any href value there, if it looks
- * relative.
-*/
-static char * xml_load_callback(const char *uri, void *user)
+/* State for the bulk data pass of streaming mode. */
+typedef struct
 {
-	char	buffer[4096], *put = buffer;
-	DynStr	*ds;
+	MainInfo		*min;
+	VNodeType		type;		/* Type of current node, or ~0 if not interesting. */
+	unsigned long		node;		/* Ordinal of next node. */
+	const StreamLayer	*layer;		/* Current layer, if known. */
+	GScanSend		scan_send;
+	const char		*elname;
+	int			in_element;	/* Inside a data element of the current layer? */
+	uint32			index;
+	uint16			tile[3];
+	real64			tmp[4];
+	unsigned long		count;
+} Streamer;
+
+static int stream_start(const XmlNode *node, void *user)
+{
+	Streamer	*st = user;
+	const char	*el = xmlnode_get_name(node);
+	VNodeType	type;
 
-	if(uri[0] != '/' && uri[0] != '\\')
+	if(el == NULL)
+		return 1;
+	if((type = node_type_from_atom(xmlnode_get_atom(node))) != V_NT_NUM_TYPES)
 	{
-		strcpy(buffer, user);	/* Overwrite with full input filename, e.g. "a/b/c/d/foo.vml". */
-		if((put = strrchr(buffer, '/')) != NULL || ((put = strrchr(buffer, '\\'))) != NULL)
-			put++;	/* Advance to just after last separator. */
-		else
-			put = buffer;
+		st->type = type;
+		st->node++;
+		if(st->type != V_NT_GEOMETRY && st->type != V_NT_BITMAP && st->type != V_NT_AUDIO)
+			return 0;	/* Nothing streamed in these, skip right past. */
 	}
-	strcpy(put, uri);
-	if((ds = dynstr_new_from_file(buffer)) != NULL)
-		return dynstr_destroy(ds, 0);	/* Destroys the string, not the buffer, which is returned. */
-	return NULL;
+	else if((st->type == V_NT_GEOMETRY && strncmp(el, "layer-", 6) == 0) ||
+		(st->type == V_NT_BITMAP && strncmp(el, "layer-", 6) == 0) ||
+		(st->type == V_NT_AUDIO && strncmp(el, "buffer-", 7) == 0))
+	{
+		char	key[sizeof st->layer->key];
+
+		stream_layer_key(key, sizeof key, st->node - 1, xmlnode_attrib_get_value(node, "name"));
+		if((st->layer = hash_lookup(st->min->stream_layers, key)) == NULL)
+			return 0;
+		if(st->type == V_NT_GEOMETRY && (st->scan_send = g_scan_send_get(st->layer->type, &st->elname)) == NULL)
+			return 0;
+		st->index = 0;
+	}
+	else if(st->layer != NULL)
+	{
+		if(st->type == V_NT_GEOMETRY)
+			st->in_element = strcmp(el, st->elname) == 0;
+		else if(st->type == V_NT_BITMAP && xmlnode_get_atom(node) == A_TILE)
+		{
+			st->tile[0] = attrib_get_uint32(node, "tile_x", ~0u);
+			st->tile[1] = attrib_get_uint32(node, "tile_y", ~0u);
+			st->tile[2] = attrib_get_uint32(node, "tile_z", ~0u);
+			st->in_element = xmlnode_attrib_get_value(node, "tile_x") != NULL &&
+					 xmlnode_attrib_get_value(node, "tile_y") != NULL &&
+					 xmlnode_attrib_get_value(node, "tile_z") != NULL;
+		}
+		else if(st->type == V_NT_AUDIO && xmlnode_get_atom(node) == A_BLOCK)
+			st->in_element = (st->index = attrib_get_uint32(node, "index", ~0u)) != ~0u;
+	}
+	return 1;
 }
 
-static XmlNode * load(const char *filename)
+static void stream_text(const char *text, void *user)
 {
-	DynStr	*ds;
+	Streamer		*st = user;
+	const StreamLayer	*sl = st->layer;
 
-	xmlnode_set_loader(xml_load_callback, filename);
-	if((ds = dynstr_new_from_file(filename)) != NULL)
+	if(!st->in_element)
+		return;
+	if(st->type == V_NT_GEOMETRY)
 	{
-		XmlNode	*n = xmlnode_new(dynstr_string(ds));
-		dynstr_destroy(ds, 1);
-		return n;
+		if(st->scan_send(sl->node_id, sl->layer_id, text, st->tmp, st->index, st->min))
+			st->index++;
 	}
-	return NULL;
+	else if(st->type == V_NT_BITMAP)
+		b_tile_send(sl->node_id, sl->layer_id, sl->type, st->tile[0], st->tile[1], st->tile[2], text);
+	else if(st->type == V_NT_AUDIO)
+		a_block_send(st->min, sl->node_id, sl->layer_id, sl->type, st->index, text);
+	st->in_element = 0;
+	if(++st->count % 1000 == 0)
+		verse_callback_update(0);	/* Keep the connection alive, and the outgoing queue moving. */
+}
+
+static void stream_end(const char *element, void *user)
+{
+	Streamer	*st = user;
+
+	st->in_element = 0;
+	if(strncmp(element, "layer-", 6) == 0 || strncmp(element, "buffer-", 7) == 0)
+		st->layer = NULL;
+	else if(strncmp(element, "node-", 5) == 0)
+		st->type = ~0;
+}
+
+/* Second pass of streaming mode: read through the file again, and upload the bulk data that was
+ * left out of the tree, into the layers created while processing that.
+*/
+static void stream_upload(MainInfo *min, const char *filename)
+{
+	const XmlNodeEvents	events = { stream_start, stream_text, stream_end };
+	Streamer		st;
+
+	st.min        = min;
+	st.type       = ~0;
+	st.node       = 0;
+	st.layer      = NULL;
+	st.scan_send  = NULL;
+	st.elname     = NULL;
+	st.in_element = 0;
+	st.index      = 0;
+	st.count      = 0;
+	message(min, 1, "Streaming bulk data from \"%s\"\n", filename);
+	xmlnode_set_loader(xml_load_callback, (void *) filename);
+	if(!xmlnode_parse_file(filename, &events, &st))
+		fprintf(stderr, "loader: Error while streaming data from \"%s\"\n", filename);
+	message(min, 1, "Streamed %lu elements\n", st.count);
 }
 
 /* Sort the nodes in a good access-order, then flatten them and concatenate the resulting element-lists.
@@ -1962,44 +3167,109 @@ static XmlNode * load(const char *filename)
 */
 static void sort_nodes(MainInfo *min)
 {
-	List	*sorted, *iter, *last = NULL;
-	uint32	cnt = 0;
+	List		*sorted, *iter;
+	ListHead	nodes;
+	uint32		cnt = 0;
+	double		t0 = timer_now(), t1;
 
-	min->file_nodes = NULL;
-	/* This loop avoids doing concat() from the head of the list, instead maintaining a last-pointer
-	 * and concatenating only from there. This (roughly) doubles the speed on a big VML file.
+	sorted = file_begin(min);
+	t1 = timer_now();
+	/* The header tracks the tail, so each node's elements are appended without walking the
+	 * list built so far.
 	*/
-	for(iter = sorted = file_begin(min); iter != NULL; iter = list_next(iter))
+	list_head_init(&nodes);
+	for(iter = sorted; iter != NULL; iter = list_next(iter))
 	{
-		List *elems = xmlnode_iter_begin(list_data(iter));
-		if(last == NULL)
-			last = min->file_nodes = list_concat(min->file_nodes, elems);
-		else
-			list_concat(last, elems);
-		last = list_last(elems);
+		list_head_concat(&nodes, xmlnode_iter_begin(list_data(iter)));
 		cnt++;
 		if(cnt % 500 == 0)
 			verse_callback_update(10);	/* Make the network breathe a little. */
 	}
 	list_destroy(sorted);
-	min->iter = min->file_nodes;
+	min->elements = list_head_length(&nodes);
+	min->iter = min->file_nodes = list_head_detach(&nodes);
+	min->time_order = t1 - t0;
+	min->time_sort = timer_now() - t1;
+	stats.elements += min->elements;
+	stats.time_order += min->time_order;
+	stats.time_sort += min->time_sort;
+}
+
+/* Print a line of timings for the upload just done, of the files from min->file_iter up to but not
+ * including <end>. The format is meant to be easy to pick apart with scripts: "bench" followed by
+ * key=value pairs, with times in seconds. Parsing speed is in megabytes of VML per second, while
+ * processing speed is in elements per second converted into commands and sent.
+*/
+static void bench_report(const MainInfo *min, const List *end, double time_process)
+{
+	const List	*iter;
+	const LoadJob	*job;
+	unsigned int	files = 0;
+	unsigned long	bytes = 0;
+	double		time_read = 0.0, time_parse = 0.0;
+
+	for(iter = min->file_iter; iter != end; iter = list_next(iter), files++)
+	{
+		job = xmlnode_get_user(list_data(iter));
+		bytes += job->size;
+		time_read += job->time_read;
+		time_parse += job->time_parse;
+	}
+	job = xmlnode_get_user(list_data(min->file_iter));
+	printf("bench file=%s files=%u bytes=%lu elements=%lu read=%.6f parse=%.6f order=%.6f sort=%.6f process=%.6f",
+	       job->filename, files, bytes, min->elements, time_read, time_parse, min->time_order, min->time_sort, time_process);
+	printf(" parse_mbps=%.3f process_eps=%.1f\n",
+	       time_read + time_parse > 0.0 ? bytes / (1E6 * (time_read + time_parse)) : 0.0,
+	       time_process > 0.0 ? min->elements / time_process : 0.0);
+}
+
+/* Summarize the create round trips measured, one line per state that had any. */
+static void latency_report(const MainInfo *min)
+{
+	const Histogram	*h;
+	int		i;
+
+	for(i = 1; i < PEND_STATES; i++)
+	{
+		h = &stats.latency[i];
+		if(h->count == 0)
+			continue;
+		message(min, 1, "Latency %-18s %6lu samples, p50 %9.3f ms, p99 %9.3f ms, max %9.3f ms\n", pend_name[i], h->count,
+			1E3 * hist_quantile(h, 0.5), 1E3 * hist_quantile(h, 0.99), 1E3 * h->max);
+	}
 }
 
 int main(int argc, char *argv[])
 {
-	int		i, j, last_pend, last_count;
-	XmlNode		*n;
+	int		i, j;
 	MainInfo	min;
-	const char	*server = "localhost";
+	const char	*server = "localhost", **filenames;
+	size_t		num_files = 0;
+	unsigned int	threads = 1;
 
+	stats.start = timer_now();
 	hash_init();
 	list_init();
+	if(!atoms_init())
+	{
+		fprintf(stderr, "loader: Failed to intern element names, aborting\n");
+		return EXIT_FAILURE;
+	}
+	queries_init();
 
 	min.files = NULL;
+	min.merge = 0;
+	min.stream = 0;
+	min.window = 1;
+	min.batch = 64;
+	min.send_queue = 256;
+	min.assign_ids = 0;
 	min.log_level = 0;
+	min.bench = 0;
 	min.o_pos_scale = 1.0;		/* Global scale on all object positions. */
 	min.g_xyz_scale = 1.0;		/* Global scale on all XYZ vertex data. */
 
+	filenames = mem_alloc(argc * sizeof *filenames);
 	for(i = 1; argv[i] != NULL; i++)
 	{
 		if(strncmp(argv[i], "-ip=", 4) == 0)
@@ -2010,6 +3280,38 @@ int main(int argc, char *argv[])
 		else if(strncmp(argv[i], "-q", 2) == 0)
 			for(j = 1; argv[i][j] == 'q'; j++, min.log_level--)
 				;
+		else if(strcmp(argv[i], "-stream") == 0)
+			min.stream = 1;
+		else if(strcmp(argv[i], "-assign") == 0)
+			min.assign_ids = 1;
+		else if(strcmp(argv[i], "-merge") == 0)
+			min.merge = 1;
+		else if(strcmp(argv[i], "-bench") == 0)
+			min.bench = 1;
+		else if(strcmp(argv[i], "-stats") == 0)
+			stats.filename = "-";
+		else if(strncmp(argv[i], "-stats=", 7) == 0)
+			stats.filename = argv[i] + 7;
+		else if(strncmp(argv[i], "-jobs=", 6) == 0)
+		{
+			if((j = atoi(argv[i] + 6)) > 0)
+				threads = j;
+		}
+		else if(strncmp(argv[i], "-window=", 8) == 0)
+		{
+			if((min.window = atoi(argv[i] + 8)) < 1)
+				min.window = 1;
+		}
+		else if(strncmp(argv[i], "-batch=", 7) == 0)
+		{
+			if((j = atoi(argv[i] + 7)) > 0)
+				min.batch = j;
+		}
+		else if(strncmp(argv[i], "-sendq=", 7) == 0)
+		{
+			if((j = atoi(argv[i] + 7)) > 0)
+				min.send_queue = j;
+		}
 		else if(strncmp(argv[i], "-scale=", 7) == 0)
 		{
 			char	*eptr = NULL;
@@ -2023,14 +3325,16 @@ int main(int argc, char *argv[])
 				fprintf(stderr, "loader: Couldn't parse floating point number from '%s'\n", argv[i] + 7);
 		}
 		else if(argv[i][0] != '-')
-		{
-			n = load(argv[i]);
-			if(n != NULL)
-				min.files = list_append(min.files, n);
-			else
-				fprintf(stderr, "loader: Couldn't load VML from \"%s\"\n", argv[i]);
-		}
-	}
+			filenames[num_files++] = argv[i];
+	}
+#if defined SIGUSR1
+	if(stats.filename != NULL)
+		signal(SIGUSR1, stats_signal);
+#endif
+	min.files = load_all(filenames, num_files, min.stream, threads);
+	mem_free(filenames);
+	if(min.stream)
+		min.merge = 0;	/* Bulk data is streamed per file, keyed on node ordinals within it. */
 	message(&min, 0, "Loaded %u VML files, about to connect\n", list_length(min.files));
 
 	if(min.files == NULL)
@@ -2055,67 +3359,72 @@ int main(int argc, char *argv[])
 	min.pend_count = 0;
 	min.node = NULL;
 	min.node_id = ~0u;
-	min.node_map = NULL;
-	min.node_map_size = 0u;
-	min.fragment_map = NULL;
-	min.fragment_map_size = 0u;
-	dict_ctor(&min.tag_groups);
-	dict_ctor(&min.layer_ids);
+	idmap_ctor(&min.node_map);
+	idmap_ctor(&min.fragment_map);
+	list_head_init(&min.creating);
+	dict_ctor(&min.ids);
+	dict_ctor(&min.assigned);
+	min.assigning = 0;
+	min.reassign = 0;
+	min.node_start = NULL;
+	min.stream_layers = hash_new_string();
 
 	min.file_iter = min.files;
 
-	verse_send_connect("loader", "<secret>", server, NULL);
+	min.pend_since = timer_now();
+	SEND(SESSION, verse_send_connect("loader", "<secret>", server, NULL));
 
 	/* Wait for connect to happen, otherwise min.iter is NULL and below loop exits too soon. */
 	while(min.avatar == ~0u)
-		verse_callback_update(10000);
+		stats_wait(PEND_CONNECT, 10000);
 
 	while(min.file_iter != NULL)
 	{
+		List		*next = min.merge ? NULL : list_next(min.file_iter);
+		double		t0;
+
 		node_map_clear(&min);
 
 		sort_nodes(&min);	/* Scary. */
 
+		t0 = timer_now();
+
 		/* Upload everything but objects. */
-		min.skip_objects = 1;
-		last_pend = -1;
-		last_count = -1;
+		pass_begin(&min, 1);
 		message(&min, 1, "About to upload non-object nodes\n");
-		while(min.iter != NULL)
-		{
-			verse_callback_update(10000);
-			if(min.pending != last_pend || min.pend_count != last_count)
-			{
-				last_pend = min.pending;
-				last_count = min.pend_count;
-			}
-			if(min.pending == PEND_NONE && min.iter != NULL)
-				step(&min);
-		}
+		pass_run(&min);
 
 		/* Then iterate again, now over objects only. */
 		message(&min, 1, "Done, this would be a good time to upload the object nodes\n");
-		min.skip_objects = 0;
-		min.iter = min.file_nodes;
-		while(min.iter != NULL)
+		pass_begin(&min, 0);
+		pass_run(&min);
+		if(min.stream)
 		{
-			verse_callback_update(10000);
-			if(min.pending == PEND_NONE && min.iter != NULL)
-				step(&min);
+			stream_upload(&min, ((const LoadJob *) xmlnode_get_user(list_data(min.file_iter)))->filename);
+			stream_layer_clear(&min);
 		}
-		min.file_iter = list_next(min.file_iter);
+		stats.time_process += timer_now() - t0;
+		if(min.bench)
+			bench_report(&min, next, timer_now() - t0);
+		min.file_iter = next;
 	}
 	node_map_clear(&min);
+	vmlb_forget();
 	for(min.file_iter = min.files; min.file_iter != NULL; min.file_iter = list_next(min.file_iter))
+	{
+		mem_free(xmlnode_get_user(list_data(min.file_iter)));
 		xmlnode_destroy(list_data(min.file_iter));
+	}
 
-	do
-	{
-		verse_callback_update(10000);
-	} while(verse_session_get_size() >= 10);
+	stats_wait(PEND_NONE, 0);	/* Push out what's queued, then only wait if it doesn't all fit. */
+	while(verse_session_get_size() >= 10)
+		stats_wait(PEND_NONE, 10000);
 
-	verse_send_connect_terminate("localhost", "All done, exiting");
+	SEND(SESSION, verse_send_connect_terminate("localhost", "All done, exiting"));
 	message(&min, 2, "All done, exiting\n");
+	latency_report(&min);
+	queries_destroy();
+	stats_dump();
 
 	return EXIT_SUCCESS;
 }
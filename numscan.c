@@ -0,0 +1,228 @@
+/*
+ * Numeric scanning routines, for parsing the (large) amounts of numbers found in
+ * VML files. These are a lot faster than sscanf() and friends, since there are
+ * no format strings to interpret, and they don't depend on the current locale.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed
+ * under the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <limits.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "numscan.h"
+
+/* ----------------------------------------------------------------------------------------- */
+
+#define	IS_SPACE(c)	((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+#define	IS_DIGIT(c)	((c) >= '0' && (c) <= '9')
+
+/* Powers of ten that are exactly representable as doubles. */
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* ----------------------------------------------------------------------------------------- */
+
+const char * numscan_uint32(const char *str, unsigned int *value)
+{
+	unsigned int	x = 0, d;
+
+	while(IS_SPACE(*str))
+		str++;
+	if(*str == '+')
+		str++;
+	if(!IS_DIGIT(*str))
+		return NULL;
+	for(; IS_DIGIT(*str); str++)
+	{
+		d = *str - '0';
+		x = x > (UINT_MAX - d) / 10 ? UINT_MAX : 10 * x + d;	/* Saturate on overflow. */
+	}
+	*value = x;
+	return str;
+}
+
+const char * numscan_int32(const char *str, int *value)
+{
+	unsigned int	x;
+	int		neg = 0;
+
+	while(IS_SPACE(*str))
+		str++;
+	if(*str == '-' || *str == '+')
+		neg = *str++ == '-';
+	if(!IS_DIGIT(*str) || (str = numscan_uint32(str, &x)) == NULL)
+		return NULL;
+	if(neg)
+		*value = x <= (unsigned int) INT_MAX + 1 ? (int) -(long) x : INT_MIN;
+	else
+		*value = x <= INT_MAX ? (int) x : INT_MAX;
+	return str;
+}
+
+/* Fall back on strtod(), for numbers that can't be converted exactly in the fast path. The
+ * number is copied, so that the decimal point can be localized for strtod()'s benefit. Long
+ * ones, such as "%f" output of huge values, get a copy on the heap.
+*/
+static const char * scan_real64_slow(const char *str, const char *stop, double *value)
+{
+	char		buf[64], *copy = buf, *eptr;
+	const char	*point = localeconv()->decimal_point;
+	size_t		len = stop - str;
+
+	if(point == NULL || point[0] == '\0' || point[1] != '\0' ||
+	   (len >= sizeof buf && (copy = mem_alloc(len + 1)) == NULL))
+	{
+		*value = strtod(str, &eptr);	/* Give up on the localization. */
+		return eptr > str ? eptr : NULL;
+	}
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	if((eptr = strchr(copy, '.')) != NULL)
+		*eptr = point[0];
+	*value = strtod(copy, &eptr);
+	str = eptr > copy ? str + (eptr - copy) : NULL;
+	if(copy != buf)
+		mem_free(copy);
+	return str;
+}
+
+const char * numscan_real64(const char *str, double *value)
+{
+	const char	*start;
+	double		mant = 0.0;
+	int		neg = 0, seen = 0, kept = 0, dropped = 0, exp = 0, e = 0, eneg;
+
+	while(IS_SPACE(*str))
+		str++;
+	start = str;
+	if(*str == '-' || *str == '+')
+		neg = *str++ == '-';
+	/* Collect up to 15 significant digits, which a double always holds exactly. */
+	for(; IS_DIGIT(*str); str++, seen++)
+	{
+		if(kept < 15)
+		{
+			mant = 10.0 * mant + (*str - '0');
+			kept += mant > 0.0;
+		}
+		else
+			exp++, dropped++;
+	}
+	if(*str == '.')
+	{
+		for(str++; IS_DIGIT(*str); str++, seen++)
+		{
+			if(kept < 15)
+			{
+				mant = 10.0 * mant + (*str - '0');
+				kept += mant > 0.0;
+				exp--;
+			}
+			else
+				dropped++;
+		}
+	}
+	if(seen == 0)
+	{
+		char	*eptr;
+
+		*value = strtod(start, &eptr);	/* No digits; let strtod() deal with "inf" and the like. */
+		return eptr > start ? eptr : NULL;
+	}
+	if(*str == 'e' || *str == 'E')
+	{
+		const char	*ep = str + 1;
+
+		eneg = 0;
+		if(*ep == '-' || *ep == '+')
+			eneg = *ep++ == '-';
+		if(IS_DIGIT(*ep))
+		{
+			for(; IS_DIGIT(*ep); ep++)
+			{
+				if(e < 10000)
+					e = 10 * e + (*ep - '0');
+			}
+			exp += eneg ? -e : e;
+			str = ep;
+		}
+	}
+	/* With an exact mantissa and power of ten, a single multiply or divide is correctly rounded. */
+	if(dropped == 0 && exp >= -22 && exp <= 22)
+	{
+		if(exp >= 0)
+			mant *= exact_pow10[exp];
+		else
+			mant /= exact_pow10[-exp];
+		*value = neg ? -mant : mant;
+		return str;
+	}
+	return scan_real64_slow(start, str, value);
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+size_t numscan_array(const char *str, NumScanType type, void *out, size_t num, const char **end)
+{
+	const char	*next;
+	size_t		i = 0;
+	unsigned int	u;
+	int		s;
+	double		d;
+
+	/* Switch outside the loop, so each element costs just the scan and a store. */
+	switch(type)
+	{
+	case NUMSCAN_UINT8:
+		for(; i < num && (next = numscan_uint32(str, &u)) != NULL; i++, str = next)
+			((unsigned char *) out)[i] = u;
+		break;
+	case NUMSCAN_UINT16:
+		for(; i < num && (next = numscan_uint32(str, &u)) != NULL; i++, str = next)
+			((unsigned short *) out)[i] = u;
+		break;
+	case NUMSCAN_UINT32:
+		for(; i < num && (next = numscan_uint32(str, &u)) != NULL; i++, str = next)
+			((unsigned int *) out)[i] = u;
+		break;
+	case NUMSCAN_INT8:
+		for(; i < num && (next = numscan_int32(str, &s)) != NULL; i++, str = next)
+			((signed char *) out)[i] = s;
+		break;
+	case NUMSCAN_INT16:
+		for(; i < num && (next = numscan_int32(str, &s)) != NULL; i++, str = next)
+			((short *) out)[i] = s;
+		break;
+	case NUMSCAN_INT32:
+		for(; i < num && (next = numscan_int32(str, &s)) != NULL; i++, str = next)
+			((int *) out)[i] = s;
+		break;
+	case NUMSCAN_REAL32:
+		for(; i < num && (next = numscan_real64(str, &d)) != NULL; i++, str = next)
+			((float *) out)[i] = d;
+		break;
+	case NUMSCAN_REAL64:
+		for(; i < num && (next = numscan_real64(str, &d)) != NULL; i++, str = next)
+			((double *) out)[i] = d;
+		break;
+	}
+	if(end != NULL)
+		*end = str;
+	return i;
+}
+
+size_t numscan_uint32_vec(const char *str, unsigned int *out, size_t num)
+{
+	return numscan_array(str, NUMSCAN_UINT32, out, num, NULL);
+}
+
+size_t numscan_real64_vec(const char *str, double *out, size_t num)
+{
+	return numscan_array(str, NUMSCAN_REAL64, out, num, NULL);
+}
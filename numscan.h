@@ -0,0 +1,34 @@
+/*
+ * Header file for the numeric scanning module used by the loader.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stddef.h>
+
+/* Element types for numscan_array(). The 8-, 16- and 32-bit types are stored as
+ * (unsigned) char, short and int, respectively.
+*/
+typedef enum
+{
+	NUMSCAN_UINT8, NUMSCAN_UINT16, NUMSCAN_UINT32,
+	NUMSCAN_INT8, NUMSCAN_INT16, NUMSCAN_INT32,
+	NUMSCAN_REAL32, NUMSCAN_REAL64
+} NumScanType;
+
+/* Scan a single number, skipping leading whitespace. Returns a pointer to just after the number,
+ * or NULL if there was none. Decimal points are always '.', regardless of locale.
+*/
+extern const char *	numscan_uint32(const char *str, unsigned int *value);
+extern const char *	numscan_int32(const char *str, int *value);
+extern const char *	numscan_real64(const char *str, double *value);
+
+/* Scan up to <num> whitespace-separated numbers of the given <type> into <out>. Returns the number
+ * of values scanned; if <end> is non-NULL, it's set to point just after the last one.
+*/
+extern size_t		numscan_array(const char *str, NumScanType type, void *out, size_t num, const char **end);
+
+/* Short-hands for the common vector cases. */
+extern size_t		numscan_uint32_vec(const char *str, unsigned int *out, size_t num);
+extern size_t		numscan_real64_vec(const char *str, double *out, size_t num);
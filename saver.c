@@ -8,6 +8,8 @@
 */
 
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -29,12 +31,37 @@
 
 #include "verse.h"
 #include "enough.h"
+#include "timer.h"
+
+typedef struct{
+	uint32 a, b;
+}Digest;
+
+typedef struct{
+	char name[256];
+	uint live;		/* Number of tiles whose latest version is in this file. */
+}PieceFile;
+
+/* A separately saved piece of a node: a geometry layer, or a bitmap layer with its tiles. */
+typedef struct{
+	uint id;
+	uint type;
+	boolean seen;
+	Digest digest;
+	PieceFile *file;
+	uint file_count;
+	Digest *tile_digest;
+	uint *tile_file;	/* Index into file, for each tile. */
+	uint tile_count;
+}Piece;
 
 typedef struct{
 	uint last_save;
 	uint last_update;
 	char last_name[256];
 	boolean saved;
+	Piece *piece;
+	uint piece_count;
 }NodeUpdate;
 
 /* ------------------------------------------------------------------------------------------------ */
@@ -162,9 +189,472 @@ FILE * fut_path_open(const char *path, const char *mode)
 
 /* ------------------------------------------------------------------------------------------------ */
 
+/* Buffered output for the bulk per-element data (vertices, polygons, pixels, curve keys), which
+ * is written one number at a time. Numbers are formatted by hand; reals are written with as few
+ * digits as will read back to the exact same value, rather than a fixed number of decimals.
+ * Anything written directly to the FILE must be preceded by an out_flush(), to keep the order.
+*/
+
+#define	OUT_BUF_SIZE	16384
+
+typedef struct {
+	FILE	*f;
+	size_t	length;
+	char	buffer[OUT_BUF_SIZE];
+} OutBuf;
+
+static void out_init(OutBuf *out, FILE *f)
+{
+	out->f = f;
+	out->length = 0;
+}
+
+static void out_flush(OutBuf *out)
+{
+	if(out->length > 0)
+		fwrite(out->buffer, out->length, 1, out->f);
+	out->length = 0;
+}
+
+/* Make room for at least <size> more characters. */
+static char * out_reserve(OutBuf *out, size_t size)
+{
+	if(out->length + size > sizeof out->buffer)
+		out_flush(out);
+	return out->buffer + out->length;
+}
+
+static void out_string(OutBuf *out, const char *str)
+{
+	size_t	len = strlen(str);
+
+	if(len > sizeof out->buffer)
+	{
+		out_flush(out);
+		fwrite(str, len, 1, out->f);
+		return;
+	}
+	memcpy(out_reserve(out, len), str, len);
+	out->length += len;
+}
+
+static void out_char(OutBuf *out, char c)
+{
+	*out_reserve(out, 1) = c;
+	out->length++;
+}
+
+/* Write the digits of <value>, with a decimal point inserted <decimals> digits from the right. */
+static void out_digits(OutBuf *out, double value, int decimals)
+{
+	char	tmp[32], *put = tmp + sizeof tmp, *dst;
+	int	n = 0;
+
+	do
+	{
+		double	q = floor(value / 10.0);
+
+		*--put = '0' + (int) (value - 10.0 * q);
+		value = q;
+		if(++n == decimals)
+			*--put = '.';
+	} while(value > 0.0 || n <= decimals);
+	dst = out_reserve(out, tmp + sizeof tmp - put);
+	memcpy(dst, put, tmp + sizeof tmp - put);
+	out->length += tmp + sizeof tmp - put;
+}
+
+static void out_uint(OutBuf *out, uint32 value)
+{
+	char	tmp[12], *put = tmp + sizeof tmp;
+
+	do
+	{
+		*--put = '0' + value % 10;
+		value /= 10;
+	} while(value > 0);
+	memcpy(out_reserve(out, tmp + sizeof tmp - put), put, tmp + sizeof tmp - put);
+	out->length += tmp + sizeof tmp - put;
+}
+
+/* Write a real, using the fewest digits that read back as exactly <value>. If <single> is set,
+ * the value only needs to survive a trip back into a real32. The common case, a value with a few
+ * decimals, is found by scaling by successive powers of ten until the result is an integer that
+ * divides back exactly. Anything else (tiny, huge, or awkward values) goes through sprintf().
+*/
+static void out_real(OutBuf *out, real64 value, int single)
+{
+	static const double	scale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	double	mag, scaled;
+	char	tmp[32];
+	int	i, prec;
+
+	if(value == 0.0)
+	{
+		out_char(out, '0');
+		return;
+	}
+	mag = value < 0.0 ? -value : value;
+	if(mag >= 1e-4 && mag < 1e15)
+	{
+		for(i = 0; i < (int) (sizeof scale / sizeof *scale); i++)
+		{
+			scaled = floor(mag * scale[i] + 0.5);
+			if(scaled >= 9007199254740992.0)	/* 2^53, beyond that integers are not exact. */
+				break;
+			if(single ? (real32) (scaled / scale[i]) == (real32) mag : scaled / scale[i] == mag)
+			{
+				if(value < 0.0)
+					out_char(out, '-');
+				out_digits(out, scaled, i);
+				return;
+			}
+		}
+	}
+	for(prec = single ? 6 : 15;; prec++)
+	{
+		sprintf(tmp, "%.*g", prec, value);
+		if(prec == (single ? 9 : 17))
+			break;
+		if(single ? (real32) strtod(tmp, NULL) == (real32) value : strtod(tmp, NULL) == value)
+			break;
+	}
+	out_string(out, tmp);
+}
+
+#define	out_egreal(out, v)	out_real((out), (v), sizeof (egreal) == sizeof (real32))
+
+/* Write the <size> bytes of the value at <value> in little-endian byte order. */
+static void out_le(OutBuf *out, const void *value, uint size)
+{
+	static const uint16 probe = 1;
+	char *put = out_reserve(out, size);
+	uint i;
+
+	if(*(const uint8 *) &probe == 1)
+		memcpy(put, value, size);
+	else
+		for(i = 0; i < size; i++)
+			put[i] = ((const char *) value)[size - 1 - i];
+	out->length += size;
+}
+
+static void out_le32(OutBuf *out, uint32 value)
+{
+	out_le(out, &value, sizeof value);
+}
+
+static void out_le64(OutBuf *out, real64 value)
+{
+	out_le(out, &value, sizeof value);
+}
+
+/* Pad with zeros up to the next multiple of 8 bytes from the start of the file. */
+static void out_pad(OutBuf *out)
+{
+	long pos = ftell(out->f) + (long) out->length;
+
+	for(; pos % 8 != 0; pos++)
+		out_char(out, '\0');
+}
+
+/* ------------------------------------------------------------------------------------------------ */
+
+/* Binary output, in the VMLB format written with -b. This is the VML text, but with the bulk data
+ * (vertices, polygons, pixels and curve keys) stored as raw little-endian arrays in sections after
+ * the text. Elements refer to their data with a "section" attribute. The sections are collected in
+ * a temporary file while the text is written, and copied in after it, followed by an index of the
+ * sections. See the README, or vmlb.h in the loader, for the details.
+*/
+
+#define	VMLB_VERSION	1
+
+enum {
+	VMLB_VERTEX = 1,
+	VMLB_POLYGON,
+	VMLB_TILES,
+	VMLB_BLOCKS,
+	VMLB_KEYS
+};
+
+typedef struct{
+	uint32 kind;
+	uint32 count;
+	long offset;
+	long size;
+}BinSection;
+
+static struct {
+	FILE *data;	/* Non-NULL while writing VMLB. */
+	BinSection *section;
+	uint count, alloc;
+} bin;
+
+static void bin_begin(void)
+{
+	if((bin.data = tmpfile()) == NULL)
+		fprintf(stderr, "saver: Couldn't create temporary file, saving plain VML\n");
+	bin.count = 0;
+}
+
+/* Start a new section of <count> elements, written through <out>. Returns the section's number. */
+static uint bin_section_begin(OutBuf *out, uint32 kind, uint32 count)
+{
+	if(bin.count == bin.alloc)
+	{
+		bin.alloc = bin.alloc == 0 ? 16 : 2 * bin.alloc;
+		bin.section = realloc(bin.section, bin.alloc * sizeof *bin.section);
+	}
+	bin.section[bin.count].kind = kind;
+	bin.section[bin.count].count = count;
+	bin.section[bin.count].offset = ftell(bin.data);
+	out_init(out, bin.data);
+	return bin.count++;
+}
+
+static void bin_section_end(OutBuf *out)
+{
+	out_pad(out);
+	out_flush(out);
+	bin.section[bin.count - 1].size = ftell(bin.data) - bin.section[bin.count - 1].offset;
+}
+
+/* Finish the VML text in <f> by appending the sections, their index and the trailer. */
+static void bin_end(FILE *f)
+{
+	char buffer[16384];
+	size_t got;
+	long base, index_offset;
+	OutBuf out;
+	uint i;
+
+	if(bin.data == NULL)
+		return;
+	out_init(&out, f);
+	out_char(&out, '\0');
+	out_pad(&out);
+	out_flush(&out);
+	base = ftell(f);
+	rewind(bin.data);
+	while((got = fread(buffer, 1, sizeof buffer, bin.data)) > 0)
+		fwrite(buffer, 1, got, f);
+	fclose(bin.data);
+	bin.data = NULL;
+	index_offset = ftell(f);
+	for(i = 0; i < bin.count; i++)
+	{
+		out_le32(&out, bin.section[i].kind);
+		out_le32(&out, bin.section[i].count);
+		out_le32(&out, (uint32) (base + bin.section[i].offset));
+		out_le32(&out, (uint32) ((base + bin.section[i].offset) >> 16 >> 16));
+		out_le32(&out, (uint32) bin.section[i].size);
+		out_le32(&out, (uint32) (bin.section[i].size >> 16 >> 16));
+	}
+	out_le32(&out, (uint32) index_offset);
+	out_le32(&out, (uint32) (index_offset >> 16 >> 16));
+	out_le32(&out, bin.count);
+	out_le32(&out, 0);
+	out_string(&out, "VMLB");
+	out_le32(&out, VMLB_VERSION);
+	out_flush(&out);
+}
+
+/* ------------------------------------------------------------------------------------------------ */
+
+/* Statistics on what has been saved, written as JSON on exit and when SIGUSR1 arrives. The signal
+ * handler only sets a flag, the main loop does the writing.
+*/
+static struct {
+	const char		*file_name;	/* "-" for standard error, NULL to disable. */
+	volatile sig_atomic_t	requested;
+	double			start;
+	uint			saves;
+	double			time_saving;
+	unsigned long		nodes[V_NT_NUM_TYPES];
+	unsigned long		bytes[V_NT_NUM_TYPES];
+} stats;
+
+static void stats_dump(void)
+{
+	static const char *type[] = { "object", "geometry", "material", "bitmap", "text", "curve", "audio" };
+	FILE *out;
+	uint i;
+
+	stats.requested = 0;
+	if(stats.file_name == NULL)
+		return;
+	if(strcmp(stats.file_name, "-") == 0)
+		out = stderr;
+	else if((out = fopen(stats.file_name, "w")) == NULL)
+	{
+		fprintf(stderr, "saver: Couldn't open \"%s\" for writing statistics\n", stats.file_name);
+		return;
+	}
+	fprintf(out, "{\n \"elapsed\": %.6f,\n \"saves\": %u,\n \"time_saving\": %.6f,\n \"nodes\": {\n",
+		timer_now() - stats.start, stats.saves, stats.time_saving);
+	for(i = 0; i < V_NT_NUM_TYPES; i++)
+		fprintf(out, "  \"%s\": { \"count\": %lu, \"bytes\": %lu }%s\n", type[i], stats.nodes[i], stats.bytes[i], i < V_NT_NUM_TYPES - 1 ? "," : "");
+	fprintf(out, " }\n}\n");
+	if(out == stderr)
+		fflush(out);
+	else
+		fclose(out);
+}
+
+static void stats_signal(int sig)
+{
+	stats.requested = 1;
+	signal(sig, stats_signal);
+}
+
+/* ------------------------------------------------------------------------------------------------ */
+
+/* Incremental saving, with -d in continuous mode. Geometry layers and the tiles of bitmap layers are
+ * saved in fragment files of their own, which the node file includes, and only what has changed since
+ * the last save is written again; the rest is included from the fragments of earlier saves. Enough
+ * only tells that something in a node changed, not what, so the pieces are compared by content digest.
+ * Old fragments are never removed, since earlier saves still include them. Their names are relative
+ * to the main file, as that is what the loader resolves all includes against.
+*/
+
+#define	PIECE_FILES_MAX	8	/* Fragments per bitmap layer, before it is written out whole again. */
+
+static struct {
+	NodeUpdate *node;	/* Non-NULL while saving a node incrementally. */
+	const char *dir;
+	const char *name;
+	const char *timer;
+	int binary;
+} inc;
+
+static void digest_init(Digest *h)
+{
+	h->a = 2166136261u;
+	h->b = 0;
+}
+
+/* Two different hashes, FNV-1a and sdbm, to make a change going unnoticed very unlikely. */
+static void digest_add(Digest *h, const void *data, size_t size)
+{
+	const uint8 *p = data;
+
+	for(; size > 0; size--, p++)
+	{
+		h->a = (h->a ^ *p) * 16777619u;
+		h->b = *p + (h->b << 6) + (h->b << 16) - h->b;
+	}
+}
+
+static boolean digest_equal(const Digest *x, const Digest *y)
+{
+	return x->a == y->a && x->b == y->b;
+}
+
+static void piece_reset(Piece *p)
+{
+	free(p->file);
+	free(p->tile_digest);
+	free(p->tile_file);
+	p->file = NULL;
+	p->file_count = 0;
+	p->tile_digest = NULL;
+	p->tile_file = NULL;
+	p->tile_count = 0;
+}
+
+/* Find piece <id> of the node being saved, creating it if needed, and mark it as still existing. */
+static Piece * piece_get(uint id, uint type)
+{
+	NodeUpdate *n = inc.node;
+	Piece *p;
+	uint i;
+
+	for(i = 0; i < n->piece_count && n->piece[i].id != id; i++)
+		;
+	if(i == n->piece_count)
+	{
+		n->piece = realloc(n->piece, (n->piece_count + 1) * sizeof *n->piece);
+		p = &n->piece[n->piece_count++];
+		memset(p, 0, sizeof *p);
+		p->id = id;
+		p->type = type;
+	}
+	else
+		p = &n->piece[i];
+	if(p->type != type)
+	{
+		piece_reset(p);
+		p->type = type;
+	}
+	p->seen = TRUE;
+	return p;
+}
+
+/* Forget the pieces that were not seen while saving the node, i.e. those of destroyed layers. */
+static void piece_sweep(NodeUpdate *n)
+{
+	uint i, j;
+
+	for(i = j = 0; i < n->piece_count; i++)
+	{
+		if(n->piece[i].seen)
+		{
+			n->piece[i].seen = FALSE;
+			n->piece[j++] = n->piece[i];
+		}
+		else
+			piece_reset(&n->piece[i]);
+	}
+	n->piece_count = j;
+}
+
+/* Name a new fragment for the piece called <label>, alongside the node file. Earlier saves may still
+ * include a fragment, so when saving again within the same second a sequence number is added rather
+ * than overwriting it.
+*/
+static void piece_name(char *name, const char *label)
+{
+	FILE *f;
+	uint seq;
+
+	sprintf(name, "%s%s_%s_%s.%s", inc.dir, inc.name, label, inc.timer, inc.binary ? "vmlb" : "vml");
+	for(seq = 2; (f = fopen(name, "r")) != NULL; seq++)
+	{
+		fclose(f);
+		sprintf(name, "%s%s_%s_%s_%u.%s", inc.dir, inc.name, label, inc.timer, seq, inc.binary ? "vmlb" : "vml");
+	}
+}
+
+static FILE * piece_open(const char *name)
+{
+	FILE *f;
+
+	if((f = fut_path_open(name, inc.binary ? "wb" : "w")) == NULL)
+	{
+		fprintf(stderr, "saver: Couldn't open \"%s\" for writing, saving inline\n", name);
+		return NULL;
+	}
+	if(inc.binary)
+		bin_begin();
+	return f;
+}
+
+static void piece_close(FILE *f, VNodeType type)
+{
+	long size;
+
+	bin_end(f);
+	if((size = ftell(f)) > 0)
+		stats.bytes[type] += size;
+	fclose(f);
+}
+
+/* ------------------------------------------------------------------------------------------------ */
+
 static void node_update_func(ENode *node, ECustomDataCommand command)
 {	
 	NodeUpdate *n;
+	uint i;
 
 	n = e_ns_get_custom_data(node, 0);
 	switch(command)
@@ -175,6 +665,8 @@ static void node_update_func(ENode *node, ECustomDataCommand command)
 			n->last_save = n->last_update;
 			n->last_name[0] = 0;
 			n->saved = FALSE;
+			n->piece = NULL;
+			n->piece_count = 0;
 			e_ns_set_custom_data(node, 0, n);
 		break;
 		case E_CDC_STRUCT :
@@ -183,6 +675,9 @@ static void node_update_func(ENode *node, ECustomDataCommand command)
 			n->saved = FALSE;
 		break;
 		case E_CDC_DESTROY :
+			for(i = 0; i < n->piece_count; i++)
+				piece_reset(&n->piece[i]);
+			free(n->piece);
 			free(n);
 		break;
 	}
@@ -255,15 +750,261 @@ static void save_object(FILE *f, ENode *o_node)
 		fprintf(f, "\t<hidden>true</hidden>\n");
 }
 
-static void save_geometry(FILE *f, ENode *g_node)
+/* Polygons are only saved if their first three corners are existing vertices. */
+static boolean polygon_valid(const uint *ref, uint i, const egreal *vertex, uint vertex_count)
+{
+	return ref[i * 4] < vertex_count && vertex[ref[i * 4] * 3] != E_REAL_MAX &&
+		ref[i * 4 + 1] < vertex_count && vertex[ref[i * 4 + 1] * 3] != E_REAL_MAX &&
+		ref[i * 4 + 2] < vertex_count && vertex[ref[i * 4 + 2] * 3] != E_REAL_MAX;
+}
+
+/* Save a geometry layer as a binary section, holding the same vertices and polygons as the text would. */
+static uint bin_save_geometry_layer(VNGLayerType type, const void *data, const egreal *vertex, const uint *ref, uint vertex_count, uint poly_count)
+{
+	OutBuf out;
+	uint i, j, count = 0, section;
+
+	if(type < VN_G_LAYER_POLYGON_CORNER_UINT32)
+	{
+		for(i = 0; i < vertex_count; i++)
+			if(vertex[i * 3] != E_REAL_MAX)
+				count++;
+		section = bin_section_begin(&out, VMLB_VERTEX, count);
+		for(i = 0; i < vertex_count; i++)
+			if(vertex[i * 3] != E_REAL_MAX)
+				out_le32(&out, i);
+		out_pad(&out);
+		for(i = 0; i < vertex_count; i++)
+		{
+			if(vertex[i * 3] == E_REAL_MAX)
+				continue;
+			if(type == VN_G_LAYER_VERTEX_XYZ)
+				for(j = 0; j < 3; j++)
+					out_le64(&out, ((egreal *)data)[i * 3 + j]);
+			else if(type == VN_G_LAYER_VERTEX_UINT32)
+				out_le32(&out, ((uint32 *)data)[i]);
+			else
+				out_le64(&out, ((egreal *)data)[i]);
+		}
+	}
+	else
+	{
+		for(i = 0; i < poly_count; i++)
+			if(polygon_valid(ref, i, vertex, vertex_count))
+				count++;
+		section = bin_section_begin(&out, VMLB_POLYGON, count);
+		for(i = 0; i < poly_count; i++)
+		{
+			if(!polygon_valid(ref, i, vertex, vertex_count))
+				continue;
+			if(type == VN_G_LAYER_POLYGON_CORNER_UINT32)
+				for(j = 0; j < 4; j++)
+					out_le32(&out, ((uint32 *)data)[i * 4 + j]);
+			else if(type == VN_G_LAYER_POLYGON_CORNER_REAL)
+				for(j = 0; j < 4; j++)
+					out_le64(&out, ((egreal *)data)[i * 4 + j]);
+			else if(type == VN_G_LAYER_POLYGON_FACE_UINT8)
+				out_char(&out, ((uint8 *)data)[i]);
+			else if(type == VN_G_LAYER_POLYGON_FACE_UINT32)
+				out_le32(&out, ((uint32 *)data)[i]);
+			else
+				out_le64(&out, ((egreal *)data)[i]);
+		}
+	}
+	bin_section_end(&out);
+	return section;
+}
+
+/* Save one geometry layer, as a layer element holding all of its vertices or polygons. */
+static void save_geometry_layer(FILE *f, EGeoLayer *layer, void *data, egreal *vertex, uint *ref, uint vertex_count, uint poly_count)
 {
 	static const char *layer_el[] = { "vertex-xyz", "vertex-uint32", "vertex-real",
 		"polygon-corner-uint32", "polygon-corner-real", "polygon-face-uint8",
 		"polygon-face-uint32", "polygon-face-real" };
 	const char	*lt;
-	EGeoLayer *layer;
 	VNGLayerType	type;
-	uint i, vertex_count = 0, poly_count = 0;
+	uint i;
+	OutBuf out;
+
+	type = e_nsg_get_layer_type(layer);
+	if(type < VN_G_LAYER_POLYGON_CORNER_UINT32)
+		lt = layer_el[type];
+	else
+		lt = layer_el[3 + type - VN_G_LAYER_POLYGON_CORNER_UINT32];	/* Hack, hack. */
+	if(bin.data != NULL)
+	{
+		fprintf(f, "\t\t<layer-%s name=\"%s\" section=\"%u\"/>\n", lt, e_nsg_get_layer_name(layer),
+			bin_save_geometry_layer(type, data, vertex, ref, vertex_count, poly_count));
+		return;
+	}
+	fprintf(f, "\t\t<layer-%s name=\"%s\">\n", lt, e_nsg_get_layer_name(layer));
+	out_init(&out, f);
+	switch(e_nsg_get_layer_type(layer))
+	{
+		case VN_G_LAYER_VERTEX_XYZ :
+			for(i = 0; i < vertex_count; i++)
+				if(vertex[i * 3] != E_REAL_MAX)
+				{
+					out_string(&out, "\t\t\t<v>");
+					out_uint(&out, i);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i * 3]);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i * 3 + 1]);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i * 3 + 2]);
+					out_string(&out, "</v>\n");
+				}
+		break;
+		case VN_G_LAYER_VERTEX_UINT32 :
+			for(i = 0; i < vertex_count; i++)
+				if(vertex[i * 3] != E_REAL_MAX)
+				{
+					out_string(&out, "\t\t\t<v>");
+					out_uint(&out, i);
+					out_char(&out, ' ');
+					out_uint(&out, ((uint32 *)data)[i]);
+					out_string(&out, "</v>\n");
+				}
+		break;
+		case VN_G_LAYER_VERTEX_REAL :
+			for(i = 0; i < vertex_count; i++)
+				if(vertex[i * 3] != E_REAL_MAX)
+				{
+					out_string(&out, "\t\t\t<v>");
+					out_uint(&out, i);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i]);
+					out_string(&out, "</v>\n");
+				}
+		break;
+		case VN_G_LAYER_POLYGON_CORNER_UINT32 :
+			for(i = 0; i < poly_count; i++)
+				if(polygon_valid(ref, i, vertex, vertex_count))
+				{
+					out_string(&out, "\t\t\t<p>");
+					out_uint(&out, ((uint32 *)data)[i * 4]);
+					out_char(&out, ' ');
+					out_uint(&out, ((uint32 *)data)[i * 4 + 1]);
+					out_char(&out, ' ');
+					out_uint(&out, ((uint32 *)data)[i * 4 + 2]);
+					out_char(&out, ' ');
+					out_uint(&out, ((uint32 *)data)[i * 4 + 3]);
+					out_string(&out, "</p>\n");
+				}
+		break;
+		case VN_G_LAYER_POLYGON_CORNER_REAL :
+			for(i = 0; i < poly_count; i++)
+				if(polygon_valid(ref, i, vertex, vertex_count))
+				{
+					out_string(&out, "\t\t\t<p>");
+					out_egreal(&out, ((egreal *)data)[i * 4]);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i * 4 + 1]);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i * 4 + 2]);
+					out_char(&out, ' ');
+					out_egreal(&out, ((egreal *)data)[i * 4 + 3]);
+					out_string(&out, "</p>\n");
+				}
+		break;
+		case VN_G_LAYER_POLYGON_FACE_UINT8 :
+			for(i = 0; i < poly_count; i++)
+				if(polygon_valid(ref, i, vertex, vertex_count))
+				{
+					out_string(&out, "\t\t\t<p>");
+					out_uint(&out, ((uint8 *)data)[i]);
+					out_string(&out, "</p>\n");
+				}
+		break;
+		case VN_G_LAYER_POLYGON_FACE_UINT32 :
+			for(i = 0; i < poly_count; i++)
+				if(polygon_valid(ref, i, vertex, vertex_count))
+				{
+					out_string(&out, "\t\t\t<p>");
+					out_uint(&out, ((uint32 *)data)[i]);
+					out_string(&out, "</p>\n");
+				}
+		break;
+		case VN_G_LAYER_POLYGON_FACE_REAL :
+			for(i = 0; i < poly_count; i++)
+				if(polygon_valid(ref, i, vertex, vertex_count))
+				{
+					out_string(&out, "\t\t\t<p>");
+					out_egreal(&out, ((egreal *)data)[i]);
+					out_string(&out, "</p>\n");
+				}
+		break;
+		default:
+			fprintf(f, "\t\t<!-- data of unknown type %d skipped -->\n", e_nsg_get_layer_type(layer));
+	}
+	out_flush(&out);
+	fprintf(f, "\t\t</layer-%s>\n", lt);
+}
+
+/* Digest what save_geometry_layer() would save of a layer. */
+static void digest_geometry_layer(Digest *digest, EGeoLayer *layer, const void *data, const egreal *vertex, const uint *ref, uint vertex_count, uint poly_count)
+{
+	static const uint size[] = { 3 * sizeof (egreal), sizeof (uint32), sizeof (egreal),
+		4 * sizeof (uint32), 4 * sizeof (egreal), sizeof (uint8), sizeof (uint32), sizeof (egreal) };
+	VNGLayerType type = e_nsg_get_layer_type(layer);
+	uint i, s;
+
+	digest_init(digest);
+	digest_add(digest, e_nsg_get_layer_name(layer), strlen(e_nsg_get_layer_name(layer)));
+	if(type < VN_G_LAYER_POLYGON_CORNER_UINT32)
+	{
+		s = size[type];
+		for(i = 0; i < vertex_count; i++)
+			if(vertex[i * 3] != E_REAL_MAX)
+			{
+				digest_add(digest, &i, sizeof i);
+				digest_add(digest, (const uint8 *) data + i * s, s);
+			}
+	}
+	else
+	{
+		s = size[3 + type - VN_G_LAYER_POLYGON_CORNER_UINT32];
+		for(i = 0; i < poly_count; i++)
+			if(polygon_valid(ref, i, vertex, vertex_count))
+			{
+				digest_add(digest, &i, sizeof i);
+				digest_add(digest, (const uint8 *) data + i * s, s);
+			}
+	}
+}
+
+/* Save a geometry layer incrementally, as an include of a fragment holding the layer element. */
+static void save_geometry_piece(FILE *f, EGeoLayer *layer, void *data, egreal *vertex, uint *ref, uint vertex_count, uint poly_count)
+{
+	Piece *p = piece_get(e_nsg_get_layer_id(layer), e_nsg_get_layer_type(layer));
+	Digest digest;
+	FILE *frag;
+
+	digest_geometry_layer(&digest, layer, data, vertex, ref, vertex_count, poly_count);
+	if(p->file_count == 0 || !digest_equal(&digest, &p->digest))
+	{
+		if(p->file == NULL)
+			p->file = malloc(sizeof *p->file);
+		piece_name(p->file[0].name, e_nsg_get_layer_name(layer));
+		if((frag = piece_open(p->file[0].name)) == NULL)
+		{
+			piece_reset(p);
+			save_geometry_layer(f, layer, data, vertex, ref, vertex_count, poly_count);
+			return;
+		}
+		save_geometry_layer(frag, layer, data, vertex, ref, vertex_count, poly_count);
+		piece_close(frag, V_NT_GEOMETRY);
+		p->file_count = 1;
+		p->digest = digest;
+	}
+	fprintf(f, "\t\t<xi:include href=\"%s\"/>\n", p->file[0].name);
+}
+
+static void save_geometry(FILE *f, ENode *g_node)
+{
+	EGeoLayer *layer;
+	uint vertex_count = 0, poly_count = 0;
 	uint *ref;
 	egreal *vertex;
 	void *data;
@@ -283,70 +1024,10 @@ static void save_geometry(FILE *f, ENode *g_node)
 			fprintf(f, "\t\t<!-- layer %s skipped here, data missing -->\n", e_nsg_get_layer_name(layer));
 			continue;
 		}
-		type = e_nsg_get_layer_type(layer);
-		if(type < VN_G_LAYER_POLYGON_CORNER_UINT32)
-			lt = layer_el[type];
+		if(inc.node != NULL)
+			save_geometry_piece(f, layer, data, vertex, ref, vertex_count, poly_count);
 		else
-			lt = layer_el[3 + type - VN_G_LAYER_POLYGON_CORNER_UINT32];	/* Hack, hack. */
-		fprintf(f, "\t\t<layer-%s name=\"%s\">\n", lt, e_nsg_get_layer_name(layer));
-		switch(e_nsg_get_layer_type(layer))
-		{
-			case VN_G_LAYER_VERTEX_XYZ :
-				for(i = 0; i < vertex_count; i++)
-					if(vertex[i * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<v>%u %f %f %f</v>\n", i, ((egreal *)data)[i * 3], ((egreal *)data)[i * 3 + 1], ((egreal *)data)[i * 3 + 2]);
-			break;
-			case VN_G_LAYER_VERTEX_UINT32 :
-				for(i = 0; i < vertex_count; i++)
-					if(vertex[i * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<v>%u %u</v>\n", i, ((uint32 *)data)[i]);
-			break;
-			case VN_G_LAYER_VERTEX_REAL :
-				for(i = 0; i < vertex_count; i++)
-					if(vertex[i * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<v>%u %f</v>\n", i, ((egreal *)data)[i]);
-			break;
-			case VN_G_LAYER_POLYGON_CORNER_UINT32 :
-				for(i = 0; i < poly_count; i++)
-					if(ref[i * 4] < vertex_count && vertex[ref[i * 4] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 1] < vertex_count && vertex[ref[i * 4 + 1] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 2] < vertex_count && vertex[ref[i * 4 + 2] * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<p>%u %u %u %u</p>\n", ((uint32 *)data)[i * 4], ((uint32 *)data)[i * 4 + 1], ((uint32 *)data)[i * 4 + 2], ((uint32 *)data)[i * 4 + 3]);
-			break;
-			case VN_G_LAYER_POLYGON_CORNER_REAL :
-				for(i = 0; i < poly_count; i++)
-					if(ref[i * 4] < vertex_count && vertex[ref[i * 4] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 1] < vertex_count && vertex[ref[i * 4 + 1] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 2] < vertex_count && vertex[ref[i * 4 + 2] * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<p>%f %f %f %f</p>\n", ((egreal *)data)[i * 4], ((egreal *)data)[i * 4 + 1], ((egreal *)data)[i * 4 + 2], ((egreal *)data)[i * 4 + 3]);
-			break;
-			case VN_G_LAYER_POLYGON_FACE_UINT8 :
-				for(i = 0; i < poly_count; i++)
-					if(ref[i * 4] < vertex_count && vertex[ref[i * 4] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 1] < vertex_count && vertex[ref[i * 4 + 1] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 2] < vertex_count && vertex[ref[i * 4 + 2] * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<p>%u</p>\n", ((uint8 *)data)[i]);
-			break;
-			case VN_G_LAYER_POLYGON_FACE_UINT32 :
-				for(i = 0; i < poly_count; i++)
-				{
-					if(ref[i * 4] < vertex_count && vertex[ref[i * 4] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 1] < vertex_count && vertex[ref[i * 4 + 1] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 2] < vertex_count && vertex[ref[i * 4 + 2] * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<p>%u</p>\n", ((uint32 *)data)[i]);
-				}
-			break;
-			case VN_G_LAYER_POLYGON_FACE_REAL :
-				for(i = 0; i < poly_count; i++)
-					if(ref[i * 4] < vertex_count && vertex[ref[i * 4] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 1] < vertex_count && vertex[ref[i * 4 + 1] * 3] != E_REAL_MAX &&
-						ref[i * 4 + 2] < vertex_count && vertex[ref[i * 4 + 2] * 3] != E_REAL_MAX)
-						fprintf(f, "\t\t\t<p>%f</p>\n", ((egreal *)data)[i]);
-			break;
-			default:
-				fprintf(f, "\t\t<!-- data of unknown type %d skipped -->\n", e_nsg_get_layer_type(layer));
-		}
-		fprintf(f, "\t\t</layer-%s>\n", lt);
+			save_geometry_layer(f, layer, data, vertex, ref, vertex_count, poly_count);
 	}
 	fprintf(f, "\t</layers>\n");
 
@@ -594,13 +1275,210 @@ static void tile_get(VNBTile *tile, int x, int y, int z, const void *data, VNBLa
 	}
 }
 
+/* Save the tiles of a bitmap layer as a binary section. */
+/* The tiles of a layer are numbered in the order they are saved in, x varying the fastest. When
+ * <where> is non-NULL, only the tiles for which it holds <file> are saved.
+*/
+#define	TILE_SELECTED(where, file, t)	((where) == NULL || (where)[t] == (file))
+
+/* Save tiles of a bitmap layer as a binary section. */
+static uint bin_save_bitmap_layer(const void *data, VNBLayerType type, const uint *size, const uint *tiles, const uint *where, uint file)
+{
+	OutBuf out;
+	VNBTile tile;
+	uint i, j, k, p, t, count = 0, section;
+	uint16 c;
+
+	for(t = 0; t < size[2] * tiles[1] * tiles[0]; t++)
+		if(TILE_SELECTED(where, file, t))
+			count++;
+	section = bin_section_begin(&out, VMLB_TILES, count);
+	for(i = t = 0; i < size[2]; i++)
+		for(j = 0; j < tiles[1]; j++)
+			for(k = 0; k < tiles[0]; k++, t++)
+			{
+				if(!TILE_SELECTED(where, file, t))
+					continue;
+				c = k;
+				out_le(&out, &c, sizeof c);
+				c = j;
+				out_le(&out, &c, sizeof c);
+				c = i;
+				out_le(&out, &c, sizeof c);
+			}
+	out_pad(&out);
+	for(i = t = 0; i < size[2]; i++)
+		for(j = 0; j < tiles[1]; j++)
+			for(k = 0; k < tiles[0]; k++, t++)
+			{
+				if(!TILE_SELECTED(where, file, t))
+					continue;
+				tile_get(&tile, k, j, i, data, type, size);
+				if(type == VN_B_LAYER_UINT1)
+					out_le(&out, tile.vuint1, sizeof tile.vuint1);
+				else if(type == VN_B_LAYER_UINT8)
+					out_le(&out, tile.vuint8, sizeof tile.vuint8);
+				else
+					for(p = 0; p < VN_B_TILE_SIZE * VN_B_TILE_SIZE; p++)
+					{
+						if(type == VN_B_LAYER_UINT16)
+							out_le(&out, &tile.vuint16[p], sizeof tile.vuint16[p]);
+						else if(type == VN_B_LAYER_REAL32)
+							out_le(&out, &tile.vreal32[p], sizeof tile.vreal32[p]);
+						else if(type == VN_B_LAYER_REAL64)
+							out_le(&out, &tile.vreal64[p], sizeof tile.vreal64[p]);
+					}
+			}
+	bin_section_end(&out);
+	return section;
+}
+
+/* Save tiles of a bitmap layer as a tiles element. */
+static void save_bitmap_tiles(FILE *f, const void *data, VNBLayerType type, const uint *size, const uint *tiles, const uint *where, uint file)
+{
+	uint i, j, k, t, tx, ty;
+	VNBTile	tile;
+	OutBuf	out;
+
+	fprintf(f, "\t\t<tiles>\n");
+	out_init(&out, f);
+	for(i = t = 0; i < size[2]; i++)
+	{
+		for(j = 0; j < tiles[1]; j++)
+		{
+			for(k = 0; k < tiles[0]; k++, t++)
+			{
+				if(!TILE_SELECTED(where, file, t))
+					continue;
+				out_string(&out, "\t\t<tile tile_x=\"");
+				out_uint(&out, k);
+				out_string(&out, "\" tile_y=\"");
+				out_uint(&out, j);
+				out_string(&out, "\" tile_z=\"");
+				out_uint(&out, i);
+				out_string(&out, "\">\n");
+				tile_get(&tile, k, j, i, data, type, size);
+				for(ty = 0; ty < VN_B_TILE_SIZE; ty++)
+				{
+					out_string(&out, "\t\t");
+					for(tx = 0; tx < VN_B_TILE_SIZE; tx++)
+					{
+						out_char(&out, ' ');
+						if(type == VN_B_LAYER_UINT1)
+							out_char(&out, tile.vuint1[ty * VN_B_TILE_SIZE / CHAR_BIT] & (1 << (CHAR_BIT - tx - 1)) ? '1' : '0');
+						else if(type == VN_B_LAYER_UINT8)
+							out_uint(&out, tile.vuint8[ty * VN_B_TILE_SIZE + tx]);
+						else if(type == VN_B_LAYER_UINT16)
+							out_uint(&out, tile.vuint16[ty * VN_B_TILE_SIZE + tx]);
+						else if(type == VN_B_LAYER_REAL32)
+							out_real(&out, tile.vreal32[ty * VN_B_TILE_SIZE + tx], 1);
+						else if(type == VN_B_LAYER_REAL64)
+							out_real(&out, tile.vreal64[ty * VN_B_TILE_SIZE + tx], 0);
+					}
+					out_char(&out, '\n');
+				}
+				out_string(&out, "\t\t</tile>\n");
+			}
+		}
+	}
+	out_flush(&out);
+	fprintf(f, "\t\t</tiles>\n");
+}
+
+/* Save a bitmap layer incrementally. The layer element includes fragments holding tiles elements,
+ * oldest first; the tiles that changed since the last save go in a new fragment at the end, so the
+ * loader sends the latest version of each tile last. Fragments that no longer hold the latest version
+ * of any tile are dropped, and if there would still be too many, the layer is written out whole.
+*/
+static void save_bitmap_piece(FILE *f, EBitLayer *layer, const void *data, VNBLayerType type, const uint *size, const uint *tiles)
+{
+	static const uint tile_size[] = { VN_B_TILE_SIZE * VN_B_TILE_SIZE / CHAR_BIT, VN_B_TILE_SIZE * VN_B_TILE_SIZE,
+		VN_B_TILE_SIZE * VN_B_TILE_SIZE * 2, VN_B_TILE_SIZE * VN_B_TILE_SIZE * 4, VN_B_TILE_SIZE * VN_B_TILE_SIZE * 8 };
+	Piece *p = piece_get(e_nsb_get_layer_id(layer), type);
+	uint count = size[2] * tiles[1] * tiles[0], i, j, k, t, last, files;
+	PieceFile *pf;
+	VNBTile tile;
+	Digest digest;
+	FILE *frag;
+
+	if(p->tile_count != count)
+	{
+		piece_reset(p);
+		p->tile_digest = malloc(count * sizeof *p->tile_digest);
+		p->tile_file = malloc(count * sizeof *p->tile_file);
+		p->tile_count = count;
+	}
+	p->file = realloc(p->file, (p->file_count + 1) * sizeof *p->file);
+	last = p->file_count;
+	pf = &p->file[last];
+	pf->live = 0;
+	for(i = t = 0; i < size[2]; i++)
+		for(j = 0; j < tiles[1]; j++)
+			for(k = 0; k < tiles[0]; k++, t++)
+			{
+				tile_get(&tile, k, j, i, data, type, size);
+				digest_init(&digest);
+				digest_add(&digest, &t, sizeof t);
+				digest_add(&digest, &tile, tile_size[type]);
+				if(last > 0 && digest_equal(&digest, &p->tile_digest[t]))
+					continue;
+				if(last > 0)
+					p->file[p->tile_file[t]].live--;
+				p->tile_digest[t] = digest;
+				p->tile_file[t] = last;
+				pf->live++;
+			}
+	if(pf->live > 0)
+	{
+		piece_name(pf->name, e_nsb_get_layer_name(layer));
+		for(i = files = 0; i < last; i++)
+			if(p->file[i].live > 0)
+				files++;
+		if(files >= PIECE_FILES_MAX)
+		{
+			for(i = 0; i < last; i++)
+				p->file[i].live = 0;
+			for(t = 0; t < count; t++)
+				p->tile_file[t] = last;
+			pf->live = count;
+		}
+		if((frag = piece_open(pf->name)) == NULL)
+		{
+			piece_reset(p);
+			save_bitmap_tiles(f, data, type, size, tiles, NULL, 0);
+			return;
+		}
+		if(bin.data != NULL)
+			fprintf(frag, "<tiles section=\"%u\"/>\n", bin_save_bitmap_layer(data, type, size, tiles, p->tile_file, last));
+		else
+			save_bitmap_tiles(frag, data, type, size, tiles, p->tile_file, last);
+		piece_close(frag, V_NT_BITMAP);
+		p->file_count++;
+	}
+	for(i = j = 0; i < p->file_count; i++)
+	{
+		if(p->file[i].live == 0)
+			continue;
+		if(i != j)
+		{
+			for(t = 0; t < count; t++)
+				if(p->tile_file[t] == i)
+					p->tile_file[t] = j;
+			p->file[j] = p->file[i];
+		}
+		j++;
+	}
+	p->file_count = j;
+	for(i = 0; i < p->file_count; i++)
+		fprintf(f, "\t\t<xi:include href=\"%s\"/>\n", p->file[i].name);
+}
+
 static void save_bitmap(FILE *f, ENode *b_node)
 {
 	const char *layer_el[] = { "uint1", "uint8", "uint16", "real32", "real64" };
 	EBitLayer *layer;
-	uint size[3], i, j, k, tiles[2], tx, ty;
+	uint size[3], tiles[2];
 	void *data;
-	VNBTile	tile;
 	VNBLayerType	type;
 
 	e_nsb_get_size(b_node, &size[0], &size[1], &size[2]);
@@ -612,43 +1490,20 @@ static void save_bitmap(FILE *f, ENode *b_node)
 	
 	for(layer = e_nsb_get_layer_next(b_node, 0); layer != NULL; layer = e_nsb_get_layer_next(b_node, e_nsb_get_layer_id(layer) + 1))
 	{
-		fprintf(f, "\t\t<layer-%s name=\"%s\">\n", layer_el[e_nsb_get_layer_type(layer)], e_nsb_get_layer_name(layer));
-		fprintf(f, "\t\t<tiles>\n");
 		data = e_nsb_get_layer_data(b_node, layer);
 		type = e_nsb_get_layer_type(layer);
-
-		for(i = 0; i < size[2]; i++)
+		if(bin.data != NULL)
 		{
-			for(j = 0; j < tiles[1]; j++)
-			{
-				for(k = 0; k < tiles[0]; k++)
-				{
-					fprintf(f, "\t\t<tile tile_x=\"%u\" tile_y=\"%u\" tile_z=\"%u\">\n", k, j, i);
-					tile_get(&tile, k, j, i, data, e_nsb_get_layer_type(layer), size);
-					for(ty = 0; ty < VN_B_TILE_SIZE; ty++)
-					{
-						fprintf(f, "\t\t");
-						for(tx = 0; tx < VN_B_TILE_SIZE; tx++)
-						{
-							if(type == VN_B_LAYER_UINT1)
-								fprintf(f, " %c", tile.vuint1[ty * VN_B_TILE_SIZE / CHAR_BIT] & (1 << (CHAR_BIT - tx - 1)) ? '1' : '0');
-							else if(type == VN_B_LAYER_UINT8)
-								fprintf(f, " %u", tile.vuint8[ty * VN_B_TILE_SIZE + tx]);
-							else if(type == VN_B_LAYER_UINT16)
-								fprintf(f, " %u", tile.vuint16[ty * VN_B_TILE_SIZE + tx]);
-							else if(type == VN_B_LAYER_REAL32)
-								fprintf(f, " %g", tile.vreal32[ty * VN_B_TILE_SIZE + tx]);
-							else if(type == VN_B_LAYER_REAL64)
-								fprintf(f, " %g", tile.vreal64[ty * VN_B_TILE_SIZE + tx]);
-						}
-						fprintf(f, "\n");
-					}
-					fprintf(f, "\t\t</tile>\n");
-				}
-			}
+			fprintf(f, "\t\t<layer-%s name=\"%s\" section=\"%u\"/>\n", layer_el[type], e_nsb_get_layer_name(layer),
+				bin_save_bitmap_layer(data, type, size, tiles, NULL, 0));
+			continue;
 		}
-		fprintf(f, "\t\t</tiles>\n");
-		fprintf(f, "\t\t</layer-%s>\n", layer_el[e_nsb_get_layer_type(layer)]);
+		fprintf(f, "\t\t<layer-%s name=\"%s\">\n", layer_el[type], e_nsb_get_layer_name(layer));
+		if(inc.node != NULL)
+			save_bitmap_piece(f, layer, data, type, size, tiles);
+		else
+			save_bitmap_tiles(f, data, type, size, tiles, NULL, 0);
+		fprintf(f, "\t\t</layer-%s>\n", layer_el[type]);
 	}
 	fprintf(f, "\t</layers>\n");
 }
@@ -685,6 +1540,47 @@ static void save_text(FILE *f, ENode *t_node)
 	fprintf(f, "\t</buffers>\n");
 }
 
+/* Save the keys of a curve as a binary section. The key values are written array by array, so the
+ * points are gone through once for each.
+*/
+static uint bin_save_curve(ECurve *curve)
+{
+	real64 pre_value[4], value[4], pos, post_value[4];
+	uint32 pre_pos[4], post_pos[4], dim = e_nsc_get_curve_dimensions(curve);
+	uint i, j, a, count = 0, section;
+	OutBuf out;
+
+	for(i = e_nsc_get_point_next(curve, 0); i != -1; i = e_nsc_get_point_next(curve, i + 1))
+		count++;
+	section = bin_section_begin(&out, VMLB_KEYS, count);
+	for(a = 0; a < 6; a++)
+	{
+		for(i = e_nsc_get_point_next(curve, 0); i != -1; i = e_nsc_get_point_next(curve, i + 1))
+		{
+			e_nsc_get_point(curve, i, pre_value, pre_pos, value, &pos, post_value, post_pos);
+			if(a == 0)
+				out_le64(&out, pos);
+			else
+				for(j = 0; j < dim; j++)
+				{
+					if(a == 1)
+						out_le64(&out, pre_value[j]);
+					else if(a == 2)
+						out_le64(&out, value[j]);
+					else if(a == 3)
+						out_le64(&out, post_value[j]);
+					else if(a == 4)
+						out_le32(&out, pre_pos[j]);
+					else
+						out_le32(&out, post_pos[j]);
+				}
+		}
+		out_pad(&out);
+	}
+	bin_section_end(&out);
+	return section;
+}
+
 static void save_curve(FILE *f, ENode *c_node)
 {
 	ECurve *curve;
@@ -695,6 +1591,7 @@ static void save_curve(FILE *f, ENode *c_node)
 	real64 post_value[4];
 	uint32 post_pos[4], dim;
 	uint i, j;
+	OutBuf out;
 
 	curve = e_nsc_get_curve_next(c_node, 0);
 	if(curve == NULL)
@@ -702,34 +1599,57 @@ static void save_curve(FILE *f, ENode *c_node)
 	fprintf(f, "\t<curves>\n");
 	for(; curve != NULL; curve = e_nsc_get_curve_next(c_node, e_nsc_get_curve_id(curve) + 1))
 	{
+		if(bin.data != NULL)
+		{
+			fprintf(f, "\t\t<curve-%ud name=\"%s\" section=\"%u\"/>\n", e_nsc_get_curve_dimensions(curve), e_nsc_get_curve_name(curve), bin_save_curve(curve));
+			continue;
+		}
 		fprintf(f, "\t\t<curve-%ud name=\"%s\">\n", e_nsc_get_curve_dimensions(curve), e_nsc_get_curve_name(curve));
 		dim = e_nsc_get_curve_dimensions(curve);
+		out_init(&out, f);
 		for(i = e_nsc_get_point_next(curve, 0); i != -1; i = e_nsc_get_point_next(curve, i + 1))
 		{
 			e_nsc_get_point(curve, i, pre_value, pre_pos, value, &pos, post_value, post_pos);
-			fprintf(f, "\t\t\t<key pos=\"%g\">\n", pos);
-			fprintf(f, "\t\t\t\t<pre-value>");
+			out_string(&out, "\t\t\t<key pos=\"");
+			out_real(&out, pos, 0);
+			out_string(&out, "\">\n\t\t\t\t<pre-value>");
 			for(j = 0; j < dim; j++)
-				fprintf(f, "%f%s", pre_value[j], (j == dim - 1) ? "" : " ");
-			fprintf(f, "</pre-value>\n");
-			fprintf(f, "\t\t\t\t<pre-pos>");
+			{
+				if(j > 0)
+					out_char(&out, ' ');
+				out_real(&out, pre_value[j], 0);
+			}
+			out_string(&out, "</pre-value>\n\t\t\t\t<pre-pos>");
 			for(j = 0; j < dim; j++)
-				fprintf(f, "%u%s", pre_pos[j], (j == dim - 1) ? "" : " ");
-			fprintf(f, "</pre-pos>\n");
-			fprintf(f, "\t\t\t\t<value>");
+			{
+				if(j > 0)
+					out_char(&out, ' ');
+				out_uint(&out, pre_pos[j]);
+			}
+			out_string(&out, "</pre-pos>\n\t\t\t\t<value>");
 			for(j = 0; j < dim; j++)
-				fprintf(f, "%f%s", value[j], (j == dim - 1) ? "" : " ");
-			fprintf(f, "</value>\n");
-			fprintf(f, "\t\t\t\t<post-value>");
+			{
+				if(j > 0)
+					out_char(&out, ' ');
+				out_real(&out, value[j], 0);
+			}
+			out_string(&out, "</value>\n\t\t\t\t<post-value>");
 			for(j = 0; j < dim; j++)
-				fprintf(f, "%f%s", post_value[j], (j == dim - 1) ? "" : " ");
-			fprintf(f, "</post-value>\n");
-			fprintf(f, "\t\t\t\t<post-pos>");
+			{
+				if(j > 0)
+					out_char(&out, ' ');
+				out_real(&out, post_value[j], 0);
+			}
+			out_string(&out, "</post-value>\n\t\t\t\t<post-pos>");
 			for(j = 0; j < dim; j++)
-				fprintf(f, "%u%s", post_pos[j], (j == dim - 1) ? "" : " ");
-			fprintf(f, "</post-pos>\n");
-			fprintf(f, "\t\t\t</key>\n");
+			{
+				if(j > 0)
+					out_char(&out, ' ');
+				out_uint(&out, post_pos[j]);
+			}
+			out_string(&out, "</post-pos>\n\t\t\t</key>\n");
 		}
+		out_flush(&out);
 		fprintf(f, "\t\t</curve-%ud>\n", e_nsc_get_curve_dimensions(curve));
 	}
 	fprintf(f, "\t</curves>\n");
@@ -792,12 +1712,16 @@ static void save_node(FILE *f, ENode *node, int filter)
 	uint16 group_id, tag_id;
 	uint i;
 	VNTag *tag;
+	long start, data_start = 0;
 
 	if(filter && !node_filter_test(node))
 	{
 		printf("node %u (%s) filtered out\n", e_ns_get_node_id(node), e_ns_get_node_name(node));
 		return;
 	}
+	start = ftell(f);
+	if(bin.data != NULL)
+		data_start = ftell(bin.data);
 
 	fprintf(f, "<%s id=\"n%u\" name=\"%s\">\n", node_el[e_ns_get_node_type(node)], e_ns_get_node_id(node), e_ns_get_node_name(node));
 	if(e_ns_get_next_tag_group(node, 0) != (uint16)-1)
@@ -878,6 +1802,9 @@ static void save_node(FILE *f, ENode *node, int filter)
 			;
 	}
 	fprintf(f, "</%s>\n\n", node_el[e_ns_get_node_type(node)]);
+	stats.nodes[e_ns_get_node_type(node)]++;
+	if(start >= 0)
+		stats.bytes[e_ns_get_node_type(node)] += ftell(f) - start + (bin.data != NULL ? ftell(bin.data) - data_start : 0);
 }
 
 static boolean save_data_test(uint32 change_timeout, uint32 change_override)
@@ -928,13 +1855,14 @@ static int timestring_set(char *buffer, size_t max)
 	return 0;
 }
 
-static void save_data(FILE *f, char *timer, int filter, uint32 change_timeout, uint32 change_override)
+static void save_data(FILE *f, char *timer, int filter, int binary, int incremental, uint32 change_timeout, uint32 change_override)
 {
 	static const char *node_dir[] = { "object/", "geometry/", "material/", "bitmap/", "text/", "curve/", "audio/" };
 	ENode *node, *me = e_ns_get_node_avatar(0);
 	FILE *node_file;
 	NodeUpdate *n;
 	uint i, seconds;
+	double start = timer_now();
 
 	verse_session_get_time(&seconds, NULL);
 	fprintf(f, "<?xml version=\"1.0\" encoding=\"latin1\"?>\n\n");
@@ -954,10 +1882,26 @@ static void save_data(FILE *f, char *timer, int filter, uint32 change_timeout, u
 					n->last_save = seconds;
 					n->last_update = seconds;
 					timestring_set(timer, 32);
-					sprintf(n->last_name, "%s%s_%s.vml", node_dir[i], e_ns_get_node_name(node), timer);
-					if((node_file = fut_path_open(n->last_name, "w")) != NULL)
+					sprintf(n->last_name, "%s%s_%s.%s", node_dir[i], e_ns_get_node_name(node), timer, binary && !incremental ? "vmlb" : "vml");
+					if((node_file = fut_path_open(n->last_name, binary && !incremental ? "wb" : "w")) != NULL)
 					{
+						if(incremental)
+						{
+							inc.node = n;
+							inc.dir = node_dir[i];
+							inc.name = e_ns_get_node_name(node);
+							inc.timer = timer;
+							inc.binary = binary;
+						}
+						else if(binary)
+							bin_begin();
 						save_node(node_file, node, filter);
+						bin_end(node_file);
+						if(inc.node != NULL)
+						{
+							piece_sweep(n);
+							inc.node = NULL;
+						}
 						n->saved = TRUE;
 						fclose(node_file);
 					}
@@ -970,6 +1914,8 @@ static void save_data(FILE *f, char *timer, int filter, uint32 change_timeout, u
 		}
 	}else
 	{
+		if(binary)
+			bin_begin();
 		for(i = 0; i < V_NT_NUM_TYPES; i++)
 		{
 			for(node = e_ns_get_node_next(0, 0, i); node != NULL; node = e_ns_get_node_next(e_ns_get_node_id(node) + 1, 0, i))
@@ -981,7 +1927,10 @@ static void save_data(FILE *f, char *timer, int filter, uint32 change_timeout, u
 		}
 	}
 	fprintf(f, "</vml>\n");
+	bin_end(f);
 	fclose(f);
+	stats.saves++;
+	stats.time_saving += timer_now() - start;
 }
 
 static void download_data(void)
@@ -1030,8 +1979,9 @@ int main(int argc, char **argv)
 	const char *name, *pass, *address, *file, *tmp;
 	char timer[64], file_name[256];
 	FILE *f;
-	int	repeat = 0, filter = 0;
+	int	repeat = 0, filter = 0, binary = 0, incremental = 0;
 
+	stats.start = timer_now();
 	enough_init();
 	for(i = 0; i < V_NT_NUM_TYPES; i++)
 		e_ns_set_custom_func(0, i, node_update_func);
@@ -1044,10 +1994,17 @@ int main(int argc, char **argv)
 	if(tmp != NULL)
 		interval = strtoul(tmp, NULL, 10);
 	filter = find_param_single(argc, argv, "-l");
+	binary = find_param_single(argc, argv, "-b");
+	incremental = find_param_single(argc, argv, "-d");
 	if((tmp = find_param(argc, argv, "-c", "30")) != NULL)
 		change_timeout = strtoul(tmp, NULL, 10);
 	if((tmp = find_param(argc, argv, "-C", "300")) != NULL)
 		change_override = strtoul(tmp, NULL, 10);
+	stats.file_name = find_param(argc, argv, "-s", NULL);
+#if defined SIGUSR1
+	if(stats.file_name != NULL)
+		signal(SIGUSR1, stats_signal);
+#endif
 
 	for(i = 1; i < argc; i++)
 	{
@@ -1061,10 +2018,13 @@ int main(int argc, char **argv)
 			printf("-a <address>\n");
 			printf("-f <filename>\n");
 			printf("-l Filter out object nodes without links or tags.\n");
+			printf("-b Save binary VMLB, with bulk data stored as raw arrays.\n");
 			printf("-1 Save only once, then exit.\n");
 			printf("-i <save interval in seconds>\n");
+			printf("-d In continuous mode, save geometry layers and bitmap tiles in files of their own, rewriting only changed ones.\n");
 			printf("-c <n> In continuous mode, save un-changed nodes every <n> seconds.\n");
 			printf("-C <n> In cintinuous mode, save nodes every n seconds, even if changing.\n");
+			printf("-s <file> Write statistics as JSON to <file> (\"-\" for stderr) on exit and on SIGUSR1.\n");
 			return EXIT_SUCCESS;
 		}
 	}
@@ -1090,6 +2050,8 @@ int main(int argc, char **argv)
 		{
 			verse_callback_update(500000);
 			download_data();
+			if(stats.requested)
+				stats_dump();
 			verse_session_get_time(&seconds, NULL);
 		}
 		timestring_set(timer, sizeof timer);
@@ -1098,18 +2060,19 @@ int main(int argc, char **argv)
 		else
 			sprintf(file_name, "%s", file);
 
-		if((!repeat || save_data_test(change_timeout, change_override)) && (f = fopen(file_name, "w")) != NULL)
+		if((!repeat || save_data_test(change_timeout, change_override)) && (f = fopen(file_name, binary && !repeat ? "wb" : "w")) != NULL)
 		{	
 			printf("Done waiting, beginning save\n");
 			if(repeat)
-				save_data(f, timer, filter, change_timeout, change_override);
+				save_data(f, timer, filter, binary, incremental, change_timeout, change_override);
 			else
-				save_data(f, NULL, filter, change_timeout, change_override);
+				save_data(f, NULL, filter, binary, 0, change_timeout, change_override);
 			printf("Save complete\n");
 		}
 		if(!repeat)
 			break;
 		printf("Waiting %u seconds ...\n", interval);
 	}
+	stats_dump();
 	return EXIT_SUCCESS;
 }
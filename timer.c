@@ -0,0 +1,41 @@
+/*
+ * A wall-clock timer, using the best monotonic clock each platform offers.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#if defined _WIN32
+#include <windows.h>
+#elif defined __unix__ || defined __APPLE__
+#include <sys/time.h>
+#include <time.h>
+#else
+#include <time.h>
+#endif
+
+#include "timer.h"
+
+double timer_now(void)
+{
+#if defined _WIN32
+	LARGE_INTEGER	freq, now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double) now.QuadPart / freq.QuadPart;
+#elif (defined __unix__ || defined __APPLE__) && defined CLOCK_MONOTONIC
+	struct timespec	now;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+		return now.tv_sec + now.tv_nsec / 1E9;
+	return 0.0;
+#elif defined __unix__ || defined __APPLE__
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec / 1E6;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
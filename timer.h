@@ -0,0 +1,11 @@
+/*
+ * Header file for the loader's wall-clock timer, used to measure how long things take.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+/* Return the current time in seconds, from some arbitrary starting point. The clock is monotonic
+ * where the platform allows it, so only differences between two readings are meaningful.
+*/
+extern double	timer_now(void);
@@ -0,0 +1,1197 @@
+/*
+ * A recording stand-in for the Verse library, covering just the part of its API that the loader
+ * uses. Instead of talking to a server, every command sent is appended to a compact binary log
+ * and the create commands are echoed straight back, with IDs picked the way a server would. This
+ * makes loader runs deterministic and network-free, so they can be timed and their command streams
+ * compared between versions. Link it in place of the real library (see "make loader-stub"), and
+ * set the VERSE_STUB_LOG environment variable to the name of the log file to write.
+ *
+ * Built with STANDALONE defined, this file instead becomes a tool that prints such logs as text.
+ *
+ * Log format: the four bytes "VSTB" and a version byte, then one record per command. A record is
+ * an opcode byte followed by the command's arguments, as described by the format string of that
+ * opcode in stub_op[]. Integers and reals are little-endian, strings are a 16-bit length (0xffff
+ * for NULL) and the bytes. Arrays are an element format byte, a 32-bit count and the elements.
+ * A variant ('v') is a count byte, followed by that many values each preceded by its format byte;
+ * this is used for unions, like tag values and material fragments, that depend on a type field.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verse.h"
+
+/* ----------------------------------------------------------------------------------------- */
+
+#define	STUB_MAGIC	"VSTB"
+#define	STUB_VERSION	1
+
+typedef enum
+{
+	OP_CONNECT = 1, OP_CONNECT_TERMINATE, OP_NODE_INDEX_SUBSCRIBE,
+	OP_NODE_CREATE, OP_NODE_DESTROY, OP_NODE_SUBSCRIBE, OP_NODE_NAME_SET,
+	OP_TAG_GROUP_CREATE, OP_TAG_CREATE,
+	OP_O_TRANSFORM_POS, OP_O_TRANSFORM_ROT, OP_O_TRANSFORM_SCALE, OP_O_LIGHT_SET, OP_O_LINK_SET,
+	OP_O_METHOD_GROUP_CREATE, OP_O_METHOD_CREATE, OP_O_HIDE,
+	OP_G_LAYER_CREATE, OP_G_VERTEX_XYZ, OP_G_VERTEX_UINT32, OP_G_VERTEX_REAL64,
+	OP_G_CORNER_UINT32, OP_G_CORNER_REAL64, OP_G_FACE_UINT8, OP_G_FACE_UINT32, OP_G_FACE_REAL64,
+	OP_G_CREASE_VERTEX, OP_G_CREASE_EDGE, OP_G_BONE_CREATE,
+	OP_M_FRAGMENT_CREATE,
+	OP_B_DIMENSIONS_SET, OP_B_LAYER_CREATE, OP_B_TILE_SET,
+	OP_T_LANGUAGE_SET, OP_T_BUFFER_CREATE, OP_T_TEXT_SET,
+	OP_C_CURVE_CREATE, OP_C_KEY_SET,
+	OP_A_BUFFER_CREATE, OP_A_BLOCK_SET,
+	OP_COUNT
+} Opcode;
+
+/* Argument formats: 'b', 'h' and 'i' are unsigned 8, 16 and 32-bit integers, 'B', 'H' and 'I' the
+ * signed versions, 'f' and 'r' are 32 and 64-bit reals, 's' a string, 'a' an array and 'v' a variant.
+ * In arrays, 'I' elements are stored in 32 bits even when they are 24-bit audio samples.
+*/
+static const struct
+{
+	const char	*name;
+	const char	*format;
+} stub_op[] = {
+	{ NULL, NULL },
+	{ "connect",			"sss" },
+	{ "connect_terminate",		"ss" },
+	{ "node_index_subscribe",	"i" },
+	{ "node_create",		"ibb" },
+	{ "node_destroy",		"i" },
+	{ "node_subscribe",		"i" },
+	{ "node_name_set",		"is" },
+	{ "tag_group_create",		"ihs" },
+	{ "tag_create",			"ihhsbv" },
+	{ "o_transform_pos_real64",	"iiiaaaar" },
+	{ "o_transform_rot_real64",	"iiiaaaar" },
+	{ "o_transform_scale_real64",	"irrr" },
+	{ "o_light_set",		"irrr" },
+	{ "o_link_set",			"ihisi" },
+	{ "o_method_group_create",	"ihs" },
+	{ "o_method_create",		"ihhsaa" },
+	{ "o_hide",			"ib" },
+	{ "g_layer_create",		"ihsbir" },
+	{ "g_vertex_set_xyz_real64",	"ihirrr" },
+	{ "g_vertex_set_uint32",	"ihii" },
+	{ "g_vertex_set_real64",	"ihir" },
+	{ "g_polygon_set_corner_uint32", "ihiiiii" },
+	{ "g_polygon_set_corner_real64", "ihirrrr" },
+	{ "g_polygon_set_face_uint8",	"ihib" },
+	{ "g_polygon_set_face_uint32",	"ihii" },
+	{ "g_polygon_set_face_real64",	"ihir" },
+	{ "g_crease_set_vertex",	"isi" },
+	{ "g_crease_set_edge",		"isi" },
+	{ "g_bone_create",		"ihsshrrrsss" },
+	{ "m_fragment_create",		"ihbv" },
+	{ "b_dimensions_set",		"ihhh" },
+	{ "b_layer_create",		"ihsb" },
+	{ "b_tile_set",			"ihhhhba" },
+	{ "t_language_set",		"is" },
+	{ "t_buffer_create",		"ihs" },
+	{ "t_text_set",			"ihiis" },
+	{ "c_curve_create",		"ihsb" },
+	{ "c_key_set",			"ihibaaaraa" },
+	{ "a_buffer_create",		"ihsbr" },
+	{ "a_block_set",		"ihiba" },
+};
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* Returns non-zero if the host stores numbers with the least significant byte first. */
+static int little_endian(void)
+{
+	const uint16	probe = 1;
+
+	return *(const uint8 *) &probe == 1;
+}
+
+/* Copy <size> bytes between host and log byte order. Since the log is little-endian, this is
+ * either a copy or a reversal.
+*/
+static void order_bytes(uint8 *dst, const void *src, size_t size)
+{
+	size_t	i;
+
+	if(little_endian())
+		memcpy(dst, src, size);
+	else
+	{
+		for(i = 0; i < size; i++)
+			dst[i] = ((const uint8 *) src)[size - 1 - i];
+	}
+}
+
+#if !defined STANDALONE
+
+/* Size in bytes of a single array element of the given format, or 0 for strings. */
+static size_t element_size(char format)
+{
+	switch(format)
+	{
+	case 'b':
+	case 'B':	return 1;
+	case 'h':
+	case 'H':	return 2;
+	case 'i':
+	case 'I':
+	case 'f':	return 4;
+	case 'r':	return 8;
+	}
+	return 0;
+}
+
+static FILE	*stub_log = NULL;
+static int	stub_log_tried = 0;
+
+static void log_close(void)
+{
+	if(stub_log != NULL)
+	{
+		fclose(stub_log);
+		stub_log = NULL;
+	}
+}
+
+/* Open the log on first use, if one was asked for. Returns NULL if commands are not logged. */
+static FILE * log_get(void)
+{
+	const char	*name;
+
+	if(stub_log == NULL && !stub_log_tried)
+	{
+		stub_log_tried = 1;
+		if((name = getenv("VERSE_STUB_LOG")) == NULL || *name == '\0')
+			return NULL;
+		if((stub_log = fopen(name, "wb")) == NULL)
+		{
+			fprintf(stderr, "verse_stub: Couldn't open log \"%s\" for writing\n", name);
+			return NULL;
+		}
+		setvbuf(stub_log, NULL, _IOFBF, 1 << 16);
+		fwrite(STUB_MAGIC, 4, 1, stub_log);
+		putc(STUB_VERSION, stub_log);
+		atexit(log_close);
+	}
+	return stub_log;
+}
+
+static void put_number(FILE *log, const void *value, size_t size)
+{
+	uint8	buf[8];
+
+	order_bytes(buf, value, size);
+	fwrite(buf, size, 1, log);
+}
+
+static void put_string(FILE *log, const char *str)
+{
+	size_t	len;
+	uint16	len16;
+
+	if(str == NULL)
+	{
+		len16 = 0xffff;
+		put_number(log, &len16, sizeof len16);
+		return;
+	}
+	if((len = strlen(str)) >= 0xffff)
+		len = 0xfffe;
+	len16 = len;
+	put_number(log, &len16, sizeof len16);
+	fwrite(str, len, 1, log);
+}
+
+/* Write an array of <count> elements of the given format. A NULL <data> is written as empty. */
+static void put_array(FILE *log, char format, uint32 count, const void *data)
+{
+	const uint8	*elem = data;
+	size_t		size = element_size(format);
+	uint32		i;
+
+	if(data == NULL)
+		count = 0;
+	putc(format, log);
+	put_number(log, &count, sizeof count);
+	for(i = 0; i < count; i++)
+	{
+		if(format == 's')
+			put_string(log, ((const char **) data)[i]);
+		else
+			put_number(log, elem + i * size, size);
+	}
+}
+
+/* Write values according to <format>, taking them from <args>. An array takes three arguments:
+ * the element format (as an int), the count, and a pointer to the elements. If <tagged> is
+ * set, each value is preceded by its format, as in variants. A 'v' writes nothing, the caller
+ * is expected to follow up with a call to put_variant().
+*/
+static void put_args(FILE *log, const char *format, va_list *args, int tagged)
+{
+	for(; *format != '\0'; format++)
+	{
+		if(*format == 'v')
+			continue;
+		if(tagged)
+			putc(*format, log);
+		switch(*format)
+		{
+		case 'b':
+		case 'B':
+			putc(va_arg(*args, int), log);
+			break;
+		case 'h':
+		case 'H':
+			{
+				uint16	v = va_arg(*args, int);
+				put_number(log, &v, sizeof v);
+			}
+			break;
+		case 'i':
+		case 'I':
+			{
+				uint32	v = va_arg(*args, uint32);
+				put_number(log, &v, sizeof v);
+			}
+			break;
+		case 'r':
+			{
+				real64	v = va_arg(*args, double);
+				put_number(log, &v, sizeof v);
+			}
+			break;
+		case 's':
+			put_string(log, va_arg(*args, const char *));
+			break;
+		case 'a':
+			{
+				char		elem = va_arg(*args, int);
+				uint32		count = va_arg(*args, uint32);
+				const void	*data = va_arg(*args, const void *);
+
+				put_array(log, elem, count, data);
+			}
+			break;
+		}
+	}
+}
+
+/* Log a command. The arguments follow the opcode's format in stub_op[]. */
+static void record(int op, ...)
+{
+	FILE	*log;
+	va_list	args;
+
+	if((log = log_get()) == NULL)
+		return;
+	putc(op, log);
+	va_start(args, op);
+	put_args(log, stub_op[op].format, &args, 0);
+	va_end(args);
+}
+
+/* Log the variant part of a command, after record(). */
+static void put_variant(const char *format, ...)
+{
+	FILE	*log;
+	va_list	args;
+
+	if((log = log_get()) == NULL)
+		return;
+	putc(strlen(format), log);
+	va_start(args, format);
+	put_args(log, format, &args, 1);
+	va_end(args);
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* A layer, buffer or curve of a node. A node only has one of these kinds, so they share a list. */
+typedef struct
+{
+	char		name[64];
+	uint16		id;
+} StubName;
+
+/* What the stub remembers about each node it has created, to pick IDs like a server would. */
+typedef struct
+{
+	VNodeType	type;
+	int		subscribed;
+	uint16		next_group, next_method_group, next_layer, next_fragment, next_buffer, next_curve;
+	StubName	*name;
+	size_t		name_count;
+} StubNode;
+
+/* A create command waiting to be echoed back, by the next verse_callback_update(). */
+typedef struct Echo	Echo;
+
+struct Echo
+{
+	Opcode		op;
+	VNodeID		node_id;
+	uint32		id;
+	int		type;
+	real64		value;
+	char		name[64];
+	Echo		*next;
+};
+
+typedef struct
+{
+	void		*send_func;
+	void		*callback;
+	void		*user;
+} Callback;
+
+static struct
+{
+	Callback	callback[32];
+	size_t		callback_count;
+	StubNode	*node;
+	size_t		node_count, node_alloc;
+	Echo		*first, *last;
+	VNodeID		avatar;
+} stub = { { { NULL } }, 0, NULL, 0, 0, NULL, NULL, ~0u };
+
+static void * callback_find(void *send_func, void **user)
+{
+	size_t	i;
+
+	for(i = 0; i < stub.callback_count; i++)
+	{
+		if(stub.callback[i].send_func == send_func)
+		{
+			*user = stub.callback[i].user;
+			return stub.callback[i].callback;
+		}
+	}
+	return NULL;
+}
+
+static void echo(Opcode op, VNodeID node_id, uint32 id, int type, real64 value, const char *name)
+{
+	Echo	*e;
+
+	if((e = malloc(sizeof *e)) == NULL)
+		return;
+	e->op = op;
+	e->node_id = node_id;
+	e->id = id;
+	e->type = type;
+	e->value = value;
+	e->name[0] = '\0';
+	if(name != NULL)
+	{
+		strncpy(e->name, name, sizeof e->name - 1);
+		e->name[sizeof e->name - 1] = '\0';
+	}
+	e->next = NULL;
+	if(stub.last != NULL)
+		stub.last->next = e;
+	else
+		stub.first = e;
+	stub.last = e;
+}
+
+static VNodeID node_new(VNodeType type)
+{
+	StubNode	*n;
+
+	if(stub.node_count == stub.node_alloc)
+	{
+		size_t		na = stub.node_alloc > 0 ? 2 * stub.node_alloc : 256;
+		StubNode	*nn;
+
+		if((nn = realloc(stub.node, na * sizeof *nn)) == NULL)
+		{
+			fprintf(stderr, "verse_stub: Out of memory for nodes\n");
+			exit(EXIT_FAILURE);
+		}
+		stub.node = nn;
+		stub.node_alloc = na;
+	}
+	n = stub.node + stub.node_count;
+	memset(n, 0, sizeof *n);
+	n->type = type;
+	return stub.node_count++;
+}
+
+static StubNode * node_get(VNodeID node_id)
+{
+	return node_id < stub.node_count ? stub.node + node_id : NULL;
+}
+
+/* Pick the ID for a new thing in a node: the one asked for, or the next free one if ~0. */
+static uint16 id_pick(uint16 *next, uint16 wanted)
+{
+	if(wanted == (uint16) ~0)
+		return (*next)++;
+	if(wanted >= *next)
+		*next = wanted + 1;
+	return wanted;
+}
+
+static uint16 node_id_pick(VNodeID node_id, size_t offset, uint16 wanted)
+{
+	StubNode	*n;
+	uint16		dummy = 0;
+
+	if((n = node_get(node_id)) == NULL)
+		return id_pick(&dummy, wanted);
+	return id_pick((uint16 *) ((char *) n + offset), wanted);
+}
+
+#define	NODE_ID_PICK(node_id, field, wanted)	node_id_pick(node_id, offsetof(StubNode, field), wanted)
+
+/* Pick the ID for a named layer, buffer or curve. Like a server, a create for a name the node already
+ * has gets the existing one back, rather than a new one.
+*/
+static uint16 node_name_pick(VNodeID node_id, size_t offset, uint16 wanted, const char *name)
+{
+	StubNode	*n;
+	StubName	*nn;
+	size_t		i;
+
+	if((n = node_get(node_id)) == NULL || name == NULL)
+		return node_id_pick(node_id, offset, wanted);
+	for(i = 0; i < n->name_count; i++)
+	{
+		if(strcmp(n->name[i].name, name) == 0)
+			return n->name[i].id;
+	}
+	if((nn = realloc(n->name, (n->name_count + 1) * sizeof *nn)) == NULL)
+	{
+		fprintf(stderr, "verse_stub: Out of memory for names\n");
+		exit(EXIT_FAILURE);
+	}
+	n->name = nn;
+	nn += n->name_count++;
+	strncpy(nn->name, name, sizeof nn->name - 1);
+	nn->name[sizeof nn->name - 1] = '\0';
+	nn->id = id_pick((uint16 *) ((char *) n + offset), wanted);
+	return nn->id;
+}
+
+#define	NODE_NAME_PICK(node_id, field, wanted, name)	node_name_pick(node_id, offsetof(StubNode, field), wanted, name)
+
+/* ----------------------------------------------------------------------------------------- */
+
+void verse_callback_set(void *send_func, void *callback, void *user_data)
+{
+	size_t	i;
+
+	for(i = 0; i < stub.callback_count; i++)
+	{
+		if(stub.callback[i].send_func == send_func)
+			break;
+	}
+	if(i == sizeof stub.callback / sizeof *stub.callback)
+		return;
+	stub.callback[i].send_func = send_func;
+	stub.callback[i].callback  = callback;
+	stub.callback[i].user      = user_data;
+	if(i == stub.callback_count)
+		stub.callback_count++;
+}
+
+/* Deliver the echoes queued so far. Ones queued by the callbacks themselves wait for the next
+ * call, as they would with a real server. There is never anything to wait for, so this ignores
+ * the timeout and returns at once.
+*/
+void verse_callback_update(uint32 microseconds)
+{
+	Echo	*e, *next;
+	void	*user;
+
+	e = stub.first;
+	stub.first = stub.last = NULL;
+	for(; e != NULL; e = next)
+	{
+		next = e->next;
+		switch(e->op)
+		{
+		case OP_CONNECT:
+			{
+				void	(*cb)(void *, VNodeID, const char *, const uint8 *) = callback_find(verse_send_connect_accept, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->name, NULL);
+			}
+			break;
+		case OP_NODE_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VNodeType, VNodeOwner) = callback_find(verse_send_node_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->type, VN_OWNER_MINE);
+			}
+			break;
+		case OP_TAG_GROUP_CREATE:
+		case OP_O_METHOD_GROUP_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, uint16, const char *);
+				cb = callback_find(e->op == OP_TAG_GROUP_CREATE ? (void *) verse_send_tag_group_create :
+						   (void *) verse_send_o_method_group_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->name);
+			}
+			break;
+		case OP_G_LAYER_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VLayerID, const char *, VNGLayerType, uint32, real64) = callback_find(verse_send_g_layer_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->name, e->type, 0, 0.0);
+			}
+			break;
+		case OP_M_FRAGMENT_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VNMFragmentID, VNMFragmentType, const VMatFrag *) = callback_find(verse_send_m_fragment_create, &user);
+				VMatFrag	frag;
+
+				memset(&frag, 0, sizeof frag);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->type, &frag);
+			}
+			break;
+		case OP_B_LAYER_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VLayerID, const char *, VNBLayerType) = callback_find(verse_send_b_layer_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->name, e->type);
+			}
+			break;
+		case OP_T_BUFFER_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VBufferID, const char *) = callback_find(verse_send_t_buffer_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->name);
+			}
+			break;
+		case OP_C_CURVE_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VLayerID, const char *, uint8) = callback_find(verse_send_c_curve_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->name, e->type);
+			}
+			break;
+		case OP_A_BUFFER_CREATE:
+			{
+				void	(*cb)(void *, VNodeID, VBufferID, const char *, VNABlockType, real64) = callback_find(verse_send_a_buffer_create, &user);
+				if(cb != NULL)
+					cb(user, e->node_id, e->id, e->name, e->type, e->value);
+			}
+			break;
+		default:
+			break;
+		}
+		free(e);
+	}
+}
+
+/* Nothing is ever queued for sending, so the session is always empty. */
+size_t verse_session_get_size(void)
+{
+	return 0;
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+VSession verse_send_connect(const char *name, const char *pass, const char *address, const uint8 *expected_host_id)
+{
+	record(OP_CONNECT, name, "", address);	/* Passwords don't belong in logs. */
+	if(stub.avatar == ~0u)
+		stub.avatar = node_new(V_NT_OBJECT);
+	echo(OP_CONNECT, stub.avatar, 0, 0, 0.0, address);
+	return NULL;
+}
+
+/* Never actually sent by the loader, but its address is used to set the connect callback. */
+VSession verse_send_connect_accept(VNodeID avatar, const char *address, uint8 *host_id)
+{
+	return NULL;
+}
+
+void verse_send_connect_terminate(const char *address, const char *bye)
+{
+	record(OP_CONNECT_TERMINATE, address, bye);
+	log_close();
+}
+
+void verse_send_node_index_subscribe(uint32 mask)
+{
+	record(OP_NODE_INDEX_SUBSCRIBE, mask);
+}
+
+void verse_send_node_create(VNodeID node_id, VNodeType type, VNodeOwner owner)
+{
+	record(OP_NODE_CREATE, node_id, type, owner);
+	echo(OP_NODE_CREATE, node_new(type), 0, type, 0.0, NULL);
+}
+
+void verse_send_node_destroy(VNodeID node_id)
+{
+	record(OP_NODE_DESTROY, node_id);
+}
+
+/* Subscribing to a geometry node for the first time announces the two layers every such node has. */
+void verse_send_node_subscribe(VNodeID node_id)
+{
+	StubNode	*n;
+
+	record(OP_NODE_SUBSCRIBE, node_id);
+	if((n = node_get(node_id)) == NULL || n->subscribed)
+		return;
+	n->subscribed = 1;
+	if(n->type == V_NT_GEOMETRY)
+	{
+		echo(OP_G_LAYER_CREATE, node_id, NODE_NAME_PICK(node_id, next_layer, 0, "vertex"), VN_G_LAYER_VERTEX_XYZ, 0.0, "vertex");
+		echo(OP_G_LAYER_CREATE, node_id, NODE_NAME_PICK(node_id, next_layer, 1, "polygon"), VN_G_LAYER_POLYGON_CORNER_UINT32, 0.0, "polygon");
+	}
+}
+
+void verse_send_node_name_set(VNodeID node_id, const char *name)
+{
+	record(OP_NODE_NAME_SET, node_id, name);
+}
+
+void verse_send_tag_group_create(VNodeID node_id, uint16 group_id, const char *name)
+{
+	record(OP_TAG_GROUP_CREATE, node_id, group_id, name);
+	echo(OP_TAG_GROUP_CREATE, node_id, NODE_ID_PICK(node_id, next_group, group_id), 0, 0.0, name);
+}
+
+void verse_send_tag_create(VNodeID node_id, uint16 group_id, uint16 tag_id, const char *name, VNTagType type, const VNTag *tag)
+{
+	record(OP_TAG_CREATE, node_id, group_id, tag_id, name, type);
+	switch(type)
+	{
+	case VN_TAG_BOOLEAN:
+		put_variant("b", tag->vboolean);
+		break;
+	case VN_TAG_UINT32:
+		put_variant("i", tag->vuint32);
+		break;
+	case VN_TAG_REAL64:
+		put_variant("r", tag->vreal64);
+		break;
+	case VN_TAG_STRING:
+		put_variant("s", tag->vstring);
+		break;
+	case VN_TAG_REAL64_VEC3:
+		put_variant("a", 'r', 3, tag->vreal64_vec3);
+		break;
+	case VN_TAG_LINK:
+		put_variant("i", tag->vlink);
+		break;
+	case VN_TAG_ANIMATION:
+		put_variant("iii", tag->vanimation.curve, tag->vanimation.start, tag->vanimation.end);
+		break;
+	case VN_TAG_BLOB:
+		put_variant("a", 'b', tag->vblob.size, tag->vblob.blob);
+		break;
+	default:
+		put_variant("");
+	}
+}
+
+void verse_send_o_transform_pos_real64(VNodeID node_id, uint32 time_s, uint32 time_f, const real64 *pos,
+				       const real64 *speed, const real64 *accelerate, const real64 *drag_normal, real64 drag)
+{
+	record(OP_O_TRANSFORM_POS, node_id, time_s, time_f, 'r', 3, pos, 'r', 3, speed,
+	       'r', 3, accelerate, 'r', 3, drag_normal, drag);
+}
+
+void verse_send_o_transform_rot_real64(VNodeID node_id, uint32 time_s, uint32 time_f, const VNQuat64 *rot,
+				       const VNQuat64 *speed, const VNQuat64 *accelerate, const VNQuat64 *drag_normal, real64 drag)
+{
+	real64	q[4][4];
+	const VNQuat64	*in[4];
+	int	i;
+
+	in[0] = rot;
+	in[1] = speed;
+	in[2] = accelerate;
+	in[3] = drag_normal;
+	for(i = 0; i < 4; i++)
+	{
+		if(in[i] == NULL)
+			continue;
+		q[i][0] = in[i]->x;
+		q[i][1] = in[i]->y;
+		q[i][2] = in[i]->z;
+		q[i][3] = in[i]->w;
+	}
+	record(OP_O_TRANSFORM_ROT, node_id, time_s, time_f, 'r', 4, in[0] ? q[0] : NULL, 'r', 4, in[1] ? q[1] : NULL,
+	       'r', 4, in[2] ? q[2] : NULL, 'r', 4, in[3] ? q[3] : NULL, drag);
+}
+
+void verse_send_o_transform_scale_real64(VNodeID node_id, real64 scale_x, real64 scale_y, real64 scale_z)
+{
+	record(OP_O_TRANSFORM_SCALE, node_id, scale_x, scale_y, scale_z);
+}
+
+void verse_send_o_light_set(VNodeID node_id, real64 light_r, real64 light_g, real64 light_b)
+{
+	record(OP_O_LIGHT_SET, node_id, light_r, light_g, light_b);
+}
+
+void verse_send_o_link_set(VNodeID node_id, uint16 link_id, VNodeID link, const char *label, uint32 target_id)
+{
+	record(OP_O_LINK_SET, node_id, link_id, link, label, target_id);
+}
+
+void verse_send_o_method_group_create(VNodeID node_id, uint16 group_id, const char *name)
+{
+	record(OP_O_METHOD_GROUP_CREATE, node_id, group_id, name);
+	echo(OP_O_METHOD_GROUP_CREATE, node_id, NODE_ID_PICK(node_id, next_method_group, group_id), 0, 0.0, name);
+}
+
+void verse_send_o_method_create(VNodeID node_id, uint16 group_id, uint16 method_id, const char *name, uint8 param_count,
+				const VNOParamType *param_types, const char **param_names)
+{
+	uint8	types[256];
+	int	i;
+
+	for(i = 0; i < param_count && param_types != NULL; i++)
+		types[i] = param_types[i];
+	record(OP_O_METHOD_CREATE, node_id, group_id, method_id, name, 'b', param_count, param_types != NULL ? types : NULL,
+	       's', param_count, param_names);
+}
+
+void verse_send_o_hide(VNodeID node_id, uint8 hidden)
+{
+	record(OP_O_HIDE, node_id, hidden);
+}
+
+void verse_send_g_layer_create(VNodeID node_id, VLayerID layer_id, const char *name, VNGLayerType type, uint32 def_uint, real64 def_real)
+{
+	record(OP_G_LAYER_CREATE, node_id, layer_id, name, type, def_uint, def_real);
+	echo(OP_G_LAYER_CREATE, node_id, NODE_NAME_PICK(node_id, next_layer, layer_id, name), type, 0.0, name);
+}
+
+void verse_send_g_vertex_set_xyz_real64(VNodeID node_id, VLayerID layer_id, uint32 vertex_id, real64 x, real64 y, real64 z)
+{
+	record(OP_G_VERTEX_XYZ, node_id, layer_id, vertex_id, x, y, z);
+}
+
+void verse_send_g_vertex_set_uint32(VNodeID node_id, VLayerID layer_id, uint32 vertex_id, uint32 value)
+{
+	record(OP_G_VERTEX_UINT32, node_id, layer_id, vertex_id, value);
+}
+
+void verse_send_g_vertex_set_real64(VNodeID node_id, VLayerID layer_id, uint32 vertex_id, real64 value)
+{
+	record(OP_G_VERTEX_REAL64, node_id, layer_id, vertex_id, value);
+}
+
+void verse_send_g_polygon_set_corner_uint32(VNodeID node_id, VLayerID layer_id, uint32 polygon_id, uint32 v0, uint32 v1, uint32 v2, uint32 v3)
+{
+	record(OP_G_CORNER_UINT32, node_id, layer_id, polygon_id, v0, v1, v2, v3);
+}
+
+void verse_send_g_polygon_set_corner_real64(VNodeID node_id, VLayerID layer_id, uint32 polygon_id, real64 v0, real64 v1, real64 v2, real64 v3)
+{
+	record(OP_G_CORNER_REAL64, node_id, layer_id, polygon_id, v0, v1, v2, v3);
+}
+
+void verse_send_g_polygon_set_face_uint8(VNodeID node_id, VLayerID layer_id, uint32 polygon_id, uint8 value)
+{
+	record(OP_G_FACE_UINT8, node_id, layer_id, polygon_id, value);
+}
+
+void verse_send_g_polygon_set_face_uint32(VNodeID node_id, VLayerID layer_id, uint32 polygon_id, uint32 value)
+{
+	record(OP_G_FACE_UINT32, node_id, layer_id, polygon_id, value);
+}
+
+void verse_send_g_polygon_set_face_real64(VNodeID node_id, VLayerID layer_id, uint32 polygon_id, real64 value)
+{
+	record(OP_G_FACE_REAL64, node_id, layer_id, polygon_id, value);
+}
+
+void verse_send_g_crease_set_vertex(VNodeID node_id, const char *layer, uint32 def_crease)
+{
+	record(OP_G_CREASE_VERTEX, node_id, layer, def_crease);
+}
+
+void verse_send_g_crease_set_edge(VNodeID node_id, const char *layer, uint32 def_crease)
+{
+	record(OP_G_CREASE_EDGE, node_id, layer, def_crease);
+}
+
+void verse_send_g_bone_create(VNodeID node_id, uint16 bone_id, const char *weight, const char *reference, uint16 parent,
+			      real64 pos_x, real64 pos_y, real64 pos_z, const char *pos_label, const char *rot_label, const char *scale_label)
+{
+	record(OP_G_BONE_CREATE, node_id, bone_id, weight, reference, parent, pos_x, pos_y, pos_z,
+	       pos_label, rot_label, scale_label);
+}
+
+void verse_send_m_fragment_create(VNodeID node_id, VNMFragmentID frag_id, VNMFragmentType type, const VMatFrag *f)
+{
+	record(OP_M_FRAGMENT_CREATE, node_id, frag_id, type);
+	switch(type)
+	{
+	case VN_M_FT_COLOR:
+		put_variant("rrr", f->color.red, f->color.green, f->color.blue);
+		break;
+	case VN_M_FT_LIGHT:
+		put_variant("brisss", f->light.type, f->light.normal_falloff, f->light.brdf,
+			    f->light.brdf_r, f->light.brdf_g, f->light.brdf_b);
+		break;
+	case VN_M_FT_REFLECTION:
+		put_variant("r", f->reflection.normal_falloff);
+		break;
+	case VN_M_FT_TRANSPARENCY:
+		put_variant("rr", f->transparency.normal_falloff, f->transparency.refraction_index);
+		break;
+	case VN_M_FT_VOLUME:
+		put_variant("rrrr", f->volume.diffusion, f->volume.col_r, f->volume.col_g, f->volume.col_b);
+		break;
+	case VN_M_FT_GEOMETRY:
+		put_variant("sss", f->geometry.layer_r, f->geometry.layer_g, f->geometry.layer_b);
+		break;
+	case VN_M_FT_TEXTURE:
+		put_variant("isssbh", f->texture.bitmap, f->texture.layer_r, f->texture.layer_g, f->texture.layer_b,
+			    f->texture.filtered, f->texture.mapping);
+		break;
+	case VN_M_FT_NOISE:
+		put_variant("bh", f->noise.type, f->noise.mapping);
+		break;
+	case VN_M_FT_BLENDER:
+		put_variant("bhhh", f->blender.type, f->blender.data_a, f->blender.data_b, f->blender.control);
+		break;
+	case VN_M_FT_CLAMP:
+		put_variant("rrrhb", f->clamp.red, f->clamp.green, f->clamp.blue, f->clamp.data, f->clamp.min);
+		break;
+	case VN_M_FT_MATRIX:
+		put_variant("ah", 'r', 16, f->matrix.matrix, f->matrix.data);
+		break;
+	case VN_M_FT_RAMP:
+		{
+			real64	point[4 * 48];
+			int	i, count = f->ramp.point_count <= 48 ? f->ramp.point_count : 48;
+
+			for(i = 0; i < count; i++)
+			{
+				point[4 * i + 0] = f->ramp.ramp[i].pos;
+				point[4 * i + 1] = f->ramp.ramp[i].red;
+				point[4 * i + 2] = f->ramp.ramp[i].green;
+				point[4 * i + 3] = f->ramp.ramp[i].blue;
+			}
+			put_variant("bbha", f->ramp.type, f->ramp.channel, f->ramp.mapping, 'r', 4 * count, point);
+		}
+		break;
+	case VN_M_FT_ANIMATION:
+		put_variant("s", f->animation.label);
+		break;
+	case VN_M_FT_ALTERNATIVE:
+		put_variant("hh", f->alternative.alt_a, f->alternative.alt_b);
+		break;
+	case VN_M_FT_OUTPUT:
+		put_variant("shh", f->output.label, f->output.front, f->output.back);
+		break;
+	default:
+		put_variant("");
+	}
+	echo(OP_M_FRAGMENT_CREATE, node_id, NODE_ID_PICK(node_id, next_fragment, frag_id), type, 0.0, NULL);
+}
+
+void verse_send_b_dimensions_set(VNodeID node_id, uint16 width, uint16 height, uint16 depth)
+{
+	record(OP_B_DIMENSIONS_SET, node_id, width, height, depth);
+}
+
+void verse_send_b_layer_create(VNodeID node_id, VLayerID layer_id, const char *name, VNBLayerType type)
+{
+	record(OP_B_LAYER_CREATE, node_id, layer_id, name, type);
+	echo(OP_B_LAYER_CREATE, node_id, NODE_NAME_PICK(node_id, next_layer, layer_id, name), type, 0.0, name);
+}
+
+void verse_send_b_tile_set(VNodeID node_id, VLayerID layer_id, uint16 tile_x, uint16 tile_y, uint16 z, VNBLayerType type, const VNBTile *tile)
+{
+	const int	pixels = VN_B_TILE_SIZE * VN_B_TILE_SIZE;
+
+	switch(type)
+	{
+	case VN_B_LAYER_UINT1:
+		record(OP_B_TILE_SET, node_id, layer_id, tile_x, tile_y, z, type, 'b', pixels / 8, tile->vuint1);
+		break;
+	case VN_B_LAYER_UINT8:
+		record(OP_B_TILE_SET, node_id, layer_id, tile_x, tile_y, z, type, 'b', pixels, tile->vuint8);
+		break;
+	case VN_B_LAYER_UINT16:
+		record(OP_B_TILE_SET, node_id, layer_id, tile_x, tile_y, z, type, 'h', pixels, tile->vuint16);
+		break;
+	case VN_B_LAYER_REAL32:
+		record(OP_B_TILE_SET, node_id, layer_id, tile_x, tile_y, z, type, 'f', pixels, tile->vreal32);
+		break;
+	case VN_B_LAYER_REAL64:
+		record(OP_B_TILE_SET, node_id, layer_id, tile_x, tile_y, z, type, 'r', pixels, tile->vreal64);
+		break;
+	default:
+		record(OP_B_TILE_SET, node_id, layer_id, tile_x, tile_y, z, type, 'b', 0, NULL);
+	}
+}
+
+void verse_send_t_language_set(VNodeID node_id, const char *language)
+{
+	record(OP_T_LANGUAGE_SET, node_id, language);
+}
+
+void verse_send_t_buffer_create(VNodeID node_id, VBufferID buffer_id, const char *name)
+{
+	record(OP_T_BUFFER_CREATE, node_id, buffer_id, name);
+	echo(OP_T_BUFFER_CREATE, node_id, NODE_NAME_PICK(node_id, next_buffer, buffer_id, name), 0, 0.0, name);
+}
+
+void verse_send_t_text_set(VNodeID node_id, VBufferID buffer_id, uint32 pos, uint32 length, const char *text)
+{
+	record(OP_T_TEXT_SET, node_id, buffer_id, pos, length, text);
+}
+
+void verse_send_c_curve_create(VNodeID node_id, VLayerID curve_id, const char *name, uint8 dimensions)
+{
+	record(OP_C_CURVE_CREATE, node_id, curve_id, name, dimensions);
+	echo(OP_C_CURVE_CREATE, node_id, NODE_NAME_PICK(node_id, next_curve, curve_id, name), dimensions, 0.0, name);
+}
+
+void verse_send_c_key_set(VNodeID node_id, VLayerID curve_id, uint32 key_id, uint8 dimensions, const real64 *pre_value,
+			  const uint32 *pre_pos, const real64 *value, real64 pos, const real64 *post_value, const uint32 *post_pos)
+{
+	record(OP_C_KEY_SET, node_id, curve_id, key_id, dimensions, 'r', dimensions, pre_value,
+	       'i', dimensions, pre_pos, 'r', dimensions, value, pos, 'r', dimensions, post_value, 'i', dimensions, post_pos);
+}
+
+void verse_send_a_buffer_create(VNodeID node_id, VBufferID buffer_id, const char *name, VNABlockType type, real64 frequency)
+{
+	record(OP_A_BUFFER_CREATE, node_id, buffer_id, name, type, frequency);
+	echo(OP_A_BUFFER_CREATE, node_id, NODE_NAME_PICK(node_id, next_buffer, buffer_id, name), type, frequency, name);
+}
+
+void verse_send_a_block_set(VNodeID node_id, VLayerID buffer_id, uint32 block_index, VNABlockType type, const VNABlock *samples)
+{
+	switch(type)
+	{
+	case VN_A_BLOCK_INT8:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'B', VN_A_BLOCK_SIZE_INT8, samples->vint8);
+		break;
+	case VN_A_BLOCK_INT16:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'H', VN_A_BLOCK_SIZE_INT16, samples->vint16);
+		break;
+	case VN_A_BLOCK_INT24:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'I', VN_A_BLOCK_SIZE_INT24, samples->vint24);
+		break;
+	case VN_A_BLOCK_INT32:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'I', VN_A_BLOCK_SIZE_INT32, samples->vint32);
+		break;
+	case VN_A_BLOCK_REAL32:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'f', VN_A_BLOCK_SIZE_REAL32, samples->vreal32);
+		break;
+	case VN_A_BLOCK_REAL64:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'r', VN_A_BLOCK_SIZE_REAL64, samples->vreal64);
+		break;
+	default:
+		record(OP_A_BLOCK_SET, node_id, buffer_id, block_index, type, 'b', 0, NULL);
+	}
+}
+
+#else	/* STANDALONE */
+
+/* ----------------------------------------------------------------------------------------- */
+
+static int get_number(FILE *in, void *value, size_t size)
+{
+	uint8	buf[8];
+
+	if(fread(buf, size, 1, in) != 1)
+		return 0;
+	order_bytes(value, buf, size);
+	return 1;
+}
+
+static int print_string(FILE *in)
+{
+	uint16	len;
+	int	c;
+
+	if(!get_number(in, &len, sizeof len))
+		return 0;
+	if(len == 0xffff)
+	{
+		printf("(null)");
+		return 1;
+	}
+	putchar('"');
+	for(; len > 0; len--)
+	{
+		if((c = getc(in)) == EOF)
+			return 0;
+		if(c == '"' || c == '\\')
+			putchar('\\');
+		putchar(c);
+	}
+	putchar('"');
+	return 1;
+}
+
+static int print_value(FILE *in, char format);
+
+static int print_array(FILE *in)
+{
+	int	elem;
+	uint32	count, i;
+
+	if((elem = getc(in)) == EOF || !get_number(in, &count, sizeof count))
+		return 0;
+	putchar('[');
+	for(i = 0; i < count; i++)
+	{
+		if(i > 0)
+			putchar(' ');
+		if(!print_value(in, elem))
+			return 0;
+	}
+	putchar(']');
+	return 1;
+}
+
+static int print_value(FILE *in, char format)
+{
+	switch(format)
+	{
+	case 'b':
+	case 'B':
+		{
+			int	c;
+
+			if((c = getc(in)) == EOF)
+				return 0;
+			printf("%d", format == 'B' ? (int) (int8) c : c);
+		}
+		return 1;
+	case 'h':
+	case 'H':
+		{
+			uint16	v;
+
+			if(!get_number(in, &v, sizeof v))
+				return 0;
+			printf("%d", format == 'H' ? (int) (int16) v : (int) v);
+		}
+		return 1;
+	case 'i':
+	case 'I':
+		{
+			uint32	v;
+
+			if(!get_number(in, &v, sizeof v))
+				return 0;
+			if(format == 'I')
+				printf("%ld", (long) (int32) v);
+			else
+				printf("%lu", (unsigned long) v);
+		}
+		return 1;
+	case 'f':
+		{
+			real32	v;
+
+			if(!get_number(in, &v, sizeof v))
+				return 0;
+			printf("%.9g", v);
+		}
+		return 1;
+	case 'r':
+		{
+			real64	v;
+
+			if(!get_number(in, &v, sizeof v))
+				return 0;
+			printf("%.17g", v);
+		}
+		return 1;
+	case 's':
+		return print_string(in);
+	case 'a':
+		return print_array(in);
+	case 'v':
+		{
+			int	count, i, f;
+
+			if((count = getc(in)) == EOF)
+				return 0;
+			putchar('{');
+			for(i = 0; i < count; i++)
+			{
+				if(i > 0)
+					putchar(' ');
+				if((f = getc(in)) == EOF || !print_value(in, f))
+					return 0;
+			}
+			putchar('}');
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Print the log in <in> as text, one command per line. Returns 0 if the log is damaged. */
+static int print_log(FILE *in)
+{
+	char		magic[5];
+	const char	*f;
+	int		op;
+
+	if(fread(magic, sizeof magic, 1, in) != 1 || memcmp(magic, STUB_MAGIC, 4) != 0 || magic[4] != STUB_VERSION)
+		return 0;
+	while((op = getc(in)) != EOF)
+	{
+		if(op <= 0 || op >= OP_COUNT)
+			return 0;
+		printf("%s", stub_op[op].name);
+		for(f = stub_op[op].format; *f != '\0'; f++)
+		{
+			putchar(' ');
+			if(!print_value(in, *f))
+				return 0;
+		}
+		putchar('\n');
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE	*in;
+	int	i, ret = EXIT_SUCCESS;
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s LOGFILE...\nPrints command logs written by the loader's Verse stub as text.\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for(i = 1; i < argc; i++)
+	{
+		if((in = fopen(argv[i], "rb")) == NULL)
+		{
+			fprintf(stderr, "stubdump: Couldn't open \"%s\" for reading\n", argv[i]);
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		if(!print_log(in))
+		{
+			fprintf(stderr, "stubdump: \"%s\" is not a complete stub log\n", argv[i]);
+			ret = EXIT_FAILURE;
+		}
+		fclose(in);
+	}
+	return ret;
+}
+
+#endif	/* STANDALONE */
@@ -0,0 +1,191 @@
+/*
+ * Reading of VMLB files, VML with bulk data stored as binary sections. See vmlb.h for the format.
+ * The sections are used straight from the loaded file's buffer, which the tree built from it owns.
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "list.h"
+#include "mem.h"
+
+#include "vmlb.h"
+
+#define	INDEX_ENTRY_SIZE	24
+#define	TRAILER_SIZE		24
+
+#define	PAD(n)	(((n) + 7) & ~(size_t) 7)
+
+/* A registered file. The text part covers the VML text, which is where attribute values are. */
+typedef struct
+{
+	const char		*text;
+	size_t			text_size;
+	const unsigned char	*index;
+	unsigned long		count;
+} VmlbFile;
+
+static List	*files = NULL;
+
+/* ----------------------------------------------------------------------------------------- */
+
+static void get_native(void *out, const unsigned char *p, size_t size)
+{
+	static const unsigned short	probe = 1;
+	size_t				i;
+
+	if(*(const unsigned char *) &probe == 1)
+		memcpy(out, p, size);
+	else
+	{
+		for(i = 0; i < size; i++)
+			((unsigned char *) out)[i] = p[size - 1 - i];
+	}
+}
+
+unsigned int vmlb_uint16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+unsigned int vmlb_uint32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+float vmlb_real32(const unsigned char *p)
+{
+	float	x;
+
+	get_native(&x, p, sizeof x);
+	return x;
+}
+
+double vmlb_real64(const unsigned char *p)
+{
+	double	x;
+
+	get_native(&x, p, sizeof x);
+	return x;
+}
+
+/* Read an offset or size. The high half is shifted in twice, which is harmless where size_t has
+ * only 32 bits; the caller's range checks then catch any value that didn't fit.
+*/
+static size_t get_size(const unsigned char *p)
+{
+	return vmlb_uint32(p) + ((size_t) vmlb_uint32(p + 4) << 16 << 16);
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+int vmlb_register(const char *buffer, size_t size)
+{
+	const unsigned char	*base = (const unsigned char *) buffer, *trailer, *entry;
+	size_t			index, offset, length, text_size;
+	unsigned long		count, i;
+	VmlbFile		*file;
+
+	if(buffer == NULL || size < TRAILER_SIZE)
+		return 0;
+	trailer = base + size - TRAILER_SIZE;
+	if(memcmp(trailer + 16, "VMLB", 4) != 0)
+		return 0;
+	if(vmlb_uint32(trailer + 20) != VMLB_VERSION)
+	{
+		fprintf(stderr, "loader: Unsupported VMLB version %u\n", vmlb_uint32(trailer + 20));
+		return -1;
+	}
+	index = get_size(trailer);
+	count = vmlb_uint32(trailer + 8);
+	if(index > size - TRAILER_SIZE || count > (size - TRAILER_SIZE - index) / INDEX_ENTRY_SIZE || memchr(buffer, '\0', index) == NULL)
+	{
+		fprintf(stderr, "loader: Damaged VMLB index\n");
+		return -1;
+	}
+	text_size = strlen(buffer);
+	for(i = 0, entry = base + index; i < count; i++, entry += INDEX_ENTRY_SIZE)
+	{
+		offset = get_size(entry + 8);
+		length = get_size(entry + 16);
+		if(offset <= text_size || offset > index || length > index - offset)
+		{
+			fprintf(stderr, "loader: VMLB section %lu is out of bounds\n", i);
+			return -1;
+		}
+	}
+	file = mem_alloc(sizeof *file);
+	file->text = buffer;
+	file->text_size = text_size;
+	file->index = base + index;
+	file->count = count;
+	files = list_prepend(files, file);
+	return 1;
+}
+
+void vmlb_forget(void)
+{
+	List	*iter;
+
+	for(iter = files; iter != NULL; iter = list_next(iter))
+		mem_free(list_data(iter));
+	list_destroy(files);
+	files = NULL;
+}
+
+int vmlb_section_get(const char *value, VmlbKind kind, VmlbSection *section)
+{
+	const List		*iter;
+	const VmlbFile		*file;
+	const unsigned char	*entry;
+	unsigned long		n;
+	char			*end;
+
+	if(value == NULL)
+		return 0;
+	for(iter = files; iter != NULL; iter = list_next(iter))
+	{
+		file = list_data(iter);
+		if(value >= file->text && value < file->text + file->text_size)
+			break;
+	}
+	if(iter == NULL)
+	{
+		fprintf(stderr, "loader: Section reference \"%s\" outside of a VMLB file\n", value);
+		return 0;
+	}
+	n = strtoul(value, &end, 10);
+	if(end == value || *end != '\0' || n >= file->count)
+	{
+		fprintf(stderr, "loader: Reference to unknown VMLB section \"%s\"\n", value);
+		return 0;
+	}
+	entry = file->index + n * INDEX_ENTRY_SIZE;
+	if(vmlb_uint32(entry) != (unsigned int) kind)
+	{
+		fprintf(stderr, "loader: VMLB section %lu is of kind %u, expected %d\n", n, vmlb_uint32(entry), kind);
+		return 0;
+	}
+	section->kind  = kind;
+	section->count = vmlb_uint32(entry + 4);
+	section->data  = (const unsigned char *) file->text + get_size(entry + 8);
+	section->size  = get_size(entry + 16);
+	section->used  = 0;
+	return 1;
+}
+
+const unsigned char * vmlb_array(VmlbSection *section, size_t num, size_t size)
+{
+	const unsigned char	*here = section->data + section->used;
+	size_t			left = section->size - section->used;
+
+	if(size > 0 && num > left / size)
+		return NULL;
+	size *= num;
+	section->used += PAD(size) < left ? PAD(size) : left;
+	return here;
+}
@@ -0,0 +1,77 @@
+/*
+ * Header file for the loader's reader of VMLB, the binary companion format to VML.
+ *
+ * A VMLB file is an ordinary VML document, in which the bulk data of some elements has been
+ * replaced by a reference to a binary section stored after the document. These elements are
+ * left empty, but have a "section" attribute giving the section's number:
+ *
+ *	<layer-vertex-xyz name="vertex" section="0"/>
+ *
+ * The file looks like this, with all integers and reals stored little-endian, reals in IEEE 754
+ * format, and "pad" meaning zero bytes up to the next multiple of 8 bytes from the file start:
+ *
+ *	VML text, NUL, pad		Since the text comes first, the file is parsed like any other.
+ *	sections			Each starts padded, and consists of one or more arrays, each
+ *					padded; see VmlbKind for what arrays the different kinds hold.
+ *	index				One 24-byte entry per section: uint32 kind, uint32 count (of
+ *					elements), uint64 offset (from file start), uint64 size.
+ *	trailer				24 bytes: uint64 index offset, uint32 number of sections,
+ *					uint32 zero, "VMLB", uint32 version (1).
+ *
+ * Written by Emil Brink, Copyright (c) PDC, KTH. This code is licensed under
+ * the GPL license, see the COPYING.loader file for details.
+*/
+
+#include <stddef.h>
+
+#define	VMLB_VERSION	1
+
+/* The kinds of sections, and the arrays they hold for <count> elements. The type of the values
+ * follows from the element that refers to the section, e.g. "layer-vertex-xyz" or "buffer-int16".
+ * Vertices and audio blocks are sparse, so they carry their indices; polygons are numbered from 0.
+*/
+typedef enum
+{
+	VMLB_VERTEX = 1,	/* uint32 index[count], value[count * components]. */
+	VMLB_POLYGON,		/* value[count * components]. */
+	VMLB_TILES,		/* uint16 xyz[count * 3], pixels[count * 64], or uint8 bits[count * 8] for 1-bit layers. */
+	VMLB_BLOCKS,		/* uint32 index[count], samples[count * block size], 24-bit samples stored in 32 bits. */
+	VMLB_KEYS		/* real64 pos[count], then real64 pre_value, value, post_value, and uint32 pre_pos,
+				 * post_pos, each [count * dimensions].
+				*/
+} VmlbKind;
+
+typedef struct
+{
+	VmlbKind		kind;
+	unsigned long		count;
+	const unsigned char	*data;
+	size_t			size;
+	size_t			used;		/* Bytes handed out by vmlb_array(). */
+} VmlbSection;
+
+/* Check if <buffer>, holding a whole file of <size> bytes as loaded for parsing in place, is a VMLB
+ * file, and if so remember its sections for vmlb_section_get(). Returns 1 for VMLB, 0 for other
+ * files, and -1 (after reporting it) for a VMLB file that is damaged and should not be loaded.
+*/
+extern int			vmlb_register(const char *buffer, size_t size);
+
+/* Forget all registered files. Do this before releasing their buffers. */
+extern void			vmlb_forget(void);
+
+/* Look up the section named by <value>, the value of a "section" attribute in a tree built in-situ
+ * from a registered buffer; the attribute's location tells which file it belongs to. Returns 1 and
+ * fills in <section> if found and of the expected <kind>, else 0.
+*/
+extern int			vmlb_section_get(const char *value, VmlbKind kind, VmlbSection *section);
+
+/* Return the next array of <num> values of <size> bytes each in <section>, or NULL if the section
+ * is too short to hold it.
+*/
+extern const unsigned char *	vmlb_array(VmlbSection *section, size_t num, size_t size);
+
+/* Decode single little-endian values. */
+extern unsigned int		vmlb_uint16(const unsigned char *p);
+extern unsigned int		vmlb_uint32(const unsigned char *p);
+extern float			vmlb_real32(const unsigned char *p);
+extern double			vmlb_real64(const unsigned char *p);
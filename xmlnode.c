@@ -12,10 +12,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "dynstr.h"
+#include "hash.h"
 #include "list.h"
 #include "log.h"
 #include "mem.h"
+#include "strutil.h"
 
 #include "xmlnode.h"
 
@@ -25,29 +28,225 @@ typedef enum { COMMENT, TAG, TAGEMPTY, TEXT, ERROR } TokenStatus;
 
 typedef struct
 {
-	const char	*name;
+	XmlAtom		name;
 	const char	*value;
 } Attrib;
 
+/* Per-document bookkeeping. Parsing is done in-situ, so all strings in a tree point into the
+ * source buffer(s), which are owned by the document. Nodes and attributes are allocated from
+ * the document's arena, so tearing down a tree is just a matter of freeing the buffers and
+ * the arena. The document itself lives in the arena, too.
+*/
+typedef struct Include	Include;
+
+/* Runs <func> on an array of items, possibly in parallel. See xmlnode_set_include_jobs(). */
+typedef void	(*IncludeRun)(void *items, size_t num, size_t size, void (*func)(void *item, void *user), void *user, unsigned int threads);
+
+typedef struct
+{
+	XmlNode		*root;
+	List		*buffers;	/* Main source buffer, plus any loaded for xi:include. */
+	List		*subdocs;	/* Documents holding included trees that were parsed separately. */
+	Arena		*arena;
+	XmlNode		**stack;	/* Scratch space for children of open elements, while parsing. */
+	size_t		stack_len, stack_size;
+	char *		(*loader)(const char *uri, void *user);	/* For xi:include, while parsing. */
+	void		*loader_user;
+	IncludeRun	include_run;	/* If non-NULL, xi:includes are deferred and done through this. */
+	unsigned int	include_threads;
+	Include		*include;	/* Deferred xi:includes, in document order. */
+	size_t		include_num, include_size;
+	Hash		*atoms;		/* Names seen while parsing, when parsing in parallel. See doc_atom(). */
+} XmlDoc;
+
+/* An xi:include whose resource is parsed into a document of its own, once the including
+ * document is done. The tree then replaces the xi:include element.
+*/
+struct Include
+{
+	XmlNode		*node;		/* The xi:include element itself. */
+	const char	*href;
+	char *		(*loader)(const char *uri, void *user);
+	void		*loader_user;
+	XmlDoc		*doc;		/* Document holding the included tree, when parsed. */
+};
+
+#define	DOC_ARENA_SIZE	(16 << 10)
+
 struct XmlNode
 {
-	const char	*element;
+	XmlAtom		atom;		/* Element name. */
 	char		*text;
 	size_t		attrib_num;	/* Number of attributes. */
 	Attrib		*attrib;
 	XmlNode		*parent;
-	List		*children;
+	size_t		child_num;
+	XmlNode		**children;	/* Contiguous, in document order. */
 	void		*user;
+	XmlDoc		*doc;
 };
 
+/* Parser state. Since text tokens are terminated in-place, the '<' that ends a text might
+ * have to be overwritten by the terminator; <open> remembers that a tag starts at <pos>.
+ * When streaming from a file, <buf> is a window holding at least the next complete token.
+*/
+typedef struct
+{
+	XmlDoc		*doc;
+	char		*pos;
+	int		open;
+	FILE		*in;		/* Non-NULL when streaming. */
+	char		*buf;
+	size_t		size, fill;
+	int		eof;
+	Arena		*scratch;	/* Attributes of event-parsed elements, cleared per element. */
+} Parser;
+
+#define	STREAM_WINDOW	(64 << 10)
+
+/* Names of open elements, for checking the nesting while event-parsing. NUL-separated. */
+typedef struct
+{
+	char		*buf;
+	size_t		len, size;
+} NameStack;
+
 static char * simple_loader(const char *uri, void *user);
 
+/* The table of interned names. The hash maps names to atoms, and the names of atoms are kept in
+ * fixed-size blocks that never move once allocated, so they can be read without the shared lock.
+*/
+#define	ATOM_BLOCK	256
+#define	ATOM_BLOCKS	1024
+
+static struct
+{
+	Hash		*hash;
+	Arena		*arena;		/* Holds the name strings. */
+	const char	**name[ATOM_BLOCKS];
+	size_t		num;
+} Atoms = { NULL, NULL, { NULL }, 1 };
+
 static struct
 {
 	char *	(*loader)(const char *uri, void *user);
 	void	*user;
 } LoaderInfo = { simple_loader, NULL };
 
+static struct
+{
+	IncludeRun	run;
+	unsigned int	threads;
+} IncludeJobs = { NULL, 0 };
+
+/* Optional lock around state shared between documents, for building trees in several threads. */
+static struct
+{
+	void	(*lock)(void *user);
+	void	(*unlock)(void *user);
+	void	*user;
+} LockInfo = { NULL, NULL, NULL };
+
+#define	SHARED_LOCK()	do { if(LockInfo.lock != NULL) LockInfo.lock(LockInfo.user); } while(0)
+#define	SHARED_UNLOCK()	do { if(LockInfo.unlock != NULL) LockInfo.unlock(LockInfo.user); } while(0)
+
+/* ----------------------------------------------------------------------------------------- */
+
+static XmlAtom atom_find(const char *name)
+{
+	if(Atoms.hash == NULL)
+		return XMLNODE_ATOM_NONE;
+	return (XmlAtom) (size_t) hash_lookup(Atoms.hash, name);
+}
+
+static XmlAtom atom_intern(const char *name)
+{
+	size_t	len;
+	char	*copy;
+	XmlAtom	atom;
+
+	if((atom = atom_find(name)) != XMLNODE_ATOM_NONE)
+		return atom;
+	if(Atoms.hash == NULL)
+	{
+		Atoms.hash  = hash_new_string();
+		Atoms.arena = arena_new(4 << 10);
+	}
+	if(Atoms.num >= ATOM_BLOCKS * ATOM_BLOCK)
+		return XMLNODE_ATOM_NONE;
+	if(Atoms.name[Atoms.num / ATOM_BLOCK] == NULL)
+	{
+		const char	**nb;
+		size_t		i;
+
+		if((nb = mem_alloc(ATOM_BLOCK * sizeof *nb)) == NULL)
+			return XMLNODE_ATOM_NONE;
+		for(i = 0; i < ATOM_BLOCK; i++)
+			nb[i] = NULL;		/* Including XMLNODE_ATOM_NONE's, which has no name. */
+		Atoms.name[Atoms.num / ATOM_BLOCK] = nb;
+	}
+	len = strlen(name) + 1;
+	if((copy = arena_alloc(Atoms.arena, len)) == NULL)
+		return XMLNODE_ATOM_NONE;
+	memcpy(copy, name, len);
+	atom = Atoms.num++;
+	Atoms.name[atom / ATOM_BLOCK][atom % ATOM_BLOCK] = copy;
+	hash_insert(Atoms.hash, copy, (void *) (size_t) atom);
+	return atom;
+}
+
+XmlAtom xmlnode_atom(const char *name)
+{
+	XmlAtom	atom;
+
+	if(name == NULL)
+		return XMLNODE_ATOM_NONE;
+	SHARED_LOCK();
+	atom = atom_intern(name);
+	SHARED_UNLOCK();
+	return atom;
+}
+
+XmlAtom xmlnode_atom_find(const char *name)
+{
+	XmlAtom	atom;
+
+	if(name == NULL)
+		return XMLNODE_ATOM_NONE;
+	SHARED_LOCK();
+	atom = atom_find(name);
+	SHARED_UNLOCK();
+	return atom;
+}
+
+/* No locking here: an atom is only known once its name has been stored, and names never move. */
+const char * xmlnode_atom_name(XmlAtom atom)
+{
+	const char	**block;
+
+	if(atom == XMLNODE_ATOM_NONE || atom >= ATOM_BLOCKS * ATOM_BLOCK || (block = Atoms.name[atom / ATOM_BLOCK]) == NULL)
+		return NULL;
+	return block[atom % ATOM_BLOCK];
+}
+
+/* Intern <name> for a document being parsed. With the shared lock in use, names are first looked
+ * up in the document's own table, which only its parsing thread touches, so the shared table is
+ * visited (and the lock taken) once per distinct name and document, rather than once per element
+ * and attribute.
+*/
+static XmlAtom doc_atom(XmlDoc *doc, const char *name)
+{
+	XmlAtom	atom;
+
+	if(doc == NULL || doc->atoms == NULL || name == NULL)
+		return xmlnode_atom(name);
+	if((atom = (XmlAtom) (size_t) hash_lookup(doc->atoms, name)) != XMLNODE_ATOM_NONE)
+		return atom;
+	if((atom = xmlnode_atom(name)) != XMLNODE_ATOM_NONE)
+		hash_insert(doc->atoms, xmlnode_atom_name(atom), (void *) (size_t) atom);
+	return atom;
+}
+
 /* ----------------------------------------------------------------------------------------- */
 
 static char * simple_loader(const char *uri, void *user)
@@ -72,14 +271,25 @@ void xmlnode_set_loader(char * (*loader)(const char *uri, void *user), void *use
 	LoaderInfo.user = user;
 }
 
-/* ----------------------------------------------------------------------------------------- */
+void xmlnode_set_include_jobs(IncludeRun run, unsigned int threads)
+{
+	IncludeJobs.run = run;
+	IncludeJobs.threads = threads;
+}
 
-#define	TOKEN_STATUS_RETURN(s, r)	*status = s; return r;
+void xmlnode_set_lock(void (*lock)(void *user), void (*unlock)(void *user), void *user)
+{
+	LockInfo.lock   = lock;
+	LockInfo.unlock = unlock;
+	LockInfo.user   = user;
+}
+
+/* ----------------------------------------------------------------------------------------- */
 
-/* Look up entity (on the form &ENTITY;) from start of <buffer>, and append the corresponding
- * actual text to <token>. Returns pointer to first char of <buffer> past entity.
+/* Look up entity (on the form &ENTITY;) at the start of <buffer>. If known, store the actual
+ * character in <c> and return the length of the entity, else return 0.
 */
-static const char * append_entity(const char *buffer, DynStr *token)
+static size_t entity_decode(const char *buffer, char *c)
 {
 	static const struct
 	{
@@ -93,392 +303,474 @@ static const char * append_entity(const char *buffer, DynStr *token)
 	{
 		if(strncmp(buffer, entity[i].entity, entity[i].len) == 0)
 		{
-			dynstr_append_c(token, entity[i].replace);
-			return buffer + entity[i].len;
+			*c = entity[i].replace;
+			return entity[i].len;
 		}
 	}
-	return buffer;
+	return 0;
 }
 
-/* Parse off a "token" from <buffer>, storing it in <token> which is created if necessary.
- * A token is simply either a tag, or some text. Uses <status> to report the type of the
- * token, angle brackets are stripped from tags. Returns new buffer pointer.
-*/
-static const char * token_get(const char *buffer, DynStr **token, TokenStatus *status)
+/* Trim leading and trailing whitespace off the in-situ string <start>, which ends at <end>. */
+static char * text_trim(char *start, char *end)
 {
-	TokenStatus	dummy;
-	DynStr		*d;
+	while(start < end && isspace((unsigned char) *start))
+		start++;
+	while(end > start && isspace((unsigned char) end[-1]))
+		end--;
+	*end = '\0';
+	return start;
+}
 
-	if(buffer == NULL || token == NULL)
-		return NULL;
-	if(status == NULL)
-		status = &dummy;	/* No need to check it, now. */
+/* Parse off a "token" from the parser's buffer, setting <token> to point at it. A token is simply
+ * either a tag, or some text. Returns the type of the token. Angle brackets are stripped from tags,
+ * entities are decoded and texts are trimmed; all in-place, by writing into the buffer.
+*/
+static TokenStatus token_get(Parser *p, char **token)
+{
+	char	*buffer = p->pos, *put;
 
-	if(*buffer == '<')
+	if(p->open || *buffer == '<')
 	{
-		char	here, last = 0;
 		int	in_str = 0;
 
-		if((d = *token) == NULL)
-			d = dynstr_new_sized(32);
+		p->open = 0;
 		if(buffer[1] == '!')
 		{
 			buffer += 2;
 			if(strncmp(buffer, "[CDATA[", 7) == 0)	/* CDATA section detected, extract and return as text. */
 			{
-				const char	*eptr;
+				char	*eptr;
+				size_t	len;
 
 				buffer += 7;
-				*status = TEXT;
 				if((eptr = strstr(buffer, "]]>")) == NULL)
 				{
-					dynstr_destroy(d, 1);
 					LOG_ERR(("Unterminated CDATA directive, aborting"));
-					*status = ERROR;
-					return buffer;
+					return ERROR;
 				}
-				while(*buffer && buffer < eptr)
+				*token = put = buffer;
+				while(buffer < eptr)
 				{
-					if(*buffer == '&')
+					if(*buffer == '&' && (strncmp(buffer, "&gt;", 4) == 0 || strncmp(buffer, "&amp;", 5) == 0))
 					{
-						if(strncmp(buffer, "&gt;", 4) == 0)	/* Bare-bones "entity support". */
-						{
-							dynstr_append_c(d, '>');
-							buffer += 4;
-							continue;
-						}
-						else if(strncmp(buffer, "&amp;", 4) == 0)
-						{
-							dynstr_append_c(d, '&');
-							buffer += 5;
-							continue;
-						}
+						len = entity_decode(buffer, put++);	/* Bare-bones "entity support". */
+						buffer += len;
 					}
-					dynstr_append_c(d, *buffer++);
+					else
+						*put++ = *buffer++;
 				}
-				if(strncmp(buffer, "]]>", 3) == 0)
-					buffer += 3;
+				p->pos = eptr + 3;
+				*token = text_trim(*token, put);
+				return TEXT;
 			}
 			else if(strncmp(buffer, "--", 2) == 0)
 			{
-				buffer += 2;
-				while(*buffer && strncmp(buffer, "--", 2) != 0)
-					dynstr_append_c(d, *buffer++);
-				buffer += 2;
-				if(*buffer != '>')
+				if((buffer = strstr(buffer + 2, "--")) == NULL || buffer[2] != '>')
 				{
-					LOG_ERR(("Parse error in comment, expected '>' after double dash, found '%c'", *buffer));
-					*status = ERROR;
-					dynstr_destroy(d, 1);
-					*token = NULL;
-					return buffer;
+					LOG_ERR(("Parse error in comment, expected '>' after double dash"));
+					return ERROR;
 				}
-				buffer++;
-				*status = COMMENT;
-			}
-			else
-			{
-				dynstr_destroy(d, 1);
-				LOG_ERR(("Unknown XML directive starting %c%c%c%c%c, aborting", buffer[0], buffer[1], buffer[2], buffer[3], buffer[4]));
-				*status = ERROR;
-				return buffer;
+				*token = NULL;
+				p->pos = buffer + 3;
+				return COMMENT;
 			}
-			*token = d;
-			return buffer;
+			LOG_ERR(("Unknown XML directive starting %c%c%c%c%c, aborting", buffer[0], buffer[1], buffer[2], buffer[3], buffer[4]));
+			return ERROR;
 		}
-
-		for(buffer++; *buffer; last = here)
+		for(put = ++buffer; *put != '\0'; put++)
 		{
-			here = *buffer++;
-			if(here == '\n' || here == '\t' || here == '\r')
-				here = ' ';
-			if(!in_str && (here == ' ' && last == ' '))
-				continue;
-			if((in_str && (here == '<' || here == '>')) || here == '<')
+			if(*put == '<')
 			{
 				LOG_ERR(("Bracket in string not legal, use entities"));
-				*status = ERROR;
-				return buffer;
+				return ERROR;
 			}
-			else if(!in_str && here == '>')
+			else if(!in_str && *put == '>')
 				break;
-			else if(here == '&')
-			{
-				const char	*b2 = append_entity(buffer - 1, d);
-				if(b2 > buffer)
-				{
-					buffer = b2;
-					continue;
-				}
-			}
-			dynstr_append_c(d, here);
-			if(!in_str && (here == '\'' || here == '"'))
-				in_str = here;
-			else if(in_str && (here == in_str))
+			else if(!in_str && (*put == '\'' || *put == '"'))
+				in_str = *put;
+			else if(in_str && *put == in_str)
 				in_str = 0;
 		}
-		if(last != '/')
-			*status = TAG;
-		else
+		if(*put == '\0')
+		{
+			LOG_ERR(("Unterminated tag, aborting"));
+			return ERROR;
+		}
+		*put = '\0';
+		p->pos = put + 1;
+		*token = buffer;
+		if(put > buffer && put[-1] == '/')
 		{
-			dynstr_truncate(d, dynstr_length(d) - 1);
-			*status = TAGEMPTY;
+			put[-1] = '\0';
+			return TAGEMPTY;
 		}
-		*token = d;
-		return buffer;
+		return TAG;
 	}
-	else	/* Load some text. */
+	/* Load some text. Entities only ever make it shorter, so decoding can be done in-place. */
+	for(*token = put = buffer; *buffer != '\0' && *buffer != '<';)
 	{
-		if((d = *token) == NULL)
-			d = dynstr_new_sized(16);
-		for(; *buffer;)
+		if(*buffer == '&')
 		{
-			char	here = *buffer;
+			size_t	len;
 
-			if(here == '<')
-				break;
-			else if(here == '&')
+			if((len = entity_decode(buffer, put)) > 0)
 			{
-				const char	*b2 = append_entity(buffer, d);
-				if(b2 > buffer)
-				{
-					buffer = b2;
-					continue;
-				}
+				buffer += len;
+				put++;
+				continue;
 			}
-			dynstr_append_c(d, here);
-			buffer++;
 		}
-		*token  = d;
-		*status = TEXT;
-		return buffer;
+		if(put != buffer)
+			*put = *buffer;
+		put++;
+		buffer++;
 	}
-	return NULL;
+	if(*buffer == '<' && put == buffer)
+		p->open = 1;	/* Terminator goes where the '<' was, remember it. */
+	p->pos = buffer;
+	*token = text_trim(*token, put);
+	return TEXT;
 }
 
-/* ----------------------------------------------------------------------------------------- */
+static void parser_init(Parser *p, XmlDoc *doc, char *buffer)
+{
+	p->doc     = doc;
+	p->pos     = buffer;
+	p->open    = 0;
+	p->in      = NULL;
+	p->buf     = buffer;
+	p->size    = p->fill = 0;
+	p->eof     = 1;
+	p->scratch = NULL;
+}
 
-/* A qsort() comparison callback for attribute name ordering. */
-static int cmp_attr(const void *a, const void *b)
+/* Check if the parser's window holds all of the next token. Tags and directives must have their
+ * terminators, texts must be followed by the start of a tag. Everything up to the end of the window
+ * after <pos> is still untouched, except the '<' that might have been overwritten (see <open>).
+*/
+static int token_complete(const Parser *p)
 {
-	const Attrib	*aa = a, *ab = b;
+	const char	*s = p->pos, *end = p->buf + p->fill;
+	int		in_str = 0;
+
+	if(!p->open && *s != '<')
+		return s < end && strchr(s, '<') != NULL;
+	if(end - s < 9)
+		return 0;
+	if(s[1] == '!')
+	{
+		if(strncmp(s + 2, "[CDATA[", 7) == 0)
+			return strstr(s + 9, "]]>") != NULL;
+		else if(strncmp(s + 2, "--", 2) == 0)
+		{
+			if((s = strstr(s + 4, "--")) == NULL)
+				return 0;
+			return s[2] != '\0';
+		}
+	}
+	for(s++; *s != '\0'; s++)
+	{
+		if(!in_str && *s == '>')
+			return 1;
+		else if(!in_str && (*s == '\'' || *s == '"'))
+			in_str = *s;
+		else if(in_str && *s == in_str)
+			in_str = 0;
+	}
+	return 0;
+}
+
+/* Slide the unparsed part of the window to the front, and read more of the file in after it. */
+static int parser_fill(Parser *p)
+{
+	size_t	keep = p->fill - (size_t) (p->pos - p->buf), got;
+
+	memmove(p->buf, p->pos, keep);
+	p->pos  = p->buf;
+	p->fill = keep;
+	if(p->size - p->fill < p->size / 2)	/* Token is large, grow window. */
+	{
+		char	*nb;
 
-	return strcmp(aa->name, ab->name);
+		if((nb = mem_realloc(p->buf, 2 * p->size)) == NULL)
+		{
+			LOG_ERR(("Failed to grow XML parse window to %u bytes", (unsigned int) (2 * p->size)));
+			return 0;
+		}
+		p->buf = p->pos = nb;
+		p->size *= 2;
+	}
+	got = fread(p->buf + p->fill, 1, p->size - 1 - p->fill, p->in);
+	p->fill += got;
+	p->buf[p->fill] = '\0';
+	if(got == 0)
+	{
+		if(ferror(p->in))
+		{
+			LOG_ERR(("Read error in XML input stream"));
+			return 0;
+		}
+		p->eof = 1;
+	}
+	return 1;
+}
+
+/* Make sure the next token is all in the buffer, reading more if streaming. Returns 0 on error. */
+static int parser_ensure(Parser *p)
+{
+	while(!p->eof && !token_complete(p))
+	{
+		if(!parser_fill(p))
+			return 0;
+	}
+	return 1;
 }
 
-/* FIXME: This function is way too long. Could be refactored, some day. */
-static Attrib * attribs_build(const char *token, size_t *attrib_num)
+/* ----------------------------------------------------------------------------------------- */
+
+/* Build attribute vector from <src>, the part of a tag following the element name. This works
+ * in-place: names are lower-cased and interned, values are decoded and terminated no later than
+ * where their closing quote was, and the vector points into <src>.
+*/
+static Attrib * attribs_build(XmlDoc *doc, Arena *arena, char *src, size_t *attrib_num)
 {
-	size_t		num = 0, name_size = 0, value_size = 0;
-	const char	*src = token;
+	size_t	num = 0, i;
+	char	*get, *put, quot;
+	Attrib	*attr;
 
-	if(token == NULL)
+	if(src == NULL)
 		return NULL;
 
-	while(*src)
+	/* First pass validates, and counts the attributes. */
+	for(get = src; *get;)
 	{
-		while(isspace(*src))
-			src++;
-		if(*src == '\0')
+		while(isspace((unsigned char) *get))
+			get++;
+		if(*get == '\0')
 			break;
-		if(isalpha(*src))
+		if(!isalpha((unsigned char) *get))
 		{
-			while(isalpha(*src) || *src == '-' || *src == '_' || *src == ':')
-			{
-				name_size++;
-				src++;
-			}
-			if(*src == '=')
-			{
-				char	quot;
-
-				src++;
-				quot = *src;
-				if(quot == '\'' || quot == '"')
-				{
-					src++;
-					while(*src && *src != quot)
-					{
-						value_size++;
-						src++;
-					}
-					if(*src == quot)
-						src++;
-					else
-						return NULL;
-					num++;
-				}
-				else
-				{
-					printf("attribute parse error\n");
-					return NULL;
-				}
-			}
-			else
-			{
-				printf("attribute parse error\n");
-				return NULL;
-			}
+			printf("attribute parse error -- '%c' (%u) is not alpha\n", *get, (unsigned int) *get);
+			return NULL;
 		}
-		else
+		while(isalpha((unsigned char) *get) || *get == '-' || *get == '_' || *get == ':')
+			get++;
+		if(get[0] != '=' || (get[1] != '\'' && get[1] != '"'))
 		{
-			printf("attribute parse error -- '%c' (%u) is not alpha\n", *src, (unsigned int) *src);
+			printf("attribute parse error\n");
 			return NULL;
 		}
+		quot = get[1];
+		for(get += 2; *get && *get != quot; get++)
+			;
+		if(*get != quot)
+			return NULL;
+		get++;
+		num++;
 	}
-	if(num > 0 && name_size > 0 && value_size > 0)
-	{
-		Attrib	*attr;
+	if(num == 0 || (attr = arena_alloc(arena, num * sizeof *attr)) == NULL)
+		return NULL;
 
-		if((attr = mem_alloc(num * sizeof *attr + (name_size + value_size + 2 * num))) != NULL)
+	/* Second pass splits and decodes, knowing the syntax is fine. */
+	for(get = src, i = 0; i < num; i++)
+	{
+		while(isspace((unsigned char) *get))
+			get++;
+		for(put = get; *get != '='; get++)
+			*get = tolower((unsigned char) *get);
+		*get = '\0';
+		attr[i].name = doc_atom(doc, put);
+		quot = get[1];
+		attr[i].value = put = get + 2;
+		for(get += 2; *get != quot;)
 		{
-			int	index = 0;
-			char	*put = (char *) (attr + num);
-
-			src = token;
-			while(*src)
+			if(*get == '&')
 			{
-				while(isspace(*src))
-					src++;
-				if(isalpha(*src))
+				size_t	len;
+
+				if((len = entity_decode(get, put)) > 0)
 				{
-					attr[index].name = put;
-					while(isalpha(*src) || *src == '-' || *src == '_' || *src == ':')
-						*put++ = tolower(*src++);
-					*put++ = '\0';
-					if(*src == '=')
-					{
-						char	quot;
-
-						src++;
-						quot = *src;
-						if(quot == '\'' || quot == '"')
-						{
-							src++;
-							attr[index].value = put;
-							while(*src && *src != quot)
-								*put++ = *src++;
-							*put++ = '\0';
-							if(*src == quot)
-								src++;
-							index++;
-						}
-					}
+					get += len;
+					put++;
+					continue;
 				}
 			}
-			qsort(attr, num, sizeof *attr, cmp_attr);
-			*attrib_num = num;
-			return attr;
+			if(*get == '\n' || *get == '\t' || *get == '\r')
+				*put++ = ' ';
+			else
+				*put++ = *get;
+			get++;
 		}
+		*put = '\0';
+		get++;
 	}
-	return NULL;
+	*attrib_num = num;
+	return attr;
 }
 
-/* Create a new node, from the given <token>. If token is NULL, node is anonymous. */
-static XmlNode * node_new(const char *token)
+/* Initialize <node> from the given in-situ <token>, allocating attributes from <arena>. If token
+ * is NULL, node is anonymous.
+*/
+static void node_init(XmlNode *node, XmlDoc *doc, Arena *arena, char *token)
 {
-	size_t	elen = 0;
-	XmlNode	*node;
+	char	*attr = NULL;
 
 	if(token != NULL)
 	{
-		for(; token[elen] && !isspace(token[elen]); elen++)
+		for(attr = token; *attr && !isspace((unsigned char) *attr); attr++)
 			;
-		if(elen > 0)
-			elen++;		/* Count in the terminator. */
+		if(*attr != '\0')
+			*attr++ = '\0';
+		if(*token == '\0')
+			token = NULL;
 	}
-	if((node = mem_alloc(sizeof *node + elen)) != NULL)
+	node->atom       = doc_atom(doc, token);
+	node->text       = NULL;
+	node->attrib_num = 0;
+	node->attrib     = attribs_build(doc, arena, attr, &node->attrib_num);
+	node->parent     = NULL;
+	node->child_num  = 0;
+	node->children   = NULL;
+	node->user       = NULL;
+	node->doc        = NULL;
+}
+
+/* Create a new node, from the given in-situ <token>. If token is NULL, node is anonymous. */
+static XmlNode * node_new(XmlDoc *doc, char *token)
+{
+	XmlNode	*node;
+
+	if((node = arena_alloc(doc->arena, sizeof *node)) != NULL)
 	{
-		if(elen > 0)
-		{
-			char		*put = (char *) (node + 1);
-			unsigned int	i;
+		node_init(node, doc, doc->arena, token);
+		node->doc = doc;
+	}
+	return node;
+}
+
+static char * doc_strdup(XmlDoc *doc, const char *str)
+{
+	char	*dup;
+	size_t	len;
+
+	if(str == NULL)
+		return NULL;
+	len = strlen(str) + 1;
+	if((dup = arena_alloc(doc->arena, len)) != NULL)
+		memcpy(dup, str, len);
+	return dup;
+}
+
+/* Create a new node in <doc> holding copies of the name and attributes of <src>. */
+static XmlNode * node_copy(XmlDoc *doc, const XmlNode *src)
+{
+	XmlNode	*node;
+	size_t	i;
 
-			for(i = 0; i < elen - 1; i++)
-				*put++ = token[i];
-			*put = '\0';
-			node->element  = (const char *) (node + 1);
+	if((node = arena_alloc(doc->arena, sizeof *node)) == NULL)
+		return NULL;
+	*node = *src;
+	node->text    = NULL;
+	node->parent  = NULL;
+	node->doc     = doc;
+	if(src->attrib_num > 0 && (node->attrib = arena_alloc(doc->arena, src->attrib_num * sizeof *node->attrib)) != NULL)
+	{
+		for(i = 0; i < src->attrib_num; i++)
+		{
+			node->attrib[i].name  = src->attrib[i].name;
+			node->attrib[i].value = doc_strdup(doc, src->attrib[i].value);
 		}
-		else
-			node->element = NULL;
-		node->text     = NULL;
-		node->attrib_num = 0;
-		node->attrib   = attribs_build(token ? token + elen - 1 : NULL, &node->attrib_num);
-		node->parent   = NULL;
-		node->children = NULL;
-		node->user     = NULL;
-		return node;
 	}
-	return NULL;
+	return node;
 }
 
-/* Add a <child> node to a <parent>. Thin. */
+/* Add a <child> node to a <parent>. Children are collected on the document's stack while the
+ * parent is open, and moved into a right-sized array in the arena by node_children_close().
+*/
 static void node_child_add(XmlNode *parent, XmlNode *child)
 {
+	XmlDoc	*doc;
+
 	if(parent == NULL || child == NULL)
 		return;
-	/* For performance reasons, we prepend children, then reverse the lists as
-	 * a final step. This is far faster, since the append() operation is O(N)
-	 * while prepend is O(1). This is roughly twice the speed.
-	*/
-	parent->children = list_prepend(parent->children, child);
-	child->parent    = parent;
+	doc = parent->doc;
+	if(doc->stack_len >= doc->stack_size)
+	{
+		size_t	ns = doc->stack_size > 0 ? 2 * doc->stack_size : 256;
+		XmlNode	**nst;
+
+		if((nst = mem_realloc(doc->stack, ns * sizeof *nst)) == NULL)
+		{
+			LOG_ERR(("Failed to grow XML node stack to %u entries, dropping node", (unsigned int) ns));
+			return;
+		}
+		doc->stack = nst;
+		doc->stack_size = ns;
+	}
+	doc->stack[doc->stack_len++] = child;
+	child->parent = parent;
+}
+
+/* Move the children stacked from <base> and up into <parent>'s child array, popping them. */
+static void node_children_close(XmlDoc *doc, XmlNode *parent, size_t base)
+{
+	size_t	num = doc->stack_len - base;
+	XmlNode	**children;
+
+	doc->stack_len = base;
+	if(parent == NULL || num == 0)
+		return;
+	/* Normally a node is closed once, but top-level trailing elements get added to the root. */
+	if((children = arena_alloc(doc->arena, (parent->child_num + num) * sizeof *children)) == NULL)
+		return;
+	if(parent->child_num > 0)
+		memcpy(children, parent->children, parent->child_num * sizeof *children);
+	memcpy(children + parent->child_num, doc->stack + base, num * sizeof *children);
+	parent->children   = children;
+	parent->child_num += num;
 }
 
 /* Add <text> content to a <parent> node. This is a bit weird, since text is not totally symmetrically
  * handled: the first text child of a node is stored directly in the node, unless there are already
  * children added. Otherwise the text will be added as individual XmlNodes.
 */
-static void node_text_add(XmlNode *parent, DynStr *text)
+static void node_text_add(XmlNode *parent, size_t base, char *text)
 {
-	if(parent->text == NULL && parent->children == NULL)
-		parent->text = dynstr_destroy(text, 0);
+	if(parent->text == NULL && parent->child_num == 0 && parent->doc->stack_len == base)
+		parent->text = text;
 	else
 	{
 		XmlNode	*tc;
 
-		tc = node_new(NULL);
-		tc->text = dynstr_destroy(text, 0);
+		tc = node_new(parent->doc, NULL);
+		tc->text = text;
 		node_child_add(parent, tc);
 	}
 }
 
-/* Determine if <tag> is the closing tag for the <parent> node. This means that if <parent>
- * is the element "foo", 1 is returned if <tag> is "/foo" and 0 otherwise.
+/* Determine if <tag> is the closing tag for the element <name>. This means that if <name>
+ * is "foo", 1 is returned if <tag> is "/foo" and 0 otherwise.
 */
-static int node_closes(const XmlNode *parent, const char *tag)
+static int name_closes(const char *src, const char *tag)
 {
-	const char	*src;
-
-	if(parent == NULL || tag == NULL || *tag == '\0' || *tag != '/')
+	if(src == NULL || tag == NULL || *tag == '\0' || *tag != '/')
 		return 0;
-	src = parent->element;
 	tag++;		/* Skip the slash. */
 	for(; *src && *tag && *src == *tag; src++, tag++)
-	{
-		if(isspace(*tag))
-			return 0;
-	}
-	return *src == *tag;
+		;
+	return *src == '\0' && (*tag == '\0' || isspace((unsigned char) *tag));
 }
 
-/* Recursively reverse all child lists, since we use prepend() when
- * constructing the tree. Should be quicker. Done in-place.
-*/
-static void tree_reverse_children(XmlNode *root)
+static int node_closes(const XmlNode *parent, const char *tag)
 {
-	const List	*iter;
-
-	if(root == NULL)
-		return;
-	root->children = list_reverse(root->children);
-	for(iter = root->children; iter != NULL; iter = list_next(iter))
-		tree_reverse_children(list_data(iter));
+	return parent != NULL && name_closes(xmlnode_atom_name(parent->atom), tag);
 }
 
-static XmlNode *	tree_build(XmlNode *parent, const char **buffer, int *complete);
+static XmlNode *	tree_build(Parser *p, XmlNode *parent, int *complete);
+static XmlDoc *		doc_new(char *buffer);
+static void		doc_destroy(XmlDoc *doc);
 
-static XmlNode * do_include(const char *href)
+static XmlNode * do_include(XmlDoc *doc, const char *href)
 {
 	XmlNode		*tree = NULL;
 	char		*buf = NULL;
@@ -490,23 +782,26 @@ static XmlNode * do_include(const char *href)
 		return NULL;
 	}
 
-	/* Ask the registered loader function to retreive the resource. */
-	if((buf = (char *) LoaderInfo.loader(href, LoaderInfo.user)) != NULL)
+	/* Ask the document's loader function to retreive the resource. */
+	buf = doc->loader(href, doc->loader_user);
+	if(buf != NULL)
 	{
-		const char	*parse = buf;
-		/* Don't just call xmlnode_new() here, since that ends up reversing the children,
-		 * which means we would have to re-reverse them to counter the reverse that will
-		 * be done on the final result tree. Rather, build a reversed sub-tree, so that
-		 * the final reverse puts it all right. Should save some cycles.
-		*/
-		tree = tree_build(NULL, &parse, &ok);
-		free(buf);	/* Currently, loaders must return memory that can be free()d. */
+		Parser	sub;
+
+		/* Build the sub-tree right into this document, so it shares the arena. */
+		parser_init(&sub, doc, buf);
+		tree = tree_build(&sub, NULL, &ok);
 		if(tree == NULL || !ok)
 		{
 			LOG_WARN(("Failed to build included tree from \"%s\"--skipping", href));
-			if(tree != NULL)
-				xmlnode_destroy(tree);
-			tree = NULL;
+			tree = NULL;	/* Any nodes stay in the arena until the document dies. */
+			mem_free(buf);	/* Currently, loaders must return memory that can be free()d. */
+		}
+		else	/* The sub-tree points into the buffer, so the document keeps it. */
+		{
+			SHARED_LOCK();
+			doc->buffers = list_prepend(doc->buffers, buf);
+			SHARED_UNLOCK();
 		}
 	}
 	else
@@ -514,11 +809,114 @@ static XmlNode * do_include(const char *href)
 	return tree;
 }
 
-/* Traverse <buffer>, extracting tokens. Build nodes from tokens, and add to <parent> as fit. Recurse. */
-static XmlNode * tree_build(XmlNode *parent, const char **buffer, int *complete)
+/* Remember the xi:include element <node>, to have it replaced by the included tree later. */
+static int include_defer(XmlDoc *doc, XmlNode *node)
+{
+	Include	*inc;
+
+	if(doc->include_num >= doc->include_size)
+	{
+		size_t	ns = doc->include_size > 0 ? 2 * doc->include_size : 64;
+		Include	*ni;
+
+		if((ni = mem_realloc(doc->include, ns * sizeof *ni)) == NULL)
+			return 0;
+		doc->include = ni;
+		doc->include_size = ns;
+	}
+	inc = doc->include + doc->include_num++;
+	inc->node = node;
+	inc->href = xmlnode_attrib_get_value(node, "href");
+	inc->loader = doc->loader;
+	inc->loader_user = doc->loader_user;
+	inc->doc = NULL;
+	return 1;
+}
+
+/* Load and parse a deferred xi:include into a document of its own. Called from include jobs. */
+static void include_job(void *item, void *user)
+{
+	Include	*inc = item;
+	Parser	p;
+	XmlNode	*tree;
+	char	*buf;
+	int	ok;
+
+	if(inc->href == NULL)
+		return;
+	if((buf = inc->loader(inc->href, inc->loader_user)) == NULL)
+		return;
+	if((inc->doc = doc_new(buf)) == NULL)
+	{
+		mem_free(buf);	/* Not owned by any document yet. */
+		return;
+	}
+	inc->doc->loader = inc->loader;		/* Nested includes are done in place, by this job. */
+	inc->doc->loader_user = inc->loader_user;
+	parser_init(&p, inc->doc, buf);
+	tree = tree_build(&p, NULL, &ok);
+	mem_free(inc->doc->stack);
+	inc->doc->stack = NULL;
+	inc->doc->stack_size = 0;
+	hash_destroy(inc->doc->atoms);
+	inc->doc->atoms = NULL;
+	if(tree == NULL || !ok)
+	{
+		doc_destroy(inc->doc);
+		inc->doc = NULL;
+		return;
+	}
+	inc->doc->root = tree;
+}
+
+/* Load and parse all of <doc>'s deferred xi:includes, in parallel if the include jobs function
+ * does that, and then splice each resulting tree into the place of its xi:include element.
+*/
+static void includes_resolve(XmlDoc *doc)
 {
-	DynStr	*token = NULL;
+	const XmlNode	*parent = NULL;
+	size_t		i, j = 0;
+
+	doc->include_run(doc->include, doc->include_num, sizeof *doc->include, include_job, NULL, doc->include_threads);
+	for(i = 0; i < doc->include_num; i++)
+	{
+		Include	*inc = doc->include + i;
+
+		if(inc->href == NULL)
+			LOG_WARN(("Broken xi:include element, missing 'href' attribute--skipping"));
+		if(inc->doc == NULL)
+		{
+			if(inc->href != NULL)
+				LOG_WARN(("Failed to load or build xi:include resource \"%s\"--skipping", inc->href));
+			continue;
+		}
+		/* Includes are in document order, so siblings are found by scanning on from the last. */
+		if(inc->node->parent != parent)
+		{
+			parent = inc->node->parent;
+			j = 0;
+		}
+		for(; j < parent->child_num && parent->children[j] != inc->node; j++)
+			;
+		if(j == parent->child_num)
+			continue;
+		parent->children[j] = inc->doc->root;
+		inc->doc->root->parent = (XmlNode *) parent;
+		inc->doc->root = NULL;		/* Not a root any more, so xmlnode_destroy() leaves it alone. */
+		SHARED_LOCK();
+		doc->subdocs = list_prepend(doc->subdocs, inc->doc);
+		SHARED_UNLOCK();
+	}
+	mem_free(doc->include);
+	doc->include = NULL;
+	doc->include_num = doc->include_size = 0;
+}
 
+/* Traverse buffer, extracting tokens. Build nodes from tokens, and add to <parent> as fit. Recurse.
+ * Children are stacked above <base> until tree_build() closes the parent.
+*/
+static XmlNode * tree_parse(Parser *p, XmlNode *parent, size_t base, int *complete)
+{
 	if(complete == NULL)
 	{
 		static int	fake;
@@ -528,117 +926,443 @@ static XmlNode * tree_build(XmlNode *parent, const char **buffer, int *complete)
 
 	*complete = 1;
 
-	for(; *complete && **buffer;)
+	for(; *complete && (p->open || *p->pos);)
 	{
 		TokenStatus	st;
+		char		*token;
 
-		*buffer = token_get(*buffer, &token, &st);
-		if(st == ERROR)
+		if((st = token_get(p, &token)) == ERROR)
 		{
 			LOG_WARN(("XML parse error detected, aborting"));
 			*complete = 0;
 			return parent;
 		}
-		if(token != NULL)
+		if(st == TAG || st == TAGEMPTY)
 		{
-			if(st == TAG || st == TAGEMPTY)
+			if(token[0] == '?')
+				continue;
+			else if(token[0] == '/')
+			{
+				if(node_closes(parent, token))
+					return parent;
+				LOG_ERR(("Element nesting error in XML source, <%s> vs <%s>--aborting", token, parent != NULL ? xmlnode_get_name(parent) : ""));
+				*complete = 0;
+				return parent;
+			}
+			else
 			{
-				const char	*tag = dynstr_string(token);
+				XmlNode	*child = NULL, *subtree = NULL;
+
+				child = node_new(p->doc, token);
 
-				if(tag[0] == '?' || strncmp(tag, "!--", 3) == 0)
-					dynstr_truncate(token, 0);
-				else if(tag[0] == '/')
+				if(st == TAGEMPTY && child->atom != XMLNODE_ATOM_NONE && strcmp(xmlnode_get_name(child), "xi:include") == 0)	/* Use of xi:include? */
 				{
-					if(node_closes(parent, tag))
-					{
-						dynstr_destroy(token, 1);
-						return parent;
-					}
-					LOG_ERR(("Element nesting error in XML source, <%s> vs <%s>--aborting", tag, parent->element));
-					*complete = 0;
-					return parent;
+					XmlNode	*inc;
+
+					if(parent != NULL && p->doc->include_run != NULL && include_defer(p->doc, child))
+						;	/* Replaced by the included tree once the whole document is parsed. */
+					else if((inc = do_include(p->doc, xmlnode_attrib_get_value(child, "href"))) != NULL)
+						child = inc;
 				}
-				else
-				{
-					XmlNode	*child = NULL, *subtree = NULL;
 
-					child = node_new(tag);
-					dynstr_destroy(token, 1);
-					token = NULL;
+				if(st != TAGEMPTY)
+					subtree = tree_build(p, child, complete);
+				else
+					subtree = child;
+				if(parent != NULL && subtree != NULL)
+					node_child_add(parent, subtree);
+				else
+					parent = child;
+			}
+		}
+		else if(st == TEXT && *token != '\0')	/* If the text is empty, it was all whitespace. */
+		{
+			if(parent != NULL)
+				node_text_add(parent, base, token);
+			else
+				LOG_WARN(("Ignoring top-level text"));
+		}
+	}
+	return parent;
+}
 
-					if(st == TAGEMPTY && strcmp(xmlnode_get_name(child), "xi:include") == 0)	/* Use of xi:include? */
-					{
-						XmlNode	*inc;
+static XmlNode * tree_build(Parser *p, XmlNode *parent, int *complete)
+{
+	size_t	base = p->doc->stack_len;
 
-						if((inc = do_include(xmlnode_attrib_get_value(child, "href"))) != NULL)
-						{
-							xmlnode_destroy(child);
-							child = inc;
-						}
-					}
-					
-					if(st != TAGEMPTY)
-						subtree = tree_build(child, buffer, complete);
-					else
-						subtree = child;
-					if(parent != NULL && subtree != NULL)
-						node_child_add(parent, subtree);
-					else
-						parent = child;
-				}
-			}
-			else if(st == TEXT)
+	parent = tree_parse(p, parent, base, complete);
+	node_children_close(p->doc, parent, base);
+	return parent;
+}
+
+static void doc_destroy(XmlDoc *doc)
+{
+	List	*iter;
+
+	for(iter = doc->subdocs; iter != NULL; iter = list_next(iter))
+		doc_destroy(list_data(iter));
+	SHARED_LOCK();
+	list_destroy(doc->subdocs);
+	for(iter = doc->buffers; iter != NULL; iter = list_next(iter))
+		mem_free(list_data(iter));
+	list_destroy(doc->buffers);
+	SHARED_UNLOCK();
+	mem_free(doc->include);
+	mem_free(doc->stack);
+	hash_destroy(doc->atoms);
+	arena_destroy(doc->arena);	/* Takes the document along. */
+}
+
+XmlNode * xmlnode_new(const char *buffer)
+{
+	if(buffer == NULL)
+		return NULL;
+	return xmlnode_new_insitu(stu_strdup(buffer));
+}
+
+/* Create a new, empty, document. It owns <buffer>, if non-NULL. */
+static XmlDoc * doc_new(char *buffer)
+{
+	Arena	*arena;
+	XmlDoc	*doc;
+
+	if((arena = arena_new(DOC_ARENA_SIZE)) == NULL)
+		return NULL;
+	doc = arena_alloc(arena, sizeof *doc);
+	doc->root    = NULL;
+	SHARED_LOCK();
+	doc->buffers = buffer != NULL ? list_prepend(NULL, buffer) : NULL;
+	doc->loader  = LoaderInfo.loader;
+	doc->loader_user = LoaderInfo.user;
+	SHARED_UNLOCK();
+	doc->subdocs = NULL;
+	doc->arena   = arena;
+	doc->stack   = NULL;
+	doc->stack_len = doc->stack_size = 0;
+	doc->include_run = NULL;
+	doc->include_threads = 0;
+	doc->include = NULL;
+	doc->include_num = doc->include_size = 0;
+	doc->atoms   = LockInfo.lock != NULL ? hash_new_string() : NULL;
+	return doc;
+}
+
+XmlNode * xmlnode_new_insitu(char *buffer)
+{
+	return xmlnode_new_insitu_loader(buffer, NULL, NULL);
+}
+
+XmlNode * xmlnode_new_insitu_loader(char *buffer, char * (*loader)(const char *uri, void *user), void *user)
+{
+	XmlDoc	*doc;
+	Parser	p;
+	XmlNode	*root;
+	int	complete;
+
+	if(buffer == NULL)
+		return NULL;
+	if((doc = doc_new(buffer)) == NULL)
+		return NULL;
+	if(loader != NULL)
+	{
+		doc->loader = loader;
+		doc->loader_user = user;
+	}
+	doc->include_run = IncludeJobs.run;
+	doc->include_threads = IncludeJobs.threads;
+	parser_init(&p, doc, buffer);
+	root = tree_build(&p, NULL, &complete);
+	if(root == NULL || !complete)
+	{
+		doc_destroy(doc);
+		return NULL;
+	}
+	if(doc->include_num > 0)
+		includes_resolve(doc);
+	doc->root = root;
+	mem_free(doc->stack);	/* Only needed while parsing. */
+	doc->stack = NULL;
+	hash_destroy(doc->atoms);
+	doc->atoms = NULL;
+	doc->stack_size = 0;
+	return root;
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+static int names_push(NameStack *ns, const char *name)
+{
+	size_t	len = strlen(name) + 1;
+
+	if(ns->len + len > ns->size)
+	{
+		size_t	size = ns->size > 0 ? ns->size : 256;
+		char	*nb;
+
+		while(size < ns->len + len)
+			size *= 2;
+		if((nb = mem_realloc(ns->buf, size)) == NULL)
+		{
+			LOG_ERR(("Failed to grow XML element name stack"));
+			return 0;
+		}
+		ns->buf  = nb;
+		ns->size = size;
+	}
+	memcpy(ns->buf + ns->len, name, len);
+	ns->len += len;
+	return 1;
+}
+
+/* Return the name of the innermost open element, or NULL if there is none. */
+static const char * names_top(const NameStack *ns)
+{
+	const char	*top;
+
+	if(ns->len == 0)
+		return NULL;
+	for(top = ns->buf + ns->len - 1; top > ns->buf && top[-1] != '\0'; top--)
+		;
+	return top;
+}
+
+static void names_pop(NameStack *ns)
+{
+	const char	*top;
+
+	if((top = names_top(ns)) != NULL)
+		ns->len = top - ns->buf;
+}
+
+static int	events_parse(Parser *p, const XmlNodeEvents *events, void *user);
+
+/* Report the contents of the resource referenced by an xi:include element, instead of the element
+ * itself. Returns 0 if the resource could not be loaded, so the element should be reported.
+*/
+static int events_include(Parser *p, const char *href, const XmlNodeEvents *events, void *user)
+{
+	Parser	sub;
+	char	*buf;
+
+	if(href == NULL)
+	{
+		LOG_WARN(("Broken xi:include element, missing 'href' attribute--skipping"));
+		return 0;
+	}
+	if((buf = LoaderInfo.loader(href, LoaderInfo.user)) == NULL)
+	{
+		LOG_WARN(("Failed to load xi:include resource \"%s\"--skipping", href));
+		return 0;
+	}
+	parser_init(&sub, NULL, buf);
+	sub.scratch = p->scratch;
+	if(!events_parse(&sub, events, user))
+		LOG_WARN(("Failed to parse included resource \"%s\"", href));
+	mem_free(buf);
+	return 1;
+}
+
+/* Extract tokens, and report elements and texts through <events> as they are found. Nothing is
+ * kept, except the names of the open elements. Returns 0 on parse error.
+*/
+static int events_parse(Parser *p, const XmlNodeEvents *events, void *user)
+{
+	NameStack	names = { NULL, 0, 0 };
+	size_t		skip = 0;	/* Nesting depth inside a skipped element. */
+	int		ok = 1;
+
+	while(ok)
+	{
+		TokenStatus	st;
+		char		*token;
+		XmlNode		node;
+
+		if(!(ok = parser_ensure(p)) || (!p->open && *p->pos == '\0'))
+			break;
+		if((st = token_get(p, &token)) == ERROR)
+		{
+			LOG_WARN(("XML parse error detected, aborting"));
+			ok = 0;
+		}
+		else if(st == TEXT)
+		{
+			if(skip == 0 && *token != '\0' && events->text != NULL)
+				events->text(token, user);
+		}
+		else if(st == COMMENT || token[0] == '?')
+			;
+		else if(token[0] == '/')
+		{
+			if(skip > 0)
+				skip--;
+			else if(name_closes(names_top(&names), token))
 			{
-				dynstr_trim(token);
-				if(dynstr_length(token) > 0)
-				{
-					if(parent != NULL)
-						node_text_add(parent, token);
-					else
-					{
-						LOG_WARN(("Ignoring top-level text"));
-						dynstr_destroy(token, 1);
-					}
-					token = NULL;
-				}
-				else	/* If the text disappeared, it was all whitespace. Free the token. */
-				{
-					dynstr_destroy(token, 1);
-					token = NULL;
-				}
+				if(events->element_end != NULL)
+					events->element_end(names_top(&names), user);
+				names_pop(&names);
 			}
-			else if(st == COMMENT)		/* Ignore this comment. */
+			else
 			{
-				dynstr_destroy(token, 1);
-				token = NULL;
+				LOG_ERR(("Element nesting error in XML source, <%s> vs <%s>--aborting", token, names.len > 0 ? names_top(&names) : ""));
+				ok = 0;
 			}
 		}
+		else if(skip > 0)
+			skip += st == TAG;
 		else
-			break;
+		{
+			arena_clear(p->scratch);
+			node_init(&node, NULL, p->scratch, token);
+			if(st == TAGEMPTY && node.atom != XMLNODE_ATOM_NONE && strcmp(xmlnode_get_name(&node), "xi:include") == 0 &&
+			   events_include(p, xmlnode_attrib_get_value(&node, "href"), events, user))
+				continue;
+			if(events->element_start != NULL && !events->element_start(&node, user))
+				skip = st == TAG;
+			else if(st == TAGEMPTY)
+			{
+				if(events->element_end != NULL)
+					events->element_end(node.atom != XMLNODE_ATOM_NONE ? xmlnode_get_name(&node) : "", user);
+			}
+			else
+				ok = names_push(&names, node.atom != XMLNODE_ATOM_NONE ? xmlnode_get_name(&node) : "");
+		}
 	}
-	return parent;
+	/* Like the tree builder, accept elements left open at the end of the input. */
+	for(; ok && names.len > 0; names_pop(&names))
+	{
+		if(events->element_end != NULL)
+			events->element_end(names_top(&names), user);
+	}
+	mem_free(names.buf);
+	return ok;
 }
 
-XmlNode * xmlnode_new(const char *buffer)
+int xmlnode_parse_file(const char *filename, const XmlNodeEvents *events, void *user)
 {
-	XmlNode	*root;
-	int	complete;
+	Parser	p;
+	int	ok;
 
-	if(buffer == NULL)
+	if(filename == NULL || events == NULL)
+		return 0;
+	parser_init(&p, NULL, NULL);
+	if((p.in = fopen(filename, "rb")) == NULL)
+	{
+		LOG_WARN(("Couldn't open \"%s\" for parsing", filename));
+		return 0;
+	}
+	p.size    = STREAM_WINDOW;
+	p.buf     = p.pos = mem_alloc(p.size);
+	p.buf[0]  = '\0';
+	p.eof     = 0;
+	p.scratch = arena_new(4 << 10);
+	ok = events_parse(&p, events, user);
+	fclose(p.in);
+	mem_free(p.buf);
+	arena_destroy(p.scratch);
+	return ok;
+}
+
+/* ----------------------------------------------------------------------------------------- */
+
+/* State for building a tree out of parse events, copying the strings as they stream past. */
+typedef struct
+{
+	XmlDoc		*doc;
+	XmlNode		*current;	/* Innermost open element. */
+	size_t		*base;		/* Document stack base for each open element. */
+	size_t		depth, base_size;
+	int		(*keep)(const XmlNode *node, void *user);
+	void		*user;
+} TreeBuilder;
+
+static int builder_start(const XmlNode *node, void *user)
+{
+	TreeBuilder	*tb = user;
+	XmlNode		*parent = tb->current != NULL ? tb->current : tb->doc->root, *copy;
+
+	((XmlNode *) node)->parent = parent;	/* Give the filter some context. */
+	if(tb->keep != NULL && !tb->keep(node, tb->user))
+		return 0;
+	if(tb->depth >= tb->base_size)
+	{
+		size_t	ns = tb->base_size > 0 ? 2 * tb->base_size : 32, *nb;
+
+		if((nb = mem_realloc(tb->base, ns * sizeof *nb)) == NULL)
+			return 0;
+		tb->base = nb;
+		tb->base_size = ns;
+	}
+	if((copy = node_copy(tb->doc, node)) == NULL)
+		return 0;
+	if(parent == NULL)
+		tb->doc->root = copy;
+	else
+		node_child_add(parent, copy);
+	tb->base[tb->depth++] = tb->doc->stack_len;
+	tb->current = copy;
+	return 1;
+}
+
+static void builder_text(const char *text, void *user)
+{
+	TreeBuilder	*tb = user;
+
+	if(tb->current != NULL)
+		node_text_add(tb->current, tb->base[tb->depth - 1], doc_strdup(tb->doc, text));
+	else if(tb->doc->root != NULL)	/* Trailing top-level text goes to the root, like in tree_build(). */
+		node_text_add(tb->doc->root, 0, doc_strdup(tb->doc, text));
+	else
+		LOG_WARN(("Ignoring top-level text"));
+}
+
+static void builder_end(const char *element, void *user)
+{
+	TreeBuilder	*tb = user;
+
+	if(tb->depth == 0)
+		return;
+	node_children_close(tb->doc, tb->current, tb->base[--tb->depth]);
+	tb->current = tb->depth > 0 ? tb->current->parent : NULL;
+}
+
+XmlNode * xmlnode_new_from_file(const char *filename, int (*keep)(const XmlNode *node, void *user), void *user)
+{
+	const XmlNodeEvents	events = { builder_start, builder_text, builder_end };
+	TreeBuilder		tb;
+	XmlNode			*root;
+	int			ok;
+
+	if((tb.doc = doc_new(NULL)) == NULL)
 		return NULL;
-	root = tree_build(NULL, &buffer, &complete);
-	if(!complete)
+	tb.current = NULL;
+	tb.base    = NULL;
+	tb.depth   = tb.base_size = 0;
+	tb.keep    = keep;
+	tb.user    = user;
+	ok = xmlnode_parse_file(filename, &events, &tb);
+	mem_free(tb.base);
+	if(!ok || (root = tb.doc->root) == NULL)
 	{
-		xmlnode_destroy(root);
+		doc_destroy(tb.doc);
 		return NULL;
 	}
-	tree_reverse_children(root);
+	node_children_close(tb.doc, root, 0);	/* Trailing top-level elements, if any. */
+	mem_free(tb.doc->stack);
+	tb.doc->stack = NULL;
+	hash_destroy(tb.doc->atoms);
+	tb.doc->atoms = NULL;
+	tb.doc->stack_size = 0;
 	return root;
 }
 
 const char * xmlnode_get_name(const XmlNode *node)
 {
-	return node != NULL ? node->element : NULL;
+	return node != NULL ? xmlnode_atom_name(node->atom) : NULL;
+}
+
+XmlAtom xmlnode_get_atom(const XmlNode *node)
+{
+	return node != NULL ? node->atom : XMLNODE_ATOM_NONE;
 }
 
 void xmlnode_set_user(XmlNode *node, void *user)
@@ -652,150 +1376,289 @@ void * xmlnode_get_user(const XmlNode *node)
 	return node != NULL ? node->user : NULL;
 }
 
-const char * xmlnode_attrib_get_value(const XmlNode *node, const char *name)
+const char * xmlnode_get_text(const XmlNode *node)
+{
+	return node != NULL ? node->text : NULL;
+}
+
+XmlNode * xmlnode_get_parent(const XmlNode *node)
+{
+	return node != NULL ? node->parent : NULL;
+}
+
+size_t xmlnode_child_num(const XmlNode *node)
+{
+	return node != NULL ? node->child_num : 0;
+}
+
+XmlNode * xmlnode_child_get(const XmlNode *node, size_t index)
 {
-	int	lo, hi;
+	if(node == NULL || index >= node->child_num)
+		return NULL;
+	return node->children[index];
+}
 
+const char * xmlnode_attrib_get_value(const XmlNode *node, const char *name)
+{
 	if(node == NULL || name == NULL || node->attrib == NULL)
 		return NULL;
+	return xmlnode_attrib_get_value_atom(node, xmlnode_atom_find(name));
+}
 
-	for(lo = 0, hi = node->attrib_num; lo <= hi;)
-	{
-		int	mid = (lo + hi) / 2, rel;
+const char * xmlnode_attrib_get_value_atom(const XmlNode *node, XmlAtom name)
+{
+	size_t	i;
 
-		rel = strcmp(name, node->attrib[mid].name);
-		if(rel == 0)
-			return node->attrib[mid].value;
-		else if(rel < 0)
-			hi = mid - 1;
-		else
-			lo = mid + 1;
+	if(node == NULL || name == XMLNODE_ATOM_NONE)
+		return NULL;
+	/* Elements have few attributes, so a linear scan comparing integers is plenty fast. */
+	for(i = 0; i < node->attrib_num; i++)
+	{
+		if(node->attrib[i].name == name)
+			return node->attrib[i].value;
 	}
 	return NULL;
 }
 
 /* ----------------------------------------------------------------------------------------- */
 
-List * filter_list(List *list, void **filter)
+/* A compiled filter program. The tests are grouped per step: step 0 tests the start node itself,
+ * and each further step descends one level, to the children of the nodes matched so far.
+*/
+typedef struct
+{
+	int		type;
+	XmlAtom		atom;		/* Name to test, unless it's a prefix. */
+	const char	*name, *value;
+	size_t		len;
+} QueryTest;
+
+#define	QUERY_MAX	32	/* Same limit as on the varargs filter vector. */
+
+struct XmlNodeQuery
+{
+	size_t		step_num;			/* Number of child steps. */
+	size_t		first[XMLNODE_QUERY_DEPTH + 2];	/* Tests of step i are test[first[i]] up to test[first[i + 1]]. */
+	size_t		test_num;
+	QueryTest	test[QUERY_MAX];
+};
+
+/* Compile a filter vector, as accepted by xmlnode_nodeset_get(), into a query. */
+static int query_compile(XmlNodeQuery *q, void **filter)
 {
 	int	cmd;
 
-	while(1)
+	q->step_num = 0;
+	q->test_num = 0;
+	q->first[0] = 0;
+	while((cmd = (int) *filter++) != XMLNODE_FILTER_ACCEPT)
 	{
-		cmd = (int) *filter++;
+		QueryTest	*t;
+
 		switch(cmd)
 		{
-		case XMLNODE_FILTER_ACCEPT:
-			return list;
-		case XMLNODE_AXIS_SELF:		/* Fall-through. */
-		case XMLNODE_AXIS_ANCESTOR:
+		case XMLNODE_AXIS_SELF:
+			continue;
 		case XMLNODE_AXIS_CHILD:
+			if(q->step_num >= XMLNODE_QUERY_DEPTH)
+			{
+				LOG_WARN(("Query too deep, can't have more than %d child steps", XMLNODE_QUERY_DEPTH));
+				return 0;
+			}
+			q->first[++q->step_num] = q->test_num;
+			continue;
+		case XMLNODE_AXIS_ANCESTOR:
 		case XMLNODE_AXIS_PREDECESSOR:
 		case XMLNODE_AXIS_SUCCESSOR:
-			switch((int) cmd)
-			{
-			case XMLNODE_AXIS_CHILD:
-				{
-					List	*clist = NULL;
-					XmlNode	*here;
+			printf("Can't filter axis %d, code missing\n", cmd);
+			continue;
+		}
+		if(q->test_num >= QUERY_MAX)
+			return 0;
+		t = &q->test[q->test_num++];
+		t->type = cmd;
+		t->name = *filter++;
+		t->atom = XMLNODE_ATOM_NONE;
+		t->value = NULL;
+		t->len = 0;
+		if(cmd == XMLNODE_FILTER_ATTRIB_VALUE)
+			t->value = *filter++;
+		else if(cmd != XMLNODE_FILTER_NAME && cmd != XMLNODE_FILTER_NAME_PREFIX && cmd != XMLNODE_FILTER_ATTRIB)
+		{
+			LOG_WARN(("Unknown filter code %d in query", cmd));
+			return 0;
+		}
+		if(cmd == XMLNODE_FILTER_NAME_PREFIX)
+			t->len = strlen(t->name);
+		else
+			t->atom = xmlnode_atom(t->name);
+	}
+	q->first[q->step_num + 1] = q->test_num;
+	return 1;
+}
 
-					for(; (here = list_data(list)) != NULL; list = list_next(list))
-					{
-						const List	*iter;
+/* Check if <node> passes the tests of the given step. */
+static int query_match(const XmlNodeQuery *q, size_t step, const XmlNode *node)
+{
+	const QueryTest	*t, *end = q->test + q->first[step + 1];
+	const char	*v;
 
-						for(iter = here->children; iter != NULL; iter = list_next(iter))
-							clist = list_append(clist, list_data(iter));
-					}
-					list_destroy(list);
-					list = clist;
-				}
-				break;
-			default:
-				printf("Can't filter axis %d, code missing\n", cmd);
-			}
-			break;
+	for(t = q->test + q->first[step]; t < end; t++)
+	{
+		switch(t->type)
+		{
 		case XMLNODE_FILTER_NAME:
-			{
-				const char	*name = *filter++;
-				List		*iter, *next;
-
-				for(iter = list; iter != NULL; iter = next)
-				{
-					next = list_next(iter);
-					if(strcmp(xmlnode_get_name(list_data(iter)), name) != 0)
-					{
-						list = list_unlink(list, iter);
-						list_destroy(iter);
-					}
-				}
-			}
+			if(node->atom != t->atom)
+				return 0;
 			break;
 		case XMLNODE_FILTER_NAME_PREFIX:
-			{
-				const char	*prefix = *filter++;
-				List		*iter, *next;
-				size_t		plen;
-
-				plen = strlen(prefix);
-				for(iter = list; iter != NULL; iter = list_next(iter))
-				{
-					next = list_next(iter);
-					if(strncmp(xmlnode_get_name(list_data(iter)), prefix, plen) != 0)
-					{
-						list = list_unlink(list, iter);
-						list_destroy(iter);
-					}
-				}
-			}
+			if(node->atom == XMLNODE_ATOM_NONE || strncmp(xmlnode_atom_name(node->atom), t->name, t->len) != 0)
+				return 0;
 			break;
 		case XMLNODE_FILTER_ATTRIB:
-			{
-				const char	*an = *filter++;
-				List		*iter, *next;
-
-				for(iter = list; iter != NULL; iter = next)
-				{
-					XmlNode	*here = list_data(iter);
-					next = list_next(iter);
-
-					if(xmlnode_attrib_get_value(here, an) == NULL)
-					{
-						list = list_unlink(list, iter);
-						list_destroy(iter);
-					}
-				}
-			}
+			if(xmlnode_attrib_get_value_atom(node, t->atom) == NULL)
+				return 0;
 			break;
 		case XMLNODE_FILTER_ATTRIB_VALUE:
-			{
-				const char	*an = *filter++, *av = *filter++;
-				List		*iter, *next;
+			if((v = xmlnode_attrib_get_value_atom(node, t->atom)) == NULL || strcmp(v, t->value) != 0)
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
 
-				for(iter = list; iter != NULL; iter = next)
-				{
-					const char	*nav;
-					XmlNode	*here = list_data(iter);
-					next = list_next(iter);
+/* Collect all matches below <node>, which has passed <step>, in document order. */
+static void query_collect(const XmlNodeQuery *q, size_t step, const XmlNode *node, ListHead *set)
+{
+	size_t	i;
 
-					if((nav = xmlnode_attrib_get_value(here, an)) == NULL ||
-					   strcmp(nav, av) != 0)
-					{
-						list = list_unlink(list, iter);
-						list_destroy(iter);
-					}
-				}
-			}
+	if(step == q->step_num)
+	{
+		list_head_append(set, (void *) node);
+		return;
+	}
+	for(i = 0; i < node->child_num; i++)
+	{
+		if(query_match(q, step + 1, node->children[i]))
+			query_collect(q, step + 1, node->children[i], set);
+	}
+}
+
+/* Find the first match below <node>, which has passed <step>. Nothing is allocated. */
+static XmlNode * query_find(const XmlNodeQuery *q, size_t step, const XmlNode *node)
+{
+	XmlNode	*hit;
+	size_t	i;
+
+	if(step == q->step_num)
+		return (XmlNode *) node;
+	for(i = 0; i < node->child_num; i++)
+	{
+		if(query_match(q, step + 1, node->children[i]) && (hit = query_find(q, step + 1, node->children[i])) != NULL)
+			return hit;
+	}
+	return NULL;
+}
+
+XmlNodeQuery * xmlnode_query_new(int axis, ...)
+{
+	XmlNodeQuery	*q;
+	void		*filter[QUERY_MAX];
+	size_t		filter_size;
+	va_list		va;
+
+	filter[0] = (void *) (size_t) axis;
+	va_start(va, axis);
+	for(filter_size = 1; filter_size < sizeof filter / sizeof *filter; filter_size++)
+	{
+		filter[filter_size] = va_arg(va, void *);
+		if(filter[filter_size] == (void *) 0)
 			break;
+	}
+	va_end(va);
+	if(axis == XMLNODE_FILTER_ACCEPT)
+		filter_size = 0;
+	if(filter_size == sizeof filter / sizeof *filter)
+		return NULL;
+	if((q = mem_alloc(sizeof *q)) != NULL)
+	{
+		if(query_compile(q, filter))
+			return q;
+		mem_free(q);
+	}
+	return NULL;
+}
+
+List * xmlnode_query_run(const XmlNodeQuery *query, const XmlNode *node)
+{
+	ListHead	set;
+
+	list_head_init(&set);
+	if(query != NULL && node != NULL && query_match(query, 0, node))
+		query_collect(query, 0, node, &set);
+	return list_head_detach(&set);
+}
+
+XmlNode * xmlnode_query_first(const XmlNodeQuery *query, const XmlNode *node)
+{
+	if(query != NULL && node != NULL && query_match(query, 0, node))
+		return query_find(query, 0, node);
+	return NULL;
+}
+
+void xmlnode_query_begin(XmlNodeCursor *cursor, const XmlNodeQuery *query, const XmlNode *node)
+{
+	cursor->query = query;
+	cursor->node[0] = node;
+	cursor->index[0] = 0;
+	cursor->level = (query != NULL && node != NULL && query_match(query, 0, node)) ? 0 : -1;
+}
+
+XmlNode * xmlnode_query_next(XmlNodeCursor *cursor)
+{
+	const XmlNodeQuery	*q = cursor->query;
+	const XmlNode		*parent, *child;
+
+	if(cursor->level < 0)
+		return NULL;
+	if(q->step_num == 0)	/* Matches just the start node. */
+	{
+		cursor->level = -1;
+		return (XmlNode *) cursor->node[0];
+	}
+	/* Resume the depth-first walk, one level per step, where the previous call left off. */
+	while(cursor->level >= 0)
+	{
+		parent = cursor->node[cursor->level];
+		if(cursor->index[cursor->level] >= parent->child_num)
+		{
+			cursor->level--;
+			continue;
 		}
+		child = parent->children[cursor->index[cursor->level]++];
+		if(!query_match(q, cursor->level + 1, child))
+			continue;
+		if((size_t) cursor->level + 1 == q->step_num)
+			return (XmlNode *) child;
+		cursor->level++;
+		cursor->node[cursor->level] = child;
+		cursor->index[cursor->level] = 0;
 	}
-	return list;
+	return NULL;
+}
+
+void xmlnode_query_destroy(XmlNodeQuery *query)
+{
+	mem_free(query);
 }
 
 List * xmlnode_nodeset_get(const XmlNode *node, ...)
 {
-	void	*filter[32];
-	size_t	filter_size;
-	va_list	va;
+	XmlNodeQuery	query;
+	void		*filter[QUERY_MAX];
+	size_t		filter_size;
+	va_list		va;
 
 	va_start(va, node);
 	for(filter_size = 0; filter_size < sizeof filter / sizeof *filter; filter_size++)
@@ -805,18 +1668,24 @@ List * xmlnode_nodeset_get(const XmlNode *node, ...)
 			break;
 	}
 	va_end(va);
-	return filter_list(list_append(NULL, (void *) node), filter);
+	if(filter_size == sizeof filter / sizeof *filter || !query_compile(&query, filter))
+		return NULL;
+	return xmlnode_query_run(&query, node);
 }
 
 /* Evaluate micro-minimalistic "dialect" (I use the term loosely) xpath-like expression.
  * The "single" means that this is guaranteed not to return a nodeset, it will simply
  * take the first result it finds. Preferrably used where the single result is the only.
+ * Each step stops at the first matching child, and nothing is allocated.
 */
 const char * xmlnode_eval_single(const XmlNode *node, const char *path)
 {
 	char		part[256], *put;			/* Static limits rule. */
-	List		*res;
+	XmlAtom		atom;
+	size_t		i;
 
+	if(node == NULL)
+		return NULL;
 	while(*path)
 	{
 		for(put = part; *path && *path != '/' && (size_t) (put - part) < sizeof part - 1;)
@@ -828,14 +1697,13 @@ const char * xmlnode_eval_single(const XmlNode *node, const char *path)
 			break;
 		if(part[0] == '@')
 			return xmlnode_attrib_get_value(node, part + 1);
-		res = xmlnode_nodeset_get(node, XMLNODE_AXIS_CHILD, XMLNODE_NAME(part), XMLNODE_DONE);
-		if(res != NULL)
-		{
-			node = list_data(res);
-			list_destroy(res);
-		}
-		else
+		if((atom = xmlnode_atom_find(part)) == XMLNODE_ATOM_NONE)
+			return NULL;	/* Never seen, so can't be a child. */
+		for(i = 0; i < node->child_num && node->children[i]->atom != atom; i++)
+			;
+		if(i == node->child_num)
 			return NULL;
+		node = node->children[i];
 	}
 	return node != NULL ? node->text : NULL;
 }
@@ -844,11 +1712,11 @@ const char * xmlnode_eval_single(const XmlNode *node, const char *path)
 
 static void iter_traverse(const XmlNode *node, List **list)
 {
-	const List	*iter;
+	size_t	i;
 
 	*list = list_prepend(*list, (void *) node);	/* Prepend, for more speed. */
-	for(iter = node->children; iter != NULL; iter = list_next(iter))
-		iter_traverse(list_data(iter), list);
+	for(i = 0; i < node->child_num; i++)
+		iter_traverse(node->children[i], list);
 }
 
 List * xmlnode_iter_begin(const XmlNode *root)
@@ -894,30 +1762,44 @@ const List * xmlnode_iter_next(const List *list, const XmlNode *skip)
 
 /* ----------------------------------------------------------------------------------------- */
 
+/* A qsort() comparison callback for attribute name ordering, so outlines don't depend on source order. */
+static int cmp_attr(const void *a, const void *b)
+{
+	const Attrib	*aa = a, *ab = b;
+
+	return strcmp(xmlnode_atom_name(aa->name), xmlnode_atom_name(ab->name));
+}
+
 /* Worker function to print outline of a node hierarchy. */
 static void do_print_outline(const XmlNode *root, int indent)
 {
-	int		i;
-	const List	*iter;
+	int	i;
 
 	for(i = 0; i < indent; i++)
 		putchar(' ');
-	if(root->element != NULL)
-		printf("%s%s", root->element, root->text != NULL ? " : " : "");
+	if(root->atom != XMLNODE_ATOM_NONE)
+		printf("%s%s", xmlnode_get_name(root), root->text != NULL ? " : " : "");
 	if(root->text != NULL)
 		printf("\"%s\"", root->text);
 	if(root->attrib_num > 0)
 	{
 		size_t	i;
+		Attrib	*attr;
 
-		printf(" [");
-		for(i = 0; i < root->attrib_num; i++)
-			printf(" %s=\"%s\"", root->attrib[i].name, root->attrib[i].value);
-		printf(" ]");
+		if((attr = mem_alloc(root->attrib_num * sizeof *attr)) != NULL)
+		{
+			memcpy(attr, root->attrib, root->attrib_num * sizeof *attr);
+			qsort(attr, root->attrib_num, sizeof *attr, cmp_attr);
+			printf(" [");
+			for(i = 0; i < root->attrib_num; i++)
+				printf(" %s=\"%s\"", xmlnode_atom_name(attr[i].name), attr[i].value);
+			printf(" ]");
+			mem_free(attr);
+		}
 	}
 	putchar('\n');
-	for(iter = root->children; iter != NULL; iter = list_next(iter))
-		do_print_outline(list_data(iter), indent + 1);
+	for(i = 0; i < (int) root->child_num; i++)
+		do_print_outline(root->children[i], indent + 1);
 }
 
 void xmlnode_print_outline(const XmlNode *root)
@@ -926,19 +1808,13 @@ void xmlnode_print_outline(const XmlNode *root)
 		do_print_outline(root, 0);
 }
 
+/* Nodes are owned by their document's arena, so only destroying the root does anything. */
 void xmlnode_destroy(XmlNode *root)
 {
-	List	*iter;
-
 	if(root == NULL)
 		return;
-
-	for(iter = root->children; iter != NULL; iter = list_next(iter))
-		xmlnode_destroy(list_data(iter));
-	list_destroy(root->children);
-	mem_free(root->text);
-	mem_free(root->attrib);
-	mem_free(root);
+	if(root->doc != NULL && root->doc->root == root)
+		doc_destroy(root->doc);
 }
 
 #if defined STANDALONE
@@ -947,6 +1823,7 @@ int main(int argc, char *argv[])
 {
 	int	i;
 
+	hash_init();
 	list_init();
 
 	for(i = 1; i < argc; i++)
@@ -957,7 +1834,7 @@ int main(int argc, char *argv[])
 		{
 			XmlNode	*xn;
 
-			if((xn = xmlnode_new(dynstr_string(ds))) != NULL)
+			if((xn = xmlnode_new_insitu(dynstr_destroy(ds, 0))) != NULL)
 			{
 				xmlnode_print_outline(xn);
 				xmlnode_destroy(xn);
@@ -18,18 +18,87 @@
 
 typedef struct XmlNode	XmlNode;
 
+/* Element and attribute names are interned, and given small integer "atoms". The same name always
+ * gets the same atom, across all documents. Atoms are handed out in order starting at 1, so
+ * a program that interns a fixed set of names before parsing anything knows their values, and
+ * can switch on them.
+*/
+typedef unsigned int	XmlAtom;
+
+#define	XMLNODE_ATOM_NONE	0
+
+/* Intern <name>, returning its atom. */
+extern XmlAtom		xmlnode_atom(const char *name);
+/* Look up the atom of <name>, without interning it. Returns XMLNODE_ATOM_NONE if not known. */
+extern XmlAtom		xmlnode_atom_find(const char *name);
+extern const char *	xmlnode_atom_name(XmlAtom atom);
+
+/* Set the function used to load xi:include resources. It must return a NUL-terminated buffer
+ * allocated so that it can be free()d; the tree takes ownership of it, just like for
+ * xmlnode_new_insitu(), below.
+*/
 extern void		xmlnode_set_loader(char * (*loader)(const char *uri, void *user), void *user);
 
-/* Create XML parse tree from textual representation in <buffer>. */
+/* Allow trees to be built from several threads at once, each building its own. The parser then
+ * calls <lock> and <unlock> around all use of state shared between documents: the atom table and
+ * the (unlocked) list module. The loader function is called without the lock held, and must do
+ * any locking it needs itself. Pass NULLs to turn it off.
+*/
+extern void		xmlnode_set_lock(void (*lock)(void *user), void (*unlock)(void *user), void *user);
+
+/* Normally, xi:include resources are loaded and parsed as they are found. With this set, trees
+ * built by xmlnode_new_insitu() instead just note each include while parsing, and then load and
+ * parse them all once the including document is done, by calling <run>. It must call <func> once
+ * for each of the <num> items of <size> bytes in <items>, passing <user> along; it may do so from
+ * up to <threads> threads at once, in which case xmlnode_set_lock() must be used as well. Each
+ * included tree replaces its xi:include element, just as before. Pass NULL to turn it off.
+*/
+extern void		xmlnode_set_include_jobs(void (*run)(void *items, size_t num, size_t size, void (*func)(void *item, void *user), void *user, unsigned int threads), unsigned int threads);
+
+/* Create XML parse tree from textual representation in <buffer>. The buffer is copied. */
 extern XmlNode	*	xmlnode_new(const char *buffer);
 
+/* Create XML parse tree by streaming the named file through the event parser below, which means
+ * the file is never held in memory all at once. If <keep> is non-NULL, it is called with each
+ * element (whose parent is set, but which has no text or children yet) and can return 0 to leave
+ * the element and all of its contents out of the tree. Strings are copied into the tree.
+*/
+extern XmlNode *	xmlnode_new_from_file(const char *filename, int (*keep)(const XmlNode *node, void *user), void *user);
+
+/* Create XML parse tree in-situ, by decoding and splitting the text in <buffer> in place. The tree
+ * takes ownership of the buffer, which must have been allocated by mem_alloc() (for instance by
+ * dynstr_destroy(ds, 0) on a string from dynstr_new_from_file()), and frees it when destroyed.
+ * Attribute values and texts in the tree all point into the buffer.
+*/
+extern XmlNode	*	xmlnode_new_insitu(char *buffer);
+
+/* As xmlnode_new_insitu(), but xi:include resources are loaded through <loader> rather than the
+ * function set by xmlnode_set_loader(). Handy when building several trees concurrently.
+*/
+extern XmlNode	*	xmlnode_new_insitu_loader(char *buffer, char * (*loader)(const char *uri, void *user), void *user);
+
 extern const char *	xmlnode_get_name(const XmlNode *node);
+extern XmlAtom		xmlnode_get_atom(const XmlNode *node);
 
 extern void		xmlnode_set_user(XmlNode *node, void *user);
 extern void *		xmlnode_get_user(const XmlNode *node);
 
+/* Get the (first) text content of a node, or NULL if there is none. */
+extern const char *	xmlnode_get_text(const XmlNode *node);
+
+extern XmlNode *	xmlnode_get_parent(const XmlNode *node);
+
+/* Index-based access to the children of a node, which are stored contiguously in document
+ * order. This is cheaper than xmlnode_nodeset_get() for plain scans, since nothing is copied:
+ *
+ * for(i = 0; (child = xmlnode_child_get(node, i)) != NULL; i++) ...
+*/
+extern size_t		xmlnode_child_num(const XmlNode *node);
+extern XmlNode *	xmlnode_child_get(const XmlNode *node, size_t index);
+
 /* Get value of named <attribute>. */
 extern const char *	xmlnode_attrib_get_value(const XmlNode *node, const char *attribute);
+extern const char *	xmlnode_attrib_get_value_atom(const XmlNode *node, XmlAtom attribute);
 
 /* Constants used when filtering out nodesets. */
 typedef enum
@@ -57,6 +126,42 @@ typedef enum
 */
 extern List *		xmlnode_nodeset_get(const XmlNode *node, ...);
 
+/* Precompiled queries, for filters that are used over and over. The arguments are as for
+ * xmlnode_nodeset_get(), and any strings must outlive the query (literals are fine). Only the
+ * child (and self) axes are supported.
+ *
+ * q = xmlnode_query_new(XMLNODE_AXIS_CHILD, XMLNODE_NAME("links"), XMLNODE_AXIS_CHILD, XMLNODE_NAME("link"), XMLNODE_DONE);
+*/
+typedef struct XmlNodeQuery	XmlNodeQuery;
+
+#define	XMLNODE_QUERY_DEPTH	16	/* Maximum number of child steps in a query. */
+
+extern XmlNodeQuery *	xmlnode_query_new(int axis, ...);
+
+/* Run query from <node>, returning all matches in a list, just like xmlnode_nodeset_get(). */
+extern List *		xmlnode_query_run(const XmlNodeQuery *query, const XmlNode *node);
+
+/* Return the first match only, or NULL. The search stops as soon as a match is found. */
+extern XmlNode *	xmlnode_query_first(const XmlNodeQuery *query, const XmlNode *node);
+
+/* Lazy iteration over the matches, without building a list. The cursor can live on the stack:
+ *
+ * xmlnode_query_begin(&c, q, node);
+ * while((hit = xmlnode_query_next(&c)) != NULL) ...
+*/
+typedef struct
+{
+	const XmlNodeQuery	*query;
+	const XmlNode		*node[XMLNODE_QUERY_DEPTH + 1];
+	size_t			index[XMLNODE_QUERY_DEPTH + 1];
+	int			level;
+} XmlNodeCursor;
+
+extern void		xmlnode_query_begin(XmlNodeCursor *cursor, const XmlNodeQuery *query, const XmlNode *node);
+extern XmlNode *	xmlnode_query_next(XmlNodeCursor *cursor);
+
+extern void		xmlnode_query_destroy(XmlNodeQuery *query);
+
 /*
  * xmlnode_eval_single(root, "at/node");
 */
@@ -70,10 +175,30 @@ extern List *		xmlnode_iter_begin(const XmlNode *root);
 */
 extern const List *	xmlnode_iter_next(const List *list, const XmlNode *skip);
 
+/* Callbacks for event-driven parsing, which reports elements and texts as they are found instead
+ * of building a tree. The node given to element_start() has a name and attributes, but is only
+ * valid during the call; returning 0 skips the element's contents, and its element_end(). Texts
+ * are reported trimmed and with entities decoded, and are also only valid during the call. Any
+ * callback can be NULL. Included (xi:include) resources are reported in place of the element.
+*/
+typedef struct
+{
+	int	(*element_start)(const XmlNode *node, void *user);
+	void	(*text)(const char *text, void *user);
+	void	(*element_end)(const char *element, void *user);
+} XmlNodeEvents;
+
+/* Parse the named file in a streaming fashion, reporting through <events>. Memory use is bounded
+ * by the largest single token, not the file size. Returns 0 on error.
+*/
+extern int		xmlnode_parse_file(const char *filename, const XmlNodeEvents *events, void *user);
+
 /* Print outline of XML parse tree rooted at <root>. Mainly for debugging. */
 extern void		xmlnode_print_outline(const XmlNode *root);
 
-/* Destroy an XML parse tree. */
+/* Destroy an XML parse tree. All nodes live in a per-document arena, so this is cheap, and
+ * only has an effect when called on the root returned by xmlnode_new() or xmlnode_new_insitu().
+*/
 extern void		xmlnode_destroy(XmlNode *root);
 
 #endif		/* XMLNODE_H */